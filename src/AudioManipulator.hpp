@@ -3,8 +3,11 @@
 
 #include "portaudio.h"
 #include "buffers.hpp"
+#include "RTCheck.hpp"
+#include "DenormalGuard.hpp"
 #include <cmath>
 #include "time.h"
+#include <atomic>
 #include <vector>
 
 typedef union {
@@ -46,7 +49,20 @@ class AudioManipulator {
         int nCH = 0;
         unsigned long rbLen = 0;
         PaStream* aStream = nullptr;
+        // dataBuf: ring buffer the producer writes to.
+        // readBuf: ring buffer the consumer reads from. After resizeRingBuffer(),
+        // the new ring is handed over through pendingBuf; the consumer switches once
+        // readBuf is drained and gives the old one back through retiredBuf.
         ring_buffer<AudioData>* dataBuf = nullptr;
+        std::atomic<ring_buffer<AudioData>*> readBuf{nullptr};
+        std::atomic<ring_buffer<AudioData>*> pendingBuf{nullptr};
+        std::atomic<ring_buffer<AudioData>*> retiredBuf{nullptr};
+        bool autoResize = false;
+        unsigned long autoResizeMin = 0;
+        unsigned long autoResizeMax = 0;
+        double autoResizeQuiet = 30.0;
+        double lastUnderrunTime = 0.0;
+        unsigned long lastUnderrunCount = 0;
         bool writeReady = false;
         std::vector<int> inputList;
         std::vector<int> outputList;
@@ -57,9 +73,39 @@ class AudioManipulator {
         bool isOpened = false;
         unsigned long txCbFrameCount = 0;
         unsigned long rxCbFrameCount = 0;
+        unsigned long framesPerBuffer = 0;
+        std::atomic<unsigned long> cbXrunCount{0};
+        std::atomic<unsigned long> rbUnderrunCount{0};
+        std::atomic<unsigned long> rbOverrunCount{0};
+        // clock snapshot of the latest output callback (seqlock: odd while being written)
+        std::atomic<uint32_t> clockSeq{0};
+        std::atomic<double> clockDacTime{0};
+        std::atomic<uint64_t> clockCbFrames{0};
+        std::atomic<uint64_t> clockRbFrames{0};
+        std::atomic<uint32_t> clockFileId{0};
+        std::atomic<double> clockFileFrame{-1};
+        std::atomic<double> clockJitter{0};
+        std::atomic<bool> clockEstimated{false};
+        std::atomic<unsigned long> clockCbLength{0};
+        uint64_t cbFramesTotal = 0;
+        uint64_t rbFramesTotal = 0;
+        double prevDacTime = -1;
+        unsigned long prevFrameCount = 0;
+        double dacJitter = 0;
+        // position markers: producer -> callback (SPSC)
+        struct PositionMarker {
+            uint64_t ringFrame;   // cumulative ring frame the marker applies to
+            uint32_t fileId;
+            uint64_t fileFrame;
+        };
+        static constexpr uint32_t markerCapacity = 1024;
+        PositionMarker markers[markerCapacity];
+        std::atomic<uint32_t> markerHead{0};
+        std::atomic<uint32_t> markerTail{0};
+        PositionMarker curMarker = {0, 0, 0};
+        bool hasMarker = false;
+        uint64_t rbWrittenFrames = 0;
         unsigned int lengthFactor = 1;
-        AudioData* zerodata = nullptr;
-        unsigned long zdlength = 0;
 
     public:
         unsigned long iFrameCount = 0;
@@ -78,6 +124,154 @@ class AudioManipulator {
         unsigned long getRxCbFrameCount(){
             return rxCbFrameCount;
         }
+        // underflow / overflow flags reported by PortAudio to the callback
+        void storeCbStatusFlags(PaStreamCallbackFlags statusFlags) {
+            if (statusFlags & (paOutputUnderflow | paInputOverflow)) {
+                cbXrunCount.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        unsigned long getCbXrunCount() {
+            return cbXrunCount.load(std::memory_order_relaxed);
+        }
+        // callbacks which found fewer samples in the ring buffer than requested
+        unsigned long getRbUnderrunCount() {
+            return rbUnderrunCount.load(std::memory_order_relaxed);
+        }
+        // writes which did not fit into the ring buffer (input: captured samples lost)
+        unsigned long getRbOverrunCount() {
+            return rbOverrunCount.load(std::memory_order_relaxed);
+        }
+        // callback side: DAC time of the first frame of this callback
+        // (estimated: the host API gave no timestamp, dacTime is the stream time)
+        void storeClock(double dacTime, unsigned long frameCount, bool estimated=false) {
+            // latest marker at or before the first ring frame of this callback
+            uint32_t tail = markerTail.load(std::memory_order_relaxed);
+            while (tail != markerHead.load(std::memory_order_acquire)) {
+                if (markers[tail % markerCapacity].ringFrame > rbFramesTotal) {
+                    break;
+                }
+                curMarker = markers[tail % markerCapacity];
+                hasMarker = true;
+                tail++;
+            }
+            markerTail.store(tail, std::memory_order_release);
+            // peak-hold of the deviation between DAC time steps and buffer lengths
+            if ((prevDacTime >= 0) && (fs > 0)) {
+                double deviation = fabs((dacTime - prevDacTime) - prevFrameCount/fs);
+                dacJitter = (deviation > dacJitter) ? deviation : dacJitter*0.999;
+            }
+            prevDacTime = dacTime;
+            prevFrameCount = frameCount;
+
+            uint32_t seq = clockSeq.load(std::memory_order_relaxed);
+            clockSeq.store(seq+1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_release);
+            clockDacTime.store(dacTime, std::memory_order_relaxed);
+            clockCbFrames.store(cbFramesTotal, std::memory_order_relaxed);
+            clockRbFrames.store(rbFramesTotal, std::memory_order_relaxed);
+            clockFileId.store(curMarker.fileId, std::memory_order_relaxed);
+            clockFileFrame.store(hasMarker ? (double)curMarker.fileFrame + (double)(rbFramesTotal - curMarker.ringFrame) : -1,
+                                 std::memory_order_relaxed);
+            clockJitter.store(dacJitter, std::memory_order_relaxed);
+            clockEstimated.store(estimated, std::memory_order_relaxed);
+            clockCbLength.store(frameCount, std::memory_order_relaxed);
+            clockSeq.store(seq+2, std::memory_order_release);
+            cbFramesTotal += frameCount;
+        }
+
+        // producer side: the ring frame written offset frames after the current write
+        // position is frame fileFrame of file fileId. Call before writing those frames.
+        bool pushPositionMarker(uint32_t fileId, uint64_t fileFrame, uint32_t offset=0) {
+            uint32_t head = markerHead.load(std::memory_order_relaxed);
+            if (head - markerTail.load(std::memory_order_acquire) >= markerCapacity) {
+                return false;
+            }
+            markers[head % markerCapacity] = {rbWrittenFrames + offset, fileId, fileFrame};
+            markerHead.store(head+1, std::memory_order_release);
+            return true;
+        }
+
+        // position at the DAC now, extrapolated from the latest callback.
+        // errorSeconds bounds timestamp jitter, clock drift since that callback and
+        // (without host timestamps) the output latency.
+        struct PlaybackPosition {
+            bool valid = false;
+            uint32_t fileId = 0;
+            double frame = 0;
+            double seconds = 0;
+            double errorSeconds = 0;
+        };
+        PlaybackPosition getPlaybackPosition() {
+            PlaybackPosition pos;
+            double dacTime = 0;
+            double fileFrame = -1;
+            double jitter = 0;
+            bool estimated = false;
+            unsigned long cbLength = 0;
+            bool consistent = false;
+            for (int retry=0; (retry<100) && !consistent; retry++) {
+                uint32_t seq = clockSeq.load(std::memory_order_acquire);
+                if ((seq & 1) || (seq == 0)) {
+                    continue;
+                }
+                dacTime = clockDacTime.load(std::memory_order_relaxed);
+                pos.fileId = clockFileId.load(std::memory_order_relaxed);
+                fileFrame = clockFileFrame.load(std::memory_order_relaxed);
+                jitter = clockJitter.load(std::memory_order_relaxed);
+                estimated = clockEstimated.load(std::memory_order_relaxed);
+                cbLength = clockCbLength.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                consistent = (clockSeq.load(std::memory_order_relaxed) == seq);
+            }
+            if (!consistent || (fileFrame < 0) || (fs <= 0) || isStopped) {
+                return pos;
+            }
+            double elapsed = getStreamTime() - dacTime;
+            if (isPaused) {
+                elapsed = 0;
+            }
+            pos.frame = fileFrame + elapsed*fs;
+            if (pos.frame < 0) {
+                pos.frame = 0;
+            }
+            pos.seconds = pos.frame / fs;
+            pos.errorSeconds = jitter + 0.5/fs + fabs(elapsed)*200e-6;
+            if (estimated) {
+                const PaStreamInfo* info = Pa_GetStreamInfo(aStream);
+                pos.errorSeconds += info ? info->outputLatency : (double)cbLength/fs;
+            }
+            pos.valid = true;
+            return pos;
+        }
+        double getStreamTime() {
+            if (!aStream) {
+                return 0;
+            }
+            return Pa_GetStreamTime(aStream);
+        }
+        // dacTime: DAC time of frame cbFrames (frames handed to the device, including zero fill),
+        // rbFrames: ring buffer frames consumed before it
+        bool getClockSnapshot(double& dacTime, uint64_t& cbFrames, uint64_t& rbFrames) {
+            for (int retry=0; retry<100; retry++) {
+                uint32_t seq = clockSeq.load(std::memory_order_acquire);
+                if (seq & 1) {
+                    continue;
+                }
+                dacTime = clockDacTime.load(std::memory_order_relaxed);
+                cbFrames = clockCbFrames.load(std::memory_order_relaxed);
+                rbFrames = clockRbFrames.load(std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (clockSeq.load(std::memory_order_relaxed) == seq) {
+                    return seq != 0;
+                }
+            }
+            return false;
+        }
+        void resetXrunCounts() {
+            cbXrunCount.store(0, std::memory_order_relaxed);
+            rbUnderrunCount.store(0, std::memory_order_relaxed);
+            rbOverrunCount.store(0, std::memory_order_relaxed);
+        }
         void initPortAudio() {
             parameters.hostApiSpecificStreamInfo = nullptr;
             //printf("PortAudio - Initializing...\n");
@@ -89,18 +283,19 @@ class AudioManipulator {
         }
         AudioManipulator(const int index, std::string dir,
                          const double fSample, const std::string format,
-                         const int channels, const unsigned long ringBufLength, const unsigned long chunkLength) {
+                         const int channels, const unsigned long ringBufLength, const unsigned long chunkLength,
+                         const unsigned long cbFrames=0, const double latency=-1) {
             initPortAudio();
+            framesPerBuffer = cbFrames;
 
             parameters.device = index;
             devInfo = Pa_GetDeviceInfo(index);
-            fs = fSample;
-            
-            zdlength = chunkLength*channels;
-            zerodata = new AudioData[zdlength];
-            for (uint32_t ctr=0; ctr<zdlength; ctr++) {
-                zerodata[ctr].s32 = 0;
+            if (!devInfo) {
+                fprintf(stderr, "PortAudio - invalid device index: %d\n", index);
+                openStatus = paInvalidDevice;
+                return;
             }
+            fs = fSample;
 
             if ((dir.compare("o") == 0) || (dir.compare("O") == 0)) {
                 output = true;
@@ -127,15 +322,21 @@ class AudioManipulator {
 
             if (output) {
                 parameters.suggestedLatency = (double)chunkLength / fSample;
+                if (latency >= 0) {
+                    parameters.suggestedLatency = latency;
+                }
                 nCH = channels;
                 if (devInfo->maxOutputChannels < channels) {
                     nCH = devInfo->maxOutputChannels;
                 }
                 parameters.channelCount = nCH;
                 openStatus = Pa_OpenStream(&aStream, nullptr, &parameters, fs,
-                            0, paNoFlag, txCallback, this);
+                            framesPerBuffer, paNoFlag, txCallback, this);
             } else {
                 parameters.suggestedLatency = (double)chunkLength / fSample;
+                if (latency >= 0) {
+                    parameters.suggestedLatency = latency;
+                }
                 nCH = channels;
                 if (devInfo->maxInputChannels < channels) {
                     nCH = devInfo->maxInputChannels;
@@ -143,7 +344,7 @@ class AudioManipulator {
                 }
                 parameters.channelCount = nCH;
                 openStatus = Pa_OpenStream(&aStream, &parameters, nullptr, fs,
-                            0, paNoFlag, rxCallback, this);
+                            framesPerBuffer, paNoFlag, rxCallback, this);
             }
             //printf("DEBUG:\n  aStream: %p\n", aStream);
             if (openStatus != 0) {
@@ -153,6 +354,7 @@ class AudioManipulator {
             }
             rbLen = ringBufLength*nCH;
             dataBuf = new ring_buffer<AudioData>(rbLen);
+            readBuf.store(dataBuf, std::memory_order_release);
             //printf("DEBUG:\n  dataBuf: %p\n", dataBuf);
             isOpened = true;
         }
@@ -164,14 +366,17 @@ class AudioManipulator {
             }
             close();
             terminate();
-            if (dataBuf) {
-                //printf("DEBUG(to free):\n  dataBuf:%p\n", dataBuf);
-                delete dataBuf;
-                dataBuf = nullptr;
+            reclaimRingBuffer();
+            if (pendingBuf.load() && (pendingBuf.load() != readBuf.load())) {
+                delete pendingBuf.load();
             }
-            if (zerodata) {
-                delete[] zerodata;
+            pendingBuf.store(nullptr);
+            if (readBuf.load()) {
+                //printf("DEBUG(to free):\n  dataBuf:%p\n", dataBuf);
+                delete readBuf.load();
+                readBuf.store(nullptr);
             }
+            dataBuf = nullptr;
         }
 
         bool isDeviceAvailable() {
@@ -204,6 +409,12 @@ class AudioManipulator {
             if (initStatus != paNoError) {
                 return;
             }
+            if (pendingBuf.load() && isStopped) {
+                // no consumer is running: finish a pending hand-over here
+                delete readBuf.load();
+                readBuf.store(pendingBuf.load());
+                pendingBuf.store(nullptr);
+            }
             if (dataBuf) {
                 dataBuf->init_buffer();
             }
@@ -254,6 +465,12 @@ class AudioManipulator {
             return 0;
         }
 
+        void prefault() {
+            if (dataBuf) {
+                dataBuf->prefault();
+            }
+        }
+
         void setWriteReady() {
             writeReady = true;
         }
@@ -263,7 +480,7 @@ class AudioManipulator {
 
         int write(AudioData* src, uint32_t length) {
             uint32_t remain = 0;
-            remain = getRbChunkLength() - getRbStoredChunkLength();
+            remain = getRbFreeChunkLength();
             if (openStatus != paNoError) {
                 return -1;
             }
@@ -273,15 +490,29 @@ class AudioManipulator {
             if (remain > length) {
                 dataBuf->put_data_memcpy(src, length*nCH/lengthFactor);
                 //dataBuf->put_data_arr_queue(src, length*nCH*lengthFactor);
+                rbWrittenFrames += length;
                 return 0;
             }
+            rbOverrunCount.fetch_add(1, std::memory_order_relaxed);
             if (remain > 0) {
                 dataBuf->put_data_memcpy(src, remain*nCH/lengthFactor);
+                rbWrittenFrames += remain;
                 return 0;
             }
             return 0;
         }
 
+        // consumer side for input streams: non-blocking, returns the frames read
+        uint32_t readAvailable(AudioData* dest, uint32_t maxLength) {
+            ring_buffer<AudioData>* cur = readBuf.load(std::memory_order_acquire);
+            if ((openStatus != paNoError) || !cur) {
+                return 0;
+            }
+            uint32_t total = maxLength*nCH/lengthFactor;
+            uint32_t readCount = cur->get_data_memcpy(dest, total);
+            return readCount*lengthFactor/nCH;
+        }
+
         int blockingWrite(AudioData* src, uint32_t length, long timeout=100) {
             if (openStatus != paNoError) {
                 return -1;
@@ -289,7 +520,7 @@ class AudioManipulator {
             timespec sleepTime = {};
             sleepTime.tv_nsec = 1000000; //1msec
             long timeoutCount = 0;
-            while (getRbStoredChunkLength() >= (getRbChunkLength()-length)) {
+            while (getRbFreeChunkLength() <= length) {
                 nanosleep(&sleepTime, nullptr);
                 timeoutCount += 1;
                 if (timeoutCount > timeout) {
@@ -300,41 +531,109 @@ class AudioManipulator {
             return 0;
         }
 
+        // producer side: replace the ring buffer with one of ringBufLength (frames)
+        // while streaming. Queued samples are played out of the old ring first,
+        // so nothing is dropped or duplicated. Returns false while a previous
+        // hand-over has not been picked up by the consumer yet.
+        bool resizeRingBuffer(unsigned long ringBufLength) {
+            if (!dataBuf || (ringBufLength == 0)) {
+                return false;
+            }
+            if (pendingBuf.load(std::memory_order_acquire)) {
+                return false;
+            }
+            reclaimRingBuffer();
+            ring_buffer<AudioData>* newBuf = new ring_buffer<AudioData>(ringBufLength*nCH);
+            newBuf->prefault();
+            dataBuf = newBuf;
+            rbLen = ringBufLength*nCH;
+            pendingBuf.store(newBuf, std::memory_order_release);
+            return true;
+        }
+
+        // producer side: free a ring buffer the consumer has switched away from
+        void reclaimRingBuffer() {
+            ring_buffer<AudioData>* retired = retiredBuf.exchange(nullptr, std::memory_order_acq_rel);
+            if (retired) {
+                delete retired;
+            }
+        }
+
+        // grow the ring buffer (x2, up to maxLength) when underruns occur, and shrink it
+        // back (/2, down to minLength) after quietSec without underruns. Lengths in frames.
+        void setAutoResize(unsigned long minLength, unsigned long maxLength, double quietSec) {
+            autoResize = true;
+            autoResizeMin = minLength;
+            autoResizeMax = maxLength;
+            autoResizeQuiet = quietSec;
+            lastUnderrunCount = getRbUnderrunCount() + getCbXrunCount();
+            lastUnderrunTime = monotonicTime();
+        }
+
+        // producer side: call once per write; returns true when a resize was requested
+        bool updateAutoResize() {
+            reclaimRingBuffer();
+            if (!autoResize || isPaused || (nCH == 0)) {
+                return false;
+            }
+            double now = monotonicTime();
+            unsigned long underruns = getRbUnderrunCount() + getCbXrunCount();
+            unsigned long curLength = rbLen / nCH;
+            if (underruns != lastUnderrunCount) {
+                lastUnderrunCount = underruns;
+                lastUnderrunTime = now;
+                if (curLength < autoResizeMax) {
+                    return resizeRingBuffer((curLength*2 < autoResizeMax) ? curLength*2 : autoResizeMax);
+                }
+                return false;
+            }
+            if (((now - lastUnderrunTime) > autoResizeQuiet) && (curLength > autoResizeMin)) {
+                lastUnderrunTime = now;
+                return resizeRingBuffer((curLength/2 > autoResizeMin) ? curLength/2 : autoResizeMin);
+            }
+            return false;
+        }
+
+        static double monotonicTime() {
+            timespec now = {};
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            return (double)now.tv_sec + (double)now.tv_nsec*1e-9;
+        }
+
+        // called from the stream callback: must not lock or allocate
         int read(AudioData* dest, uint32_t length, bool zeros=false) {
-            uint32_t remain = 0;
-            remain = getRbStoredChunkLength();
             if (openStatus != paNoError) {
                 return -1;
             }
             if (!dataBuf) {
                 return -1;
             }
-            if (zeros) {
-                for (uint32_t ctr=0; ctr<(length*nCH); ctr++) {
-                    dest[ctr].s32 = 0;
+            uint32_t total = length*nCH/lengthFactor;
+            uint32_t readCount = 0;
+            if (!zeros) {
+                ring_buffer<AudioData>* cur = readBuf.load(std::memory_order_acquire);
+                readCount = cur->get_data_memcpy(dest, total);
+                if (readCount < total) {
+                    ring_buffer<AudioData>* next = pendingBuf.load(std::memory_order_acquire);
+                    if (next) {
+                        // the producer has moved on to next: drain cur, then switch over
+                        readCount += cur->get_data_memcpy(&(dest[readCount]), total-readCount);
+                        if (cur->get_stored_length() == 0) {
+                            readBuf.store(next, std::memory_order_release);
+                            retiredBuf.store(cur, std::memory_order_release);
+                            pendingBuf.store(nullptr, std::memory_order_release);
+                            readCount += next->get_data_memcpy(&(dest[readCount]), total-readCount);
+                        }
+                    }
                 }
-                return 0;
-            }
-            if (remain >= length) {
-                memcpy(dest, dataBuf->get_data_memcpy(length*nCH/lengthFactor),
-                             length*nCH*sizeof(AudioData)/lengthFactor);
-                //memcpy(dest, dataBuf->get_data_nelm_queue(length*nCH), length*nCH*sizeof(AudioData));
-                return 0;
-            }
-            if (remain != 0) {
-                memcpy(dest,
-                       dataBuf->get_data_memcpy(remain*nCH/lengthFactor),
-                       remain*nCH*sizeof(AudioData)/lengthFactor);
-                return 0;
+                if (readCount < total) {
+                    rbUnderrunCount.fetch_add(1, std::memory_order_relaxed);
+                }
+                rbFramesTotal += readCount*lengthFactor/nCH;
             }
-            if ((length*nCH) < zdlength) {
-                memcpy(dest, zerodata,
-                       length*nCH*sizeof(AudioData)/lengthFactor);
-                return 0;
+            if (readCount < total) {
+                memset(&(dest[readCount]), 0, (total-readCount)*sizeof(AudioData));
             }
-            memcpy(dest, zerodata,
-                   zdlength*sizeof(AudioData)/lengthFactor);
-
             return 0;
         }
 
@@ -346,6 +645,46 @@ class AudioManipulator {
             return nCH;
         }
 
+        unsigned long getFramesPerBuffer() {
+            return framesPerBuffer;
+        }
+        double getSuggestedLatency() {
+            return parameters.suggestedLatency;
+        }
+        // latency reported by the opened stream [sec]
+        double getStreamLatency() {
+            if (!isOpened) {
+                return 0.0;
+            }
+            const PaStreamInfo* sInfo = Pa_GetStreamInfo(aStream);
+            if (!sInfo) {
+                return 0.0;
+            }
+            return output ? sInfo->outputLatency : sInfo->inputLatency;
+        }
+        std::string getDeviceName() {
+            return getDeviceName(parameters.device);
+        }
+        // "<host API>: <device name>", PortAudio must be initialized
+        static std::string getDeviceName(int index) {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(index);
+            if (!info) {
+                return std::string();
+            }
+            const PaHostApiInfo* hostAPIInfo = Pa_GetHostApiInfo(info->hostApi);
+            std::string name(hostAPIInfo ? hostAPIInfo->name : "");
+            name.append(": ");
+            name.append(info->name);
+            return name;
+        }
+        static double getDefaultSampleRate(int index) {
+            const PaDeviceInfo* info = Pa_GetDeviceInfo(index);
+            if (!info) {
+                return 0.0;
+            }
+            return info->defaultSampleRate;
+        }
+
         bool isStreamPaused() {
             return isPaused;
         }
@@ -369,17 +708,31 @@ class AudioManipulator {
             return dataBuf->get_buf_length() / nCH;
         }
 
+        // samples queued for the consumer (including a ring being handed over)
         unsigned long getRbStoredLength() {
-            if (!dataBuf) {
+            ring_buffer<AudioData>* cur = readBuf.load(std::memory_order_acquire);
+            if (!cur) {
                 return -1;
             }
-            return dataBuf->get_stored_length();
+            unsigned long stored = cur->get_stored_length();
+            ring_buffer<AudioData>* next = pendingBuf.load(std::memory_order_acquire);
+            if (next && (next != cur)) {
+                stored += next->get_stored_length();
+            }
+            return stored;
         }
         unsigned long getRbStoredChunkLength() {
             if (!dataBuf) {
                 return -1;
             }
-            return dataBuf->get_stored_length() / nCH;
+            return getRbStoredLength() / nCH;
+        }
+        // free space of the ring buffer the producer writes to
+        unsigned long getRbFreeChunkLength() {
+            if (!dataBuf) {
+                return 0;
+            }
+            return (dataBuf->get_buf_length() - dataBuf->get_stored_length()) / nCH;
         }
         
         void listInputDevices() {
@@ -426,11 +779,11 @@ class AudioManipulator {
                         outputList.at(ctr), hostAPIInfo->name, devInfo->name, devInfo->defaultSampleRate);
                 printf("max output channels: %d\n", devInfo->maxOutputChannels);
                 printf("Output low latency default:  %6.2lf[msec]\n",
-                        (devInfo->defaultLowInputLatency != -1 ?
-                         devInfo->defaultLowInputLatency*1000 : std::nan("1")));
+                        (devInfo->defaultLowOutputLatency != -1 ?
+                         devInfo->defaultLowOutputLatency*1000 : std::nan("1")));
                 printf("Output high latency default: %6.2lf[msec]\n\n",
-                        (devInfo->defaultHighInputLatency != -1 ?
-                         devInfo->defaultHighInputLatency*1000 : std::nan("1")));
+                        (devInfo->defaultHighOutputLatency != -1 ?
+                         devInfo->defaultHighOutputLatency*1000 : std::nan("1")));
             }  
         }
     
@@ -469,11 +822,11 @@ class AudioManipulator {
                         outputList.at(ctr), hostAPIInfo->name, devInfo->name, devInfo->defaultSampleRate);
                 printf("max output channels: %d\n", devInfo->maxOutputChannels);
                 printf("Output low latency default:  %6.2lf[msec]\n",
-                        (devInfo->defaultLowInputLatency != -1 ?
-                         devInfo->defaultLowInputLatency*1000 : std::nan("1")));
+                        (devInfo->defaultLowOutputLatency != -1 ?
+                         devInfo->defaultLowOutputLatency*1000 : std::nan("1")));
                 printf("Output high latency default: %6.2lf[msec]\n\n",
-                        (devInfo->defaultHighInputLatency != -1 ?
-                         devInfo->defaultHighInputLatency*1000 : std::nan("1")));
+                        (devInfo->defaultHighOutputLatency != -1 ?
+                         devInfo->defaultHighOutputLatency*1000 : std::nan("1")));
             }
         }
         void getPaVersion() {
@@ -514,7 +867,10 @@ int rxCallback( const void *input,
                 const PaStreamCallbackTimeInfo* timeInfo,
                 PaStreamCallbackFlags statusFlags,
                 void *userData ) {
+    RtScope rtContext;
+    ScopedFlushDenormals ftz;
     reinterpret_cast<AudioManipulator*>(userData)->storeRxCbFrameCount(frameCount);
+    reinterpret_cast<AudioManipulator*>(userData)->storeCbStatusFlags(statusFlags);
     if (reinterpret_cast<AudioManipulator*>(userData)->isStreamPaused()) {
         return 0;
     }
@@ -528,7 +884,18 @@ int txCallback( const void *input,
                 const PaStreamCallbackTimeInfo* timeInfo,
                 PaStreamCallbackFlags statusFlags,
                 void *userData ) {
+    RtScope rtContext;
+    ScopedFlushDenormals ftz;
     reinterpret_cast<AudioManipulator*>(userData)->storeTxCbFrameCount(frameCount);
+    reinterpret_cast<AudioManipulator*>(userData)->storeCbStatusFlags(statusFlags);
+    double dacTime = timeInfo->outputBufferDacTime;
+    bool estimated = false;
+    if (dacTime <= 0) {
+        // some host APIs do not fill the timestamps
+        dacTime = reinterpret_cast<AudioManipulator*>(userData)->getStreamTime();
+        estimated = true;
+    }
+    reinterpret_cast<AudioManipulator*>(userData)->storeClock(dacTime, frameCount, estimated);
     if (reinterpret_cast<AudioManipulator*>(userData)->isStreamPaused()) {
         reinterpret_cast<AudioManipulator*>(userData)->read((AudioData*)output, frameCount, true);
         return 0;
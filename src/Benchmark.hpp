@@ -0,0 +1,751 @@
+#ifndef BENCHMARK_H_INCLUDED
+#define BENCHMARK_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "math.h"
+#include "string.h"
+
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "MatrixFader.hpp"
+#include "DenormalGuard.hpp"
+#include "SyncSimulation.hpp"
+#include "WaveWriter.hpp"
+#include "MixEngine.hpp"
+#include "GaplessLooper.hpp"
+#include "PcmCache.hpp"
+#include "ReaderPool.hpp"
+#include "RTCheck.hpp"
+#include "DspChain.hpp"
+#include "BiquadBank.hpp"
+#include "Limiter.hpp"
+#include "LevelMeter.hpp"
+
+// Micro benchmarks selected with --benchmark <name>
+class Benchmark {
+    private:
+        static double elapsedSec(std::chrono::steady_clock::time_point start) {
+            return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        }
+
+        // feed an exponentially decaying sine through MatrixFader::mix and
+        // report the cost per sample for each 40 dB step of the decay
+        static void denormalMixPass(bool flushDenormals, uint32_t blockLength, uint32_t channels) {
+            constexpr int steps = 24;            // 1.0 down to 1e-48 (through the denormal range)
+            constexpr uint32_t blocksPerStep = 200;
+            MatrixFader mf(channels, channels);
+            for (uint32_t ch=0; ch<channels; ch++) {
+                mf.setCrossPointGain(ch, ch, 0.0);
+            }
+            std::vector<std::vector<float>> inBuf(channels, std::vector<float>(blockLength));
+            std::vector<std::vector<float>> outBuf(channels, std::vector<float>(blockLength));
+            std::vector<float*> inPtr(channels);
+            std::vector<float*> outPtr(channels);
+            for (uint32_t ch=0; ch<channels; ch++) {
+                inPtr[ch] = inBuf[ch].data();
+                outPtr[ch] = outBuf[ch].data();
+            }
+            // decay factor per sample: -40 dB per step
+            double perSample = pow(10.0, -2.0 / (double)(blockLength*blocksPerStep));
+            double level = 1.0;
+            double phase = 0.0;
+            double minCost = 0.0;
+            double maxCost = 0.0;
+            printf("%s\n", flushDenormals ? "FTZ/DAZ on:" : "FTZ/DAZ off:");
+            for (int step=0; step<steps; step++) {
+                double stepTime = 0.0;
+                for (uint32_t bctr=0; bctr<blocksPerStep; bctr++) {
+                    for (uint32_t sctr=0; sctr<blockLength; sctr++) {
+                        for (uint32_t ch=0; ch<channels; ch++) {
+                            inBuf[ch][sctr] = (float)(level * sin(phase));
+                        }
+                        phase += 0.0573;
+                        level *= perSample;
+                    }
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    if (flushDenormals) {
+                        ScopedFlushDenormals ftz;
+                        mf.mix(inPtr.data(), blockLength, outPtr.data(), blockLength);
+                    } else {
+                        mf.mix(inPtr.data(), blockLength, outPtr.data(), blockLength);
+                    }
+                    stepTime += elapsedSec(start);
+                }
+                double nsPerSample = stepTime*1e9 / (double)(blocksPerStep*blockLength*channels);
+                if ((step == 0) || (nsPerSample < minCost)) {
+                    minCost = nsPerSample;
+                }
+                if (nsPerSample > maxCost) {
+                    maxCost = nsPerSample;
+                }
+                printf("  level %5d dB: %8.3f ns/sample\n", -40*step, nsPerSample);
+            }
+            printf("  max/min cost ratio: %6.2f\n", maxCost / minCost);
+        }
+
+    public:
+        static void denormal(uint32_t blockLength=1024, uint32_t channels=2) {
+            printf("Benchmark: MatrixFader::mix with decaying input (%u ch, block %u)\n",
+                   channels, blockLength);
+            if (!ScopedFlushDenormals::isSupported()) {
+                printf("  (FTZ/DAZ is not supported on this platform)\n");
+            }
+            denormalMixPass(false, blockLength, channels);
+            denormalMixPass(true, blockLength, channels);
+        }
+
+        // render N looping stereo streams and report the load against real time
+        static bool streams(uint32_t blockLength=1024) {
+            constexpr uint32_t fs = 48000;
+            constexpr uint32_t fileSeconds = 10;
+            constexpr double renderSeconds = 20.0;
+            const uint32_t counts[] = {16, 32, 64, 128, 256};
+            std::string path = (std::filesystem::temp_directory_path() / "waveplayer_bench_stream.wav").string();
+            {
+                WaveWriter writer(path, fs, 2, FLOAT_32);
+                if (!writer.isFileOpened()) {
+                    printf("Cannot create %s\n", path.c_str());
+                    return false;
+                }
+                std::vector<float> noise(fs*2);
+                uint32_t state = 1;
+                for (uint32_t sec=0; sec<fileSeconds; sec++) {
+                    for (std::vector<float>::size_type ctr=0; ctr<noise.size(); ctr++) {
+                        state = state*1664525u + 1013904223u;
+                        noise[ctr] = ((float)(state >> 8)/8388608.0f - 1.0f)*0.01f;
+                    }
+                    writer.write(noise.data(), fs);
+                }
+                writer.close();
+            }
+            uint32_t cores = std::thread::hardware_concurrency();
+            if (cores == 0) {
+                cores = 1;
+            }
+            printf("Benchmark: MixEngine, %u sec of %u Hz stereo per stream (block %u, %u threads available)\n",
+                   (uint32_t)renderSeconds, fs, blockLength, cores);
+            std::vector<float> out(blockLength*2);
+            for (uint32_t threads : {1u, cores}) {
+                double bestPerCore = 0;
+                for (uint32_t count : counts) {
+                    MixEngine engine(count, 2, fs, blockLength, threads);
+                    for (uint32_t ctr=0; ctr<count; ctr++) {
+                        int id = engine.addStream(path, true);
+                        if (id < 0) {
+                            std::filesystem::remove(path);
+                            return false;
+                        }
+                        engine.start(id);
+                    }
+                    uint32_t blocks = (uint32_t)(renderSeconds*fs/blockLength);
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    for (uint32_t bctr=0; bctr<blocks; bctr++) {
+                        engine.render(out.data(), blockLength);
+                    }
+                    double load = elapsedSec(start) / ((double)blocks*blockLength/fs);
+                    // streams one core keeps up with in real time
+                    double perCore = count / (load*threads);
+                    if (perCore > bestPerCore) {
+                        bestPerCore = perCore;
+                    }
+                    printf("  %2u thread(s) %4u streams: load %7.2f%%, %8.1f streams/core\n",
+                           threads, count, load*100.0, perCore);
+                }
+                printf("  %2u thread(s): max %.0f streams per core\n", threads, bestPerCore);
+                if (cores == 1) {
+                    break;
+                }
+            }
+            std::filesystem::remove(path);
+            return true;
+        }
+
+        // write a sparse RF64 / BW64 file of 5 GiB with marked frames around the 4 GiB
+        // boundary and read it back through WaveFile (seek, read, loop region)
+        static bool largeFile() {
+            constexpr uint32_t fs = 48000;
+            constexpr uint32_t nCH = 8;
+            constexpr uint64_t frameBytes = nCH*sizeof(float);
+            constexpr uint64_t dataSize = 5ULL << 30;
+            constexpr uint64_t frames = dataSize / frameBytes;
+            constexpr uint64_t boundary = (1ULL << 32) / frameBytes;
+            const uint64_t marked[] = {0, 1, boundary-2, boundary-1, boundary, boundary+1, frames/2, frames-1};
+            std::string path = (std::filesystem::temp_directory_path() / "waveplayer_rf64_check.wav").string();
+            bool passed = true;
+            for (const char* riffId : {"RF64", "BW64"}) {
+                FILE* pFile = fopen(path.c_str(), "wb");
+                if (!pFile) {
+                    printf("Cannot create %s\n", path.c_str());
+                    return false;
+                }
+                // RF64 header: ds64 holds the 64-bit sizes, the 32-bit fields are 0xFFFFFFFF
+                uint8_t header[80] = {};
+                uint32_t u32 = 0;
+                uint64_t u64 = 0;
+                uint16_t u16 = 0;
+                memcpy(&(header[0]), riffId, 4);
+                u32 = 0xFFFFFFFF;
+                memcpy(&(header[4]), &u32, 4);
+                memcpy(&(header[8]), "WAVEds64", 8);
+                u32 = 28;
+                memcpy(&(header[16]), &u32, 4);
+                u64 = 80 - 8 + dataSize;
+                memcpy(&(header[20]), &u64, 8);
+                memcpy(&(header[28]), &dataSize, 8);
+                memcpy(&(header[36]), &frames, 8);
+                memcpy(&(header[48]), "fmt ", 4);
+                u32 = 16;
+                memcpy(&(header[52]), &u32, 4);
+                u16 = 3;
+                memcpy(&(header[56]), &u16, 2);
+                u16 = nCH;
+                memcpy(&(header[58]), &u16, 2);
+                u32 = fs;
+                memcpy(&(header[60]), &u32, 4);
+                u32 = fs*frameBytes;
+                memcpy(&(header[64]), &u32, 4);
+                u16 = frameBytes;
+                memcpy(&(header[68]), &u16, 2);
+                u16 = 32;
+                memcpy(&(header[70]), &u16, 2);
+                memcpy(&(header[72]), "data", 4);
+                u32 = 0xFFFFFFFF;
+                memcpy(&(header[76]), &u32, 4);
+                bool written = (fwrite(header, 1, sizeof(header), pFile) == sizeof(header));
+                // marked frame: ch0 = low 16 bits of the frame number, ch1 = the rest, ch2.. = channel
+                for (uint64_t frame : marked) {
+                    float data[nCH] = {};
+                    data[0] = (float)(frame & 0xFFFF);
+                    data[1] = (float)(frame >> 16);
+                    for (uint32_t ch=2; ch<nCH; ch++) {
+                        data[ch] = (float)ch;
+                    }
+                    written &= (waveSeek64(pFile, sizeof(header) + frame*frameBytes, SEEK_SET) == 0);
+                    written &= (fwrite(data, sizeof(float), nCH, pFile) == nCH);
+                }
+                fclose(pFile);
+                if (!written) {
+                    printf("Cannot write %s (a sparse file of %.1f GiB is needed)\n", path.c_str(), dataSize/1073741824.0);
+                    std::filesystem::remove(path);
+                    return false;
+                }
+
+                std::vector<std::string> errors;
+                GaplessLooper wf(path);
+                if (!wf.isFileOpened() || !wf.isWaveFile() || !wf.isRF64File()) {
+                    errors.push_back("not opened as RF64");
+                } else {
+                    if ((wf.getDataSize() != dataSize) || (wf.getFrameCount() != frames)) {
+                        errors.push_back("size: " + std::to_string(wf.getDataSize()));
+                    }
+                    float data[nCH*4] = {};
+                    for (uint64_t frame : marked) {
+                        bool ok = wf.seekFrame(frame) && (wf.read(data, 1) == 1);
+                        ok = ok && (wf.getPositionFrames() == frame+1) && (wf.getPosition() == (frame+1)*frameBytes);
+                        ok = ok && (data[0] == (float)(frame & 0xFFFF)) && (data[1] == (float)(frame >> 16));
+                        for (uint32_t ch=2; ch<nCH; ch++) {
+                            ok = ok && (data[ch] == (float)ch);
+                        }
+                        if (!ok) {
+                            errors.push_back("seek/read at frame " + std::to_string(frame));
+                        }
+                    }
+                    // sequential read over the 4 GiB boundary
+                    wf.seekFrame(boundary-2);
+                    if ((wf.read(data, 4) != 4) || (data[nCH*3] != (float)((boundary+1) & 0xFFFF))) {
+                        errors.push_back("read across 4 GiB");
+                    }
+                    // loop region over the boundary: frames boundary-2 ... boundary+1 repeated
+                    wf.setLoopRegion(boundary-2, boundary+2);
+                    wf.seekFrame(boundary-2);
+                    std::vector<float> chunk(nCH*10);
+                    wf.prepareFrame(chunk.data(), 10);
+                    for (uint32_t ctr=0; ctr<10; ctr++) {
+                        if (chunk[ctr*nCH] != (float)((boundary-2+ctr%4) & 0xFFFF)) {
+                            errors.push_back("loop region across 4 GiB");
+                            break;
+                        }
+                    }
+                    // end of data
+                    wf.seekFrame(frames-1);
+                    if ((wf.read(data, 4) != 1) || (wf.getPositionFrames() != frames)) {
+                        errors.push_back("end of data");
+                    }
+                }
+                printf("%s, %.1f GiB, %llu frames: %s\n", riffId, dataSize/1073741824.0,
+                       (unsigned long long)frames, errors.empty() ? "OK" : "FAILED");
+                for (std::vector<std::string>::size_type ctr=0; ctr<errors.size(); ctr++) {
+                    printf("  %s\n", errors.at(ctr).c_str());
+                }
+                passed &= errors.empty();
+                std::filesystem::remove(path);
+            }
+            return passed;
+        }
+
+        // file changes as the playlist does them: a new reader per file (new / delete),
+        // readers from a ReaderPool (reopen), and reopen attached to cached buffers.
+        // allocations are counted with cmake -DWAVEPLAYER_RT_CHECK=ON; the pooled
+        // changes must not allocate once the readers are warmed up.
+        static bool transitions(uint32_t blockLength=1024) {
+            constexpr uint32_t fs = 48000;
+            constexpr uint32_t fileCount = 8;
+            constexpr uint32_t changes = 4000;
+            const uint16_t channels[fileCount] = {2, 2, 1, 2, 6, 2, 1, 2};
+            const WF_Format formats[fileCount] = {SIGNED_16, FLOAT_32, SIGNED_24, SIGNED_16,
+                                                  SIGNED_32, SIGNED_24, FLOAT_32, SIGNED_16};
+            std::vector<std::string> paths;
+            std::vector<WaveHeader> headers(fileCount);
+            std::vector<float> buf(blockLength*8);
+            for (uint32_t idx=0; idx<fileCount; idx++) {
+                paths.push_back((std::filesystem::temp_directory_path()
+                                 / ("waveplayer_bench_change" + std::to_string(idx) + ".wav")).string());
+                WaveWriter writer(paths.back(), fs, channels[idx], formats[idx]);
+                if (!writer.isFileOpened()) {
+                    printf("Cannot create %s\n", paths.back().c_str());
+                    return false;
+                }
+                // a few blocks each, of different lengths
+                std::vector<float> data((blockLength*(idx+1)/2)*channels[idx], 0.25f);
+                writer.write(data.data(), blockLength*(idx+1)/2);
+                writer.close();
+                WaveFile wf(paths.back(), "r");
+                wf.getHeader(headers.at(idx));
+            }
+            RtCheck::init();
+            printf("Benchmark: file changes, %u files, %u changes (reading one block of each)\n", fileCount, changes);
+            if (!RtCheck::enabled) {
+                printf("  (allocations are counted when built with cmake -DWAVEPLAYER_RT_CHECK=ON)\n");
+            }
+            bool passed = true;
+            ReaderPool readers(2);
+            PcmCache cache(64ULL << 20);
+            for (int mode=0; mode<3; mode++) {
+                const char* names[3] = {"new / delete", "ReaderPool reopen", "ReaderPool + PcmCache"};
+                GaplessLooper* wf = nullptr;
+                uint64_t allocations = 0;
+                std::chrono::steady_clock::time_point start;
+                // the first pass warms up the readers (and fills the cache)
+                for (uint32_t ctr=0; ctr<changes+fileCount; ctr++) {
+                    if (ctr == fileCount) {
+                        allocations = RtCheck::getAllocationCount();
+                        start = std::chrono::steady_clock::now();
+                    }
+                    RtScope counted;
+                    uint32_t idx = ctr % fileCount;
+                    if (mode == 0) {
+                        wf = new GaplessLooper(paths.at(idx), headers.at(idx));
+                    } else {
+                        wf = readers.acquire();
+                        if (mode == 1) {
+                            wf->reopen(paths.at(idx), headers.at(idx));
+                        } else {
+                            cache.reopen(wf, paths.at(idx), false, &(headers.at(idx)));
+                        }
+                    }
+                    while (wf->prepareFrame(buf.data(), blockLength, true) == blockLength) {
+                    }
+                    if (mode == 0) {
+                        delete wf;
+                    } else {
+                        if (mode == 2) {
+                            cache.retire(wf);
+                        }
+                        readers.release(wf);
+                    }
+                }
+                double elapsed = elapsedSec(start);
+                allocations = RtCheck::getAllocationCount() - allocations;
+                printf("  %-22s: %7.2f usec/change", names[mode], elapsed*1e6/changes);
+                if (RtCheck::enabled) {
+                    printf(", %lu allocations", (unsigned long)allocations);
+                    if ((mode > 0) && (allocations > 0)) {
+                        printf(" (FAILED)");
+                        passed = false;
+                    }
+                }
+                putchar('\n');
+            }
+            for (uint32_t idx=0; idx<fileCount; idx++) {
+                std::filesystem::remove(paths.at(idx));
+            }
+            return passed;
+        }
+
+        // the playback DspChain (fader + level meter with true peak) on interleaved blocks,
+        // as the decode thread runs it. nothing may be allocated after prepare() (counted
+        // with cmake -DWAVEPLAYER_RT_CHECK=ON), including when it is prepared again for
+        // another channel count and then processes.
+        static bool dsp(uint32_t blockLength=1024) {
+            constexpr double fs = 48000;
+            constexpr uint32_t blocks = 2000;
+            const uint32_t channels[3] = {2, 6, 1};
+            std::vector<float> buf(blockLength*8);
+            for (std::vector<float>::size_type idx=0; idx<buf.size(); idx++) {
+                buf.at(idx) = 0.5f*sinf(idx*0.01f);
+            }
+            LevelMeter meter(channels[0], fs, true);
+            FaderStage fader;
+            MeterStage meterStage(meter);
+            DspChain chain;
+            chain.add(&fader);
+            chain.add(&meterStage);
+            fader.setGain(-6.0f);
+            RtCheck::init();
+            printf("Benchmark: DSP chain (fader, level meter), %u blocks of %u frames\n", blocks, blockLength);
+            if (!RtCheck::enabled) {
+                printf("  (allocations are counted when built with cmake -DWAVEPLAYER_RT_CHECK=ON)\n");
+            }
+            bool passed = true;
+            for (uint32_t mode=0; mode<3; mode++) {
+                if (!chain.prepare(blockLength, channels[mode], fs)) {
+                    printf("  %u ch: cannot prepare (FAILED)\n", channels[mode]);
+                    passed = false;
+                    continue;
+                }
+                uint64_t allocations = RtCheck::getAllocationCount();
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                {
+                    RtScope counted;
+                    for (uint32_t ctr=0; ctr<blocks; ctr++) {
+                        chain.process(buf.data(), blockLength);
+                        // keep the level from decaying to denormals
+                        fader.setGain((ctr % 2) ? 6.0f : -6.0f);
+                    }
+                }
+                double elapsed = elapsedSec(start);
+                allocations = RtCheck::getAllocationCount() - allocations;
+                printf("  %u ch: %7.2f nsec/frame", channels[mode], elapsed*1e9/((double)blocks*blockLength));
+                if (RtCheck::enabled) {
+                    printf(", %lu allocations", (unsigned long)allocations);
+                    if (allocations > 0) {
+                        printf(" (FAILED)");
+                        passed = false;
+                    }
+                }
+                putchar('\n');
+            }
+            return passed;
+        }
+
+        // BiquadBank with 4 bands per channel: cost per channel and sample for 1-16 channels,
+        // the error against a scalar double precision filter, and the cost while another
+        // thread commits new bands all the time (nothing may be allocated on the audio side,
+        // counted with cmake -DWAVEPLAYER_RT_CHECK=ON)
+        static bool biquad(uint32_t blockLength=1024) {
+            constexpr double fs = 48000;
+            constexpr uint32_t blocks = 2000;
+            constexpr uint32_t bandCount = 4;
+            const uint32_t channels[5] = {1, 2, 4, 8, 16};
+            EqBand bands[bandCount];
+            bands[0].type = EQ_HIGH_PASS;
+            bands[0].freq = 30;
+            bands[1].type = EQ_LOW_SHELF;
+            bands[1].freq = 120;
+            bands[1].gain = -4;
+            bands[2].type = EQ_PEAK;
+            bands[2].freq = 1000;
+            bands[2].gain = 3;
+            bands[2].q = 1.4;
+            bands[3].type = EQ_HIGH_SHELF;
+            bands[3].freq = 8000;
+            bands[3].gain = -2;
+            BiquadBank eq;
+            for (uint32_t ch=0; ch<16; ch++) {
+                for (uint32_t band=0; band<bandCount; band++) {
+                    EqBand spec = bands[band];
+                    spec.freq *= 1.0 + 0.01*ch;
+                    eq.setBand(ch, band, spec);
+                }
+            }
+            eq.commit();
+            std::vector<std::vector<float>> planarData(16, std::vector<float>(blockLength));
+            std::vector<float*> planar;
+            for (uint32_t ch=0; ch<16; ch++) {
+                planar.push_back(planarData.at(ch).data());
+            }
+            // noise-like input, different per channel. the timed loops copy it in before
+            // every block (the filters are run in place)
+            uint32_t seed = 1;
+            auto fill = [&]() {
+                for (uint32_t ch=0; ch<16; ch++) {
+                    for (uint32_t frame=0; frame<blockLength; frame++) {
+                        seed = seed*1664525u + 1013904223u;
+                        planar.at(ch)[frame] = (float)((int32_t)seed) / 4294967296.0f;
+                    }
+                }
+            };
+            std::vector<std::vector<float>> source;
+            auto copyIn = [&](uint32_t nCH) {
+                for (uint32_t ch=0; ch<nCH; ch++) {
+                    memcpy(planar.at(ch), source.at(ch).data(), sizeof(float)*blockLength);
+                }
+            };
+            RtCheck::init();
+            printf("Benchmark: biquad EQ bank, %u bands, %u blocks of %u frames\n", bandCount, blocks, blockLength);
+            if (!RtCheck::enabled) {
+                printf("  (allocations are counted when built with cmake -DWAVEPLAYER_RT_CHECK=ON)\n");
+            }
+            bool passed = true;
+
+            // accuracy: 16 channels (4 lanes x 4 groups) against double precision, 20 blocks
+            eq.prepare(blockLength, 16, fs);
+            std::vector<double> ref(16*bandCount*2, 0.0);
+            double maxError = 0;
+            for (uint32_t ctr=0; ctr<20; ctr++) {
+                fill();
+                std::vector<std::vector<float>> input = planarData;
+                eq.process(planar.data(), blockLength);
+                for (uint32_t ch=0; ch<16; ch++) {
+                    for (uint32_t frame=0; frame<blockLength; frame++) {
+                        double x = input.at(ch).at(frame);
+                        for (uint32_t band=0; band<bandCount; band++) {
+                            EqBand spec = bands[band];
+                            spec.freq *= 1.0 + 0.01*ch;
+                            double c[5];
+                            BiquadBank::design(spec, fs, c);
+                            double* z = &(ref.at((ch*bandCount + band)*2));
+                            double y = c[0]*x + z[0];
+                            z[0] = c[1]*x - c[3]*y + z[1];
+                            z[1] = c[2]*x - c[4]*y;
+                            x = y;
+                        }
+                        maxError = std::max(maxError, fabs(x - planar.at(ch)[frame]));
+                    }
+                }
+            }
+            printf("  max error against a double precision filter: %.2e", maxError);
+            if (maxError > 1e-3) {
+                printf(" (FAILED)");
+                passed = false;
+            }
+            putchar('\n');
+
+            fill();
+            source = planarData;
+            for (uint32_t mode=0; mode<5; mode++) {
+                eq.prepare(blockLength, channels[mode], fs);
+                uint64_t allocations = RtCheck::getAllocationCount();
+                std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                {
+                    RtScope counted;
+                    for (uint32_t ctr=0; ctr<blocks; ctr++) {
+                        copyIn(channels[mode]);
+                        eq.process(planar.data(), blockLength);
+                    }
+                }
+                double elapsed = elapsedSec(start);
+                allocations = RtCheck::getAllocationCount() - allocations;
+                printf("  %2u ch: %6.2f nsec/ch/sample", channels[mode],
+                       elapsed*1e9/((double)blocks*blockLength*channels[mode]));
+                if (RtCheck::enabled) {
+                    printf(", %lu allocations", (unsigned long)allocations);
+                    if (allocations > 0) {
+                        printf(" (FAILED)");
+                        passed = false;
+                    }
+                }
+                putchar('\n');
+            }
+
+            // lock-free updates: the gain of band 2 changes on another thread while processing
+            eq.prepare(blockLength, 8, fs);
+            std::atomic<bool> quit{false};
+            uint32_t commits = 0;
+            std::thread control([&]() {
+                while (!quit.load()) {
+                    EqBand spec = bands[2];
+                    spec.gain = (commits % 13) - 6.0;
+                    for (uint32_t ch=0; ch<8; ch++) {
+                        eq.setBand(ch, 2, spec);
+                    }
+                    eq.commit();
+                    commits++;
+                    std::this_thread::sleep_for(std::chrono::microseconds(200));
+                }
+            });
+            uint64_t allocations = RtCheck::getAllocationCount();
+            float peak = 0;
+            std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+            {
+                RtScope counted;
+                for (uint32_t ctr=0; ctr<blocks; ctr++) {
+                    copyIn(8);
+                    eq.process(planar.data(), blockLength);
+                    for (uint32_t frame=0; frame<blockLength; frame++) {
+                        // NaN fails too
+                        peak = (fabsf(planar.at(0)[frame]) <= peak) ? peak : fabsf(planar.at(0)[frame]);
+                    }
+                }
+            }
+            double elapsed = elapsedSec(start);
+            allocations = RtCheck::getAllocationCount() - allocations;
+            quit = true;
+            control.join();
+            printf("   8 ch, %u commits while processing: %6.2f nsec/ch/sample, peak %.2f", commits,
+                   elapsed*1e9/((double)blocks*blockLength*8), peak);
+            if (!std::isfinite(peak) || (peak > 8.0f)) {
+                printf(" (FAILED)");
+                passed = false;
+            }
+            if (RtCheck::enabled) {
+                printf(", %lu allocations", (unsigned long)allocations);
+                if (allocations > 0) {
+                    printf(" (FAILED)");
+                    passed = false;
+                }
+            }
+            putchar('\n');
+            return passed;
+        }
+
+        // Limiter: a signal under the ceiling must come out unchanged (delayed by the
+        // look-ahead), and the sum of three sines (about +4 dBFS) and clicks must stay under
+        // the ceiling in sample and true peak. cost per channel and sample, and allocations
+        // with cmake -DWAVEPLAYER_RT_CHECK=ON
+        static bool limiter(uint32_t blockLength=1024) {
+            constexpr double fs = 48000;
+            constexpr uint32_t blocks = 2000;
+            constexpr double ceilingDB = -1.0;
+            const uint32_t channels[3] = {1, 2, 8};
+            std::vector<std::vector<float>> planarData(8, std::vector<float>(blockLength));
+            std::vector<float*> planar;
+            for (uint32_t ch=0; ch<8; ch++) {
+                planar.push_back(planarData.at(ch).data());
+            }
+            uint64_t position = 0;
+            auto fill = [&](uint32_t nCH, float level, bool clicks) {
+                for (uint32_t frame=0; frame<blockLength; frame++) {
+                    double t = (double)(position + frame) / fs;
+                    for (uint32_t ch=0; ch<nCH; ch++) {
+                        double x = sin(2*M_PI*(110.0 + ch)*t) + sin(2*M_PI*997.0*t + ch) + sin(2*M_PI*11025.0*t + 0.5*ch);
+                        // a click every 0.1 sec
+                        if (clicks && (((position + frame) % 4800) == 0)) {
+                            x = (ch % 2) ? -3.0 : 3.0;
+                        }
+                        planar.at(ch)[frame] = (float)(x*level);
+                    }
+                }
+                position += blockLength;
+            };
+            Limiter limiter;
+            limiter.setCeiling(ceilingDB);
+            RtCheck::init();
+            printf("Benchmark: look-ahead limiter, ceiling %.1f dBTP, %.1f msec look-ahead, %u blocks of %u frames\n",
+                   ceilingDB, limiter.getLookahead()*1000.0, blocks, blockLength);
+            if (!RtCheck::enabled) {
+                printf("  (allocations are counted when built with cmake -DWAVEPLAYER_RT_CHECK=ON)\n");
+            }
+            bool passed = true;
+
+            // under the ceiling: the input delayed by getLatency()
+            limiter.prepare(blockLength, 2, fs);
+            uint32_t latency = limiter.getLatency();
+            std::vector<float> in;
+            std::vector<float> out;
+            for (uint32_t ctr=0; ctr<16; ctr++) {
+                fill(2, 0.25f, false);
+                in.insert(in.end(), planar.at(1), planar.at(1) + blockLength);
+                limiter.process(planar.data(), blockLength);
+                out.insert(out.end(), planar.at(1), planar.at(1) + blockLength);
+            }
+            double maxError = 0;
+            for (std::vector<float>::size_type idx=latency; idx<out.size(); idx++) {
+                maxError = std::max(maxError, (double)fabsf(out.at(idx) - in.at(idx-latency)));
+            }
+            printf("  under the ceiling: latency %u frames, max difference %.2e", latency, maxError);
+            if (maxError > 0) {
+                printf(" (FAILED)");
+                passed = false;
+            }
+            putchar('\n');
+
+            for (uint32_t mode=0; mode<3; mode++) {
+                uint32_t nCH = channels[mode];
+                limiter.prepare(blockLength, nCH, fs);
+                LevelMeter meter(nCH, fs, true);
+                std::vector<float> interleaved(blockLength*nCH);
+                double elapsed = 0;
+                uint64_t allocations = 0;
+                float peak = 0;
+                position = 0;
+                for (uint32_t ctr=0; ctr<blocks; ctr++) {
+                    fill(nCH, 0.55f, true);
+                    uint64_t count = RtCheck::getAllocationCount();
+                    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+                    {
+                        RtScope counted;
+                        limiter.process(planar.data(), blockLength);
+                    }
+                    elapsed += elapsedSec(start);
+                    allocations += RtCheck::getAllocationCount() - count;
+                    for (uint32_t frame=0; frame<blockLength; frame++) {
+                        for (uint32_t ch=0; ch<nCH; ch++) {
+                            interleaved.at(frame*nCH + ch) = planar.at(ch)[frame];
+                            peak = std::max(peak, fabsf(planar.at(ch)[frame]));
+                        }
+                    }
+                    meter.process(interleaved.data(), blockLength);
+                }
+                float truePeak = 0;
+                for (uint32_t ch=0; ch<nCH; ch++) {
+                    truePeak = std::max(truePeak, meter.getMaxTruePeak(ch));
+                }
+                printf("  %u ch: %6.2f nsec/ch/sample, peak %5.2f dBFS, true peak %5.2f dBTP, max gain reduction %5.1f dB",
+                       nCH, elapsed*1e9/((double)blocks*blockLength*nCH), LevelMeter::toDB(peak),
+                       LevelMeter::toDB(truePeak), limiter.getMaxReduction());
+                // the meter's true peak is measured after the gain changes (0.1 dB margin)
+                if ((LevelMeter::toDB(peak) > ceilingDB) || (LevelMeter::toDB(truePeak) > ceilingDB + 0.1)) {
+                    printf(" (FAILED)");
+                    passed = false;
+                }
+                if (RtCheck::enabled) {
+                    printf(", %lu allocations", (unsigned long)allocations);
+                    if (allocations > 0) {
+                        printf(" (FAILED)");
+                        passed = false;
+                    }
+                }
+                putchar('\n');
+            }
+            return passed;
+        }
+
+        static bool run(const std::string& name, uint32_t blockLength) {
+            if (name == "denormal") {
+                denormal(blockLength);
+                return true;
+            }
+            if (name == "sync") {
+                return SyncSimulation::run();
+            }
+            if (name == "streams") {
+                return streams(blockLength);
+            }
+            if (name == "rf64") {
+                return largeFile();
+            }
+            if (name == "transitions") {
+                return transitions(blockLength);
+            }
+            if (name == "dsp") {
+                return dsp(blockLength);
+            }
+            if (name == "biquad") {
+                return biquad(blockLength);
+            }
+            if (name == "limiter") {
+                return limiter(blockLength);
+            }
+            printf("Unknown benchmark: %s (available: denormal, sync, streams, rf64, transitions, dsp, biquad, limiter)\n", name.c_str());
+            return false;
+        }
+};
+
+#endif
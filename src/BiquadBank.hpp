@@ -0,0 +1,448 @@
+#ifndef BIQUAD_BANK_H_INCLUDED
+#define BIQUAD_BANK_H_INCLUDED
+
+#include "stdint.h"
+#include "math.h"
+
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "DspChain.hpp"
+
+typedef enum {
+    EQ_OFF = 0,
+    EQ_PEAK,
+    EQ_LOW_SHELF,
+    EQ_HIGH_SHELF,
+    EQ_LOW_PASS,
+    EQ_HIGH_PASS
+} EQ_BandType;
+
+struct EqBand {
+    EQ_BandType type = EQ_OFF;
+    double freq = 1000;
+    double gain = 0;    // dB (peak / shelves)
+    double q = 0.7071;
+};
+
+// Cascaded biquads (transposed direct form II) per channel: parametric EQ / room
+// correction on the output. Channels are filtered 4 at a time, one per SSE lane: a group
+// of 4 channels is packed frame by frame into a work buffer, each band runs over the
+// whole block with its coefficients in registers, and the result is unpacked.
+// Bands are edited on one control thread (setBand / addBand, then commit()) and handed
+// to the audio thread through a triple buffer, so neither side waits for the other.
+// The audio thread designs the new coefficients and ramps to them linearly over
+// smoothTime; the region of stable (a1, a2) is convex, so every filter on the way is
+// stable too.
+class BiquadBank : public DspProcessor {
+    private:
+        static constexpr uint32_t lanes = 4;
+        static constexpr uint32_t coefCount = 5;   // b0 b1 b2 a1 a2
+        static constexpr uint32_t freshFlag = 4;
+        static constexpr double smoothTime = 0.02;
+        uint32_t maxCH = 0;
+        uint32_t maxBands = 0;
+        // control thread: the bands being edited [channel][band]
+        std::vector<EqBand> edit;
+        // triple buffer: the set commit() writes, the set the audio thread reads, and the
+        // latest committed set in between (index | freshFlag until it is taken)
+        std::vector<EqBand> sets[3];
+        uint32_t writeIdx = 0;
+        uint32_t readIdx = 1;
+        std::atomic<uint32_t> latest{2};
+        // audio thread
+        uint32_t nCH = 0;
+        uint32_t groups = 0;
+        uint32_t usedBands = 0;     // bands that are run (last one that is not off, +1)
+        uint32_t targetBands = 0;
+        double fs = 48000;
+        std::vector<float> coef;    // [group][band][coefficient][lane]
+        std::vector<float> target;
+        std::vector<float> delta;
+        std::vector<float> state;   // [group][band][z1, z2][lane]
+        std::vector<float> work;    // [frame][lane]
+        std::vector<float> silence;
+        uint32_t rampLength = 0;
+        uint32_t rampLeft = 0;
+
+        // coefficients of bands (one set) for the channels of the chain; other lanes pass through
+        void loadTargets(const std::vector<EqBand>& bands) {
+            targetBands = 0;
+            for (uint32_t group=0; group<groups; group++) {
+                for (uint32_t band=0; band<maxBands; band++) {
+                    float* t = &(target[(group*maxBands + band)*coefCount*lanes]);
+                    for (uint32_t lane=0; lane<lanes; lane++) {
+                        uint32_t ch = group*lanes + lane;
+                        double c[coefCount];
+                        EqBand off;
+                        const EqBand& spec = (ch < nCH) ? bands[ch*maxBands + band] : off;
+                        design(spec, fs, c);
+                        for (uint32_t idx=0; idx<coefCount; idx++) {
+                            t[idx*lanes + lane] = (float)c[idx];
+                        }
+                        if (spec.type != EQ_OFF) {
+                            targetBands = std::max(targetBands, band+1);
+                        }
+                    }
+                }
+            }
+        }
+
+        // frames [start, end) of work through one band. ramp: the coefficients move by
+        // delta every frame
+        static void runBand(float* c, const float* d, float* z, float* data, uint32_t start, uint32_t end, bool ramp) {
+#if defined(__SSE2__)
+            __m128 b0 = _mm_loadu_ps(&(c[0]));
+            __m128 b1 = _mm_loadu_ps(&(c[4]));
+            __m128 b2 = _mm_loadu_ps(&(c[8]));
+            __m128 a1 = _mm_loadu_ps(&(c[12]));
+            __m128 a2 = _mm_loadu_ps(&(c[16]));
+            __m128 z1 = _mm_loadu_ps(&(z[0]));
+            __m128 z2 = _mm_loadu_ps(&(z[4]));
+            if (ramp) {
+                const __m128 db0 = _mm_loadu_ps(&(d[0]));
+                const __m128 db1 = _mm_loadu_ps(&(d[4]));
+                const __m128 db2 = _mm_loadu_ps(&(d[8]));
+                const __m128 da1 = _mm_loadu_ps(&(d[12]));
+                const __m128 da2 = _mm_loadu_ps(&(d[16]));
+                for (uint32_t frame=start; frame<end; frame++) {
+                    __m128 x = _mm_loadu_ps(&(data[frame*lanes]));
+                    __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+                    z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+                    z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+                    _mm_storeu_ps(&(data[frame*lanes]), y);
+                    b0 = _mm_add_ps(b0, db0);
+                    b1 = _mm_add_ps(b1, db1);
+                    b2 = _mm_add_ps(b2, db2);
+                    a1 = _mm_add_ps(a1, da1);
+                    a2 = _mm_add_ps(a2, da2);
+                }
+                _mm_storeu_ps(&(c[0]), b0);
+                _mm_storeu_ps(&(c[4]), b1);
+                _mm_storeu_ps(&(c[8]), b2);
+                _mm_storeu_ps(&(c[12]), a1);
+                _mm_storeu_ps(&(c[16]), a2);
+            } else {
+                for (uint32_t frame=start; frame<end; frame++) {
+                    __m128 x = _mm_loadu_ps(&(data[frame*lanes]));
+                    __m128 y = _mm_add_ps(_mm_mul_ps(b0, x), z1);
+                    z1 = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(b1, x), _mm_mul_ps(a1, y)), z2);
+                    z2 = _mm_sub_ps(_mm_mul_ps(b2, x), _mm_mul_ps(a2, y));
+                    _mm_storeu_ps(&(data[frame*lanes]), y);
+                }
+            }
+            _mm_storeu_ps(&(z[0]), z1);
+            _mm_storeu_ps(&(z[4]), z2);
+#else
+            for (uint32_t lane=0; lane<lanes; lane++) {
+                float b0 = c[lane], b1 = c[4+lane], b2 = c[8+lane], a1 = c[12+lane], a2 = c[16+lane];
+                float z1 = z[lane], z2 = z[4+lane];
+                for (uint32_t frame=start; frame<end; frame++) {
+                    float x = data[frame*lanes + lane];
+                    float y = b0*x + z1;
+                    z1 = b1*x - a1*y + z2;
+                    z2 = b2*x - a2*y;
+                    data[frame*lanes + lane] = y;
+                    if (ramp) {
+                        b0 += d[lane];
+                        b1 += d[4+lane];
+                        b2 += d[8+lane];
+                        a1 += d[12+lane];
+                        a2 += d[16+lane];
+                    }
+                }
+                if (ramp) {
+                    c[lane] = b0;
+                    c[4+lane] = b1;
+                    c[8+lane] = b2;
+                    c[12+lane] = a1;
+                    c[16+lane] = a2;
+                }
+                z[lane] = z1;
+                z[4+lane] = z2;
+            }
+#endif
+        }
+
+        void pack(float** src, uint32_t frames) {
+            uint32_t frame = 0;
+#if defined(__SSE2__)
+            for (; frame+4 <= frames; frame += 4) {
+                __m128 r0 = _mm_loadu_ps(&(src[0][frame]));
+                __m128 r1 = _mm_loadu_ps(&(src[1][frame]));
+                __m128 r2 = _mm_loadu_ps(&(src[2][frame]));
+                __m128 r3 = _mm_loadu_ps(&(src[3][frame]));
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(&(work[frame*lanes]), r0);
+                _mm_storeu_ps(&(work[(frame+1)*lanes]), r1);
+                _mm_storeu_ps(&(work[(frame+2)*lanes]), r2);
+                _mm_storeu_ps(&(work[(frame+3)*lanes]), r3);
+            }
+#endif
+            for (; frame<frames; frame++) {
+                for (uint32_t lane=0; lane<lanes; lane++) {
+                    work[frame*lanes + lane] = src[lane][frame];
+                }
+            }
+        }
+        void unpack(float** dest, uint32_t frames) {
+            uint32_t frame = 0;
+#if defined(__SSE2__)
+            for (; frame+4 <= frames; frame += 4) {
+                __m128 r0 = _mm_loadu_ps(&(work[frame*lanes]));
+                __m128 r1 = _mm_loadu_ps(&(work[(frame+1)*lanes]));
+                __m128 r2 = _mm_loadu_ps(&(work[(frame+2)*lanes]));
+                __m128 r3 = _mm_loadu_ps(&(work[(frame+3)*lanes]));
+                _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                _mm_storeu_ps(&(dest[0][frame]), r0);
+                _mm_storeu_ps(&(dest[1][frame]), r1);
+                _mm_storeu_ps(&(dest[2][frame]), r2);
+                _mm_storeu_ps(&(dest[3][frame]), r3);
+            }
+#endif
+            for (; frame<frames; frame++) {
+                for (uint32_t lane=0; lane<lanes; lane++) {
+                    dest[lane][frame] = work[frame*lanes + lane];
+                }
+            }
+        }
+
+    public:
+        BiquadBank(uint32_t maxChannels=16, uint32_t bandsPerChannel=8) {
+            maxCH = maxChannels;
+            maxBands = bandsPerChannel;
+            edit.assign(maxCH*maxBands, EqBand());
+            for (int idx=0; idx<3; idx++) {
+                sets[idx] = edit;
+            }
+        }
+        BiquadBank(const BiquadBank&) = delete;
+        BiquadBank& operator=(const BiquadBank&) = delete;
+
+        // b0 b1 b2 a1 a2 (normalized by a0, Audio EQ Cookbook). unity for EQ_OFF or
+        // parameters out of range
+        static void design(const EqBand& band, double fSample, double c[5]) {
+            c[0] = 1.0;
+            c[1] = c[2] = c[3] = c[4] = 0.0;
+            if ((band.type == EQ_OFF) || (fSample <= 0) || (band.freq <= 0) || (band.freq >= fSample/2) || (band.q <= 0)) {
+                return;
+            }
+            double w0 = 2.0*M_PI*band.freq/fSample;
+            double cosW = cos(w0);
+            double alpha = sin(w0)/(2.0*band.q);
+            double A = pow(10.0, band.gain/40.0);
+            double sqA = 2.0*sqrt(A)*alpha;
+            double b0 = 1, b1 = 0, b2 = 0, a0 = 1, a1 = 0, a2 = 0;
+            switch (band.type) {
+                case EQ_PEAK:
+                    b0 = 1.0 + alpha*A;
+                    b1 = -2.0*cosW;
+                    b2 = 1.0 - alpha*A;
+                    a0 = 1.0 + alpha/A;
+                    a1 = -2.0*cosW;
+                    a2 = 1.0 - alpha/A;
+                    break;
+                case EQ_LOW_SHELF:
+                    b0 = A*((A+1) - (A-1)*cosW + sqA);
+                    b1 = 2.0*A*((A-1) - (A+1)*cosW);
+                    b2 = A*((A+1) - (A-1)*cosW - sqA);
+                    a0 = (A+1) + (A-1)*cosW + sqA;
+                    a1 = -2.0*((A-1) + (A+1)*cosW);
+                    a2 = (A+1) + (A-1)*cosW - sqA;
+                    break;
+                case EQ_HIGH_SHELF:
+                    b0 = A*((A+1) + (A-1)*cosW + sqA);
+                    b1 = -2.0*A*((A-1) + (A+1)*cosW);
+                    b2 = A*((A+1) + (A-1)*cosW - sqA);
+                    a0 = (A+1) - (A-1)*cosW + sqA;
+                    a1 = 2.0*((A-1) - (A+1)*cosW);
+                    a2 = (A+1) - (A-1)*cosW - sqA;
+                    break;
+                case EQ_LOW_PASS:
+                    b0 = (1.0 - cosW)/2.0;
+                    b1 = 1.0 - cosW;
+                    b2 = (1.0 - cosW)/2.0;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0*cosW;
+                    a2 = 1.0 - alpha;
+                    break;
+                case EQ_HIGH_PASS:
+                    b0 = (1.0 + cosW)/2.0;
+                    b1 = -(1.0 + cosW);
+                    b2 = (1.0 + cosW)/2.0;
+                    a0 = 1.0 + alpha;
+                    a1 = -2.0*cosW;
+                    a2 = 1.0 - alpha;
+                    break;
+                default:
+                    return;
+            }
+            c[0] = b0/a0;
+            c[1] = b1/a0;
+            c[2] = b2/a0;
+            c[3] = a1/a0;
+            c[4] = a2/a0;
+        }
+
+        // "<channel>:<type>:<freq>:<gain>:<q>" (channel: 1- or all (0), type: peak, lowshelf,
+        // highshelf, lowpass, highpass; gain / q may be omitted)
+        static bool parseBand(const std::string& spec, uint32_t& channel, EqBand& band) {
+            std::vector<std::string> fields;
+            std::string::size_type pos = 0;
+            while (pos <= spec.length()) {
+                std::string::size_type next = spec.find(':', pos);
+                if (next == std::string::npos) {
+                    next = spec.length();
+                }
+                fields.push_back(spec.substr(pos, next-pos));
+                pos = next+1;
+            }
+            if ((fields.size() < 3) || (fields.size() > 5)) {
+                return false;
+            }
+            const char* names[] = {"peak", "lowshelf", "highshelf", "lowpass", "highpass"};
+            const EQ_BandType types[] = {EQ_PEAK, EQ_LOW_SHELF, EQ_HIGH_SHELF, EQ_LOW_PASS, EQ_HIGH_PASS};
+            band = EqBand();
+            for (int idx=0; idx<5; idx++) {
+                if (fields.at(1) == names[idx]) {
+                    band.type = types[idx];
+                }
+            }
+            if (band.type == EQ_OFF) {
+                return false;
+            }
+            try {
+                channel = (fields.at(0) == "all") ? 0 : (uint32_t)std::stoul(fields.at(0));
+                band.freq = std::stod(fields.at(2));
+                if (fields.size() > 3) {
+                    band.gain = std::stod(fields.at(3));
+                }
+                if (fields.size() > 4) {
+                    band.q = std::stod(fields.at(4));
+                }
+            } catch (const std::exception& e) {
+                return false;
+            }
+            return (band.freq > 0) && (band.q > 0);
+        }
+
+        uint32_t getMaxChannels() {
+            return maxCH;
+        }
+        uint32_t getBandsPerChannel() {
+            return maxBands;
+        }
+
+        // control thread. channel is 0-based here; applied by commit()
+        bool setBand(uint32_t channel, uint32_t index, const EqBand& band) {
+            if ((channel >= maxCH) || (index >= maxBands)) {
+                return false;
+            }
+            edit.at(channel*maxBands + index) = band;
+            return true;
+        }
+        // into the first unused band of channel. false if they are all used
+        bool addBand(uint32_t channel, const EqBand& band) {
+            for (uint32_t index=0; (channel < maxCH) && (index < maxBands); index++) {
+                if (edit.at(channel*maxBands + index).type == EQ_OFF) {
+                    return setBand(channel, index, band);
+                }
+            }
+            return false;
+        }
+        void clear() {
+            std::fill(edit.begin(), edit.end(), EqBand());
+        }
+        bool isEmpty() {
+            for (std::vector<EqBand>::size_type idx=0; idx<edit.size(); idx++) {
+                if (edit.at(idx).type != EQ_OFF) {
+                    return false;
+                }
+            }
+            return true;
+        }
+        // hand the edited bands to the audio thread (does not allocate or wait)
+        void commit() {
+            std::copy(edit.begin(), edit.end(), sets[writeIdx].begin());
+            writeIdx = latest.exchange(writeIdx | freshFlag, std::memory_order_acq_rel) & 3;
+        }
+
+        // audio thread (as the rest of the chain)
+        bool prepare(uint32_t maxBlock, uint32_t channels, double fSample) override {
+            if ((channels == 0) || (channels > maxCH)) {
+                return false;
+            }
+            nCH = channels;
+            fs = fSample;
+            groups = (nCH + lanes - 1) / lanes;
+            std::size_t coefSize = (std::size_t)groups*maxBands*coefCount*lanes;
+            coef.assign(coefSize, 0.0f);
+            target.assign(coefSize, 0.0f);
+            delta.assign(coefSize, 0.0f);
+            state.assign((std::size_t)groups*maxBands*2*lanes, 0.0f);
+            work.assign((std::size_t)maxBlock*lanes, 0.0f);
+            silence.assign(maxBlock, 0.0f);
+            rampLength = std::max<uint32_t>((uint32_t)(smoothTime*fs), 1);
+            rampLeft = 0;
+            if (latest.load(std::memory_order_acquire) & freshFlag) {
+                readIdx = latest.exchange(readIdx, std::memory_order_acq_rel) & 3;
+            }
+            loadTargets(sets[readIdx]);
+            coef = target;
+            usedBands = targetBands;
+            return true;
+        }
+
+        void process(float** data, uint32_t frames) override {
+            if (latest.load(std::memory_order_acquire) & freshFlag) {
+                readIdx = latest.exchange(readIdx, std::memory_order_acq_rel) & 3;
+                loadTargets(sets[readIdx]);
+                for (std::vector<float>::size_type idx=0; idx<coef.size(); idx++) {
+                    delta[idx] = (target[idx] - coef[idx]) / rampLength;
+                }
+                rampLeft = rampLength;
+                usedBands = std::max(usedBands, targetBands);
+            }
+            if (usedBands == 0) {
+                return;
+            }
+            uint32_t rampFrames = std::min(frames, rampLeft);
+            bool rampEnds = (rampFrames > 0) && (rampFrames == rampLeft);
+            for (uint32_t group=0; group<groups; group++) {
+                float* lanePtr[lanes];
+                for (uint32_t lane=0; lane<lanes; lane++) {
+                    uint32_t ch = group*lanes + lane;
+                    lanePtr[lane] = (ch < nCH) ? data[ch] : silence.data();
+                }
+                pack(lanePtr, frames);
+                for (uint32_t band=0; band<usedBands; band++) {
+                    std::size_t offset = (std::size_t)(group*maxBands + band)*coefCount*lanes;
+                    float* c = &(coef[offset]);
+                    float* z = &(state[(std::size_t)(group*maxBands + band)*2*lanes]);
+                    if (rampFrames > 0) {
+                        runBand(c, &(delta[offset]), z, work.data(), 0, rampFrames, true);
+                        if (rampEnds) {
+                            std::copy(&(target[offset]), &(target[offset]) + coefCount*lanes, c);
+                        }
+                    }
+                    runBand(c, nullptr, z, work.data(), rampFrames, frames, false);
+                }
+                unpack(lanePtr, frames);
+            }
+            rampLeft -= rampFrames;
+            if (rampEnds) {
+                usedBands = targetBands;
+            }
+        }
+        const char* getName() override {
+            return "eq";
+        }
+};
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef CROSSFADE_H_INCLUDED
+#define CROSSFADE_H_INCLUDED
+
+#include "stdint.h"
+#include "math.h"
+
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+// Equal-power crossfade between the tail of one file and the head of the next
+// (same channel count, interleaved). The gains of each frame are sin / cos of a
+// quarter period sampled at the frame centers, so fadeIn^2 + fadeOut^2 = 1 and the
+// overlap of uncorrelated material keeps its power.
+class Crossfade {
+    private:
+        std::vector<float> fadeIn;
+        std::vector<float> fadeOut;
+        uint32_t length = 0;
+
+    public:
+        // maxFrames: longest fade (the tables are not reallocated for shorter ones)
+        Crossfade(uint32_t maxFrames=0) {
+            fadeIn.reserve(maxFrames);
+            fadeOut.reserve(maxFrames);
+        }
+
+        void setLength(uint32_t frames) {
+            if (frames == length) {
+                return;
+            }
+            length = frames;
+            fadeIn.resize(length);
+            fadeOut.resize(length);
+            for (uint32_t idx=0; idx<length; idx++) {
+                double phase = M_PI_2 * (idx + 0.5) / length;
+                fadeIn.at(idx) = sin(phase);
+                fadeOut.at(idx) = cos(phase);
+            }
+        }
+        uint32_t getLength() {
+            return length;
+        }
+
+        // dest = dest * fadeOut + in * inGain * fadeIn for frames [pos, pos+frames) of the fade
+        void mix(float* dest, const float* in, uint32_t channels, uint32_t pos, uint32_t frames, float inGain=1.0f) {
+            if (pos + frames > length) {
+                frames = (pos < length) ? length - pos : 0;
+            }
+            const float* gIn = fadeIn.data() + pos;
+            const float* gOut = fadeOut.data() + pos;
+            uint32_t frame = 0;
+#if defined(__SSE2__)
+            const __m128 vGain = _mm_set1_ps(inGain);
+            if (channels == 1) {
+                for (; frame+4 <= frames; frame += 4) {
+                    __m128 x = _mm_mul_ps(_mm_loadu_ps(&(dest[frame])), _mm_loadu_ps(&(gOut[frame])));
+                    __m128 y = _mm_mul_ps(_mm_loadu_ps(&(in[frame])), _mm_mul_ps(_mm_loadu_ps(&(gIn[frame])), vGain));
+                    _mm_storeu_ps(&(dest[frame]), _mm_add_ps(x, y));
+                }
+            } else if (channels == 2) {
+                // gains of two frames: g0 g0 g1 g1
+                for (; frame+2 <= frames; frame += 2) {
+                    __m128 go = _mm_castpd_ps(_mm_load_sd((const double*)&(gOut[frame])));
+                    __m128 gi = _mm_castpd_ps(_mm_load_sd((const double*)&(gIn[frame])));
+                    go = _mm_unpacklo_ps(go, go);
+                    gi = _mm_mul_ps(_mm_unpacklo_ps(gi, gi), vGain);
+                    __m128 x = _mm_mul_ps(_mm_loadu_ps(&(dest[frame*2])), go);
+                    __m128 y = _mm_mul_ps(_mm_loadu_ps(&(in[frame*2])), gi);
+                    _mm_storeu_ps(&(dest[frame*2]), _mm_add_ps(x, y));
+                }
+            } else {
+                for (; frame<frames; frame++) {
+                    __m128 go = _mm_set1_ps(gOut[frame]);
+                    __m128 gi = _mm_set1_ps(gIn[frame]*inGain);
+                    float* d = &(dest[frame*channels]);
+                    const float* s = &(in[frame*channels]);
+                    uint32_t ch = 0;
+                    for (; ch+4 <= channels; ch += 4) {
+                        __m128 x = _mm_mul_ps(_mm_loadu_ps(&(d[ch])), go);
+                        __m128 y = _mm_mul_ps(_mm_loadu_ps(&(s[ch])), gi);
+                        _mm_storeu_ps(&(d[ch]), _mm_add_ps(x, y));
+                    }
+                    for (; ch<channels; ch++) {
+                        d[ch] = d[ch]*gOut[frame] + s[ch]*gIn[frame]*inGain;
+                    }
+                }
+            }
+#endif
+            for (; frame<frames; frame++) {
+                for (uint32_t ch=0; ch<channels; ch++) {
+                    uint32_t idx = frame*channels + ch;
+                    dest[idx] = dest[idx]*gOut[frame] + in[idx]*gIn[frame]*inGain;
+                }
+            }
+        }
+};
+
+#endif
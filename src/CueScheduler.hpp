@@ -0,0 +1,364 @@
+#ifndef CUE_SCHEDULER_H_INCLUDED
+#define CUE_SCHEDULER_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "math.h"
+
+#include <atomic>
+#include <mutex>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GaplessLooper.hpp"
+#include "buffers.hpp"
+
+// Timeline of cues (file, start frame, optional loop region, gain) rendered with
+// sample accuracy: a cue starting in the middle of a block starts at that frame of
+// the block. Pending cues are kept sorted by start frame (std::multiset, O(log n)
+// insertion). Cues may be added or cancelled from any thread while playing: the
+// control side sends them to render() through a lock-free ring and gets finished /
+// cancelled cues back through another one, so render() takes no mutex and opens,
+// closes or frees nothing. It still reads the cue files (WaveFile::read, i.e. stdio
+// fread / fseeko, which take the FILE lock). The control side deletes finished cues
+// in collect() (also called by addCue() / cancel()).
+class CueScheduler {
+    private:
+        enum CueState {
+            CUE_QUEUED = 0,
+            CUE_PENDING,
+            CUE_ACTIVE,
+            CUE_DONE
+        };
+        struct Cue;
+        struct CueLess {
+            bool operator()(const Cue* a, const Cue* b) const {
+                return a->startFrame < b->startFrame;
+            }
+        };
+        typedef std::multiset<Cue*, CueLess> CueSet;
+        struct Cue {
+            int id = -1;
+            GaplessLooper* wf = nullptr;
+            uint32_t channels = 0;
+            uint64_t startFrame = 0;
+            // loops the region set on wf
+            bool loop = false;
+            float gain = 1.0f;
+            // control side: a cancel has been sent (wait for its reply before deleting)
+            bool cancelSent = false;
+            // render side: the node of pending (allocated by addCue(), moved in and out
+            // without allocation), the position in it, and the links of the active list
+            CueSet::node_type node;
+            CueSet::iterator pendingPos;
+            int state = CUE_QUEUED;
+            Cue* prev = nullptr;
+            Cue* next = nullptr;
+        };
+        // control -> render
+        struct Command {
+            Cue* cue;
+            bool cancel;
+        };
+        // render -> control: a cue that has ended, or the reply to a cancel
+        struct Retired {
+            Cue* cue;
+            bool cancelled;
+        };
+        uint32_t nOutputs = 2;
+        uint32_t fs = 48000;
+        uint32_t blockLength = 1024;
+        uint32_t maxCues = 4096;
+        uint64_t now = 0;
+        // control side (addCue / cancel / collect may be called from several threads)
+        std::mutex mx;
+        int nextId = 0;
+        std::unordered_map<int, Cue*> cues;
+        // at most two commands and two retired entries per cue in cues (see maxCues)
+        ring_buffer<Command> commands;
+        ring_buffer<Retired> retired;
+        // render side
+        CueSet pending;
+        Cue* activeHead = nullptr;
+        Cue* activeTail = nullptr;
+        std::vector<float> readBuf;
+        std::atomic<uint32_t> activeCount{0};
+        std::atomic<uint32_t> pendingCount{0};
+
+        // add frames of cue to dest from offset (frames in block); false when it has ended
+        bool renderCue(Cue* cue, float* dest, uint32_t offset, uint32_t frames) {
+            float* buf = readBuf.data();
+            uint32_t want = frames - offset;
+            uint32_t got = cue->wf->prepareFrame(buf, want, !cue->loop);
+            for (uint32_t frame=0; frame<got; frame++) {
+                float* out = &(dest[(offset+frame)*nOutputs]);
+                const float* in = &(buf[frame*cue->channels]);
+                if (cue->channels == 1) {
+                    for (uint32_t ch=0; ch<nOutputs; ch++) {
+                        out[ch] += in[0]*cue->gain;
+                    }
+                } else {
+                    for (uint32_t ch=0; (ch<nOutputs) && (ch<cue->channels); ch++) {
+                        out[ch] += in[ch]*cue->gain;
+                    }
+                }
+            }
+            return got == want;
+        }
+
+        void releaseCue(Cue* cue) {
+            delete cue->wf;
+            delete cue;
+        }
+
+        // render side
+        void appendActive(Cue* cue) {
+            cue->state = CUE_ACTIVE;
+            cue->prev = activeTail;
+            cue->next = nullptr;
+            if (activeTail) {
+                activeTail->next = cue;
+            } else {
+                activeHead = cue;
+            }
+            activeTail = cue;
+            activeCount.fetch_add(1, std::memory_order_relaxed);
+        }
+        void unlinkActive(Cue* cue) {
+            if (cue->prev) {
+                cue->prev->next = cue->next;
+            } else {
+                activeHead = cue->next;
+            }
+            if (cue->next) {
+                cue->next->prev = cue->prev;
+            } else {
+                activeTail = cue->prev;
+            }
+            activeCount.fetch_sub(1, std::memory_order_relaxed);
+        }
+        void retire(Cue* cue, bool cancelled) {
+            cue->state = CUE_DONE;
+            Retired entry = {cue, cancelled};
+            retired.put_data_memcpy(&entry, 1);
+        }
+        void applyCommands() {
+            Command command;
+            while (commands.get_data_memcpy(&command, 1) == 1) {
+                Cue* cue = command.cue;
+                if (!command.cancel) {
+                    cue->pendingPos = pending.insert(std::move(cue->node));
+                    cue->state = CUE_PENDING;
+                    continue;
+                }
+                if (cue->state == CUE_PENDING) {
+                    cue->node = pending.extract(cue->pendingPos);
+                    pendingCount.fetch_sub(1, std::memory_order_relaxed);
+                } else if (cue->state == CUE_ACTIVE) {
+                    unlinkActive(cue);
+                }
+                // a cue that has already ended is handed back a second time
+                retire(cue, true);
+            }
+        }
+
+        // control side, with mx held. a cancelled cue is deleted on the reply to its
+        // cancel (it may have ended before render() saw the cancel)
+        void collectLocked() {
+            Retired entry;
+            while (retired.get_data_memcpy(&entry, 1) == 1) {
+                if (entry.cue->cancelSent && !entry.cancelled) {
+                    continue;
+                }
+                cues.erase(entry.cue->id);
+                releaseCue(entry.cue);
+            }
+        }
+
+    public:
+        struct CueSpec {
+            std::string fileName;
+            uint64_t startFrame = 0;
+            float gainDB = 0.0f;
+            bool loop = false;
+            uint64_t loopStart = 0;
+            uint64_t loopEnd = 0;
+        };
+
+        // <file>@<start frame>[,<gain dB>[,<loop start>[,<loop end>]]]
+        static bool parseCueSpec(const std::string& arg, CueSpec& spec) {
+            std::string::size_type at = arg.rfind('@');
+            if ((at == std::string::npos) || (at == 0)) {
+                return false;
+            }
+            spec = CueSpec();
+            spec.fileName = arg.substr(0, at);
+            std::vector<std::string> fields;
+            std::string::size_type begin = at+1;
+            while (true) {
+                std::string::size_type comma = arg.find(',', begin);
+                fields.push_back(arg.substr(begin, (comma == std::string::npos) ? std::string::npos : comma-begin));
+                if (comma == std::string::npos) {
+                    break;
+                }
+                begin = comma+1;
+            }
+            if (fields.size() > 4) {
+                return false;
+            }
+            try {
+                spec.startFrame = std::stoull(fields.at(0));
+                if (fields.size() > 1) {
+                    spec.gainDB = std::stof(fields.at(1));
+                }
+                if (fields.size() > 2) {
+                    spec.loop = true;
+                    spec.loopStart = std::stoull(fields.at(2));
+                }
+                if (fields.size() > 3) {
+                    spec.loopEnd = std::stoull(fields.at(3));
+                }
+            } catch (const std::exception& e) {
+                return false;
+            }
+            return true;
+        }
+
+        // cues: most cues alive at a time (added and not collected yet)
+        CueScheduler(uint32_t outputs=2, uint32_t fSample=48000, uint32_t block=1024, uint32_t cueCount=4096)
+            : commands(2*cueCount), retired(2*cueCount) {
+            nOutputs = outputs;
+            fs = fSample;
+            blockLength = block;
+            maxCues = cueCount;
+            // enough for any file up to 8 channels
+            readBuf.resize(blockLength*8);
+        }
+        ~CueScheduler() {
+            for (std::unordered_map<int, Cue*>::iterator it=cues.begin(); it!=cues.end(); ++it) {
+                releaseCue(it->second);
+            }
+        }
+
+        // schedule fileName at startFrame of the timeline; loopEnd 0 loops to the end of data.
+        // returns the cue id, or -1 (file error or sampling rate mismatch)
+        int addCue(const std::string& fileName, uint64_t startFrame, float gainDB=0.0f,
+                   bool loop=false, uint64_t loopStart=0, uint64_t loopEnd=0) {
+            GaplessLooper* wf = new GaplessLooper(fileName);
+            if (!wf->isFileOpened() || !wf->isWaveFile()) {
+                printf("Cue: cannot open %s\n", fileName.c_str());
+                delete wf;
+                return -1;
+            }
+            if (wf->getSampleFreq() != fs) {
+                printf("Cue: %s is %u Hz (timeline: %u Hz)\n", fileName.c_str(), wf->getSampleFreq(), fs);
+                delete wf;
+                return -1;
+            }
+            if ((wf->getChannels() < 1) || (wf->getChannels() > 8)) {
+                printf("Cue: %s has %d channels\n", fileName.c_str(), wf->getChannels());
+                delete wf;
+                return -1;
+            }
+            if (loop && !wf->setLoopRegion(loopStart, (loopEnd > 0) ? loopEnd : wf->getFrameCount())) {
+                printf("Cue: invalid loop region %llu - %llu\n",
+                       (unsigned long long)loopStart, (unsigned long long)loopEnd);
+                delete wf;
+                return -1;
+            }
+            Cue* cue = new Cue();
+            cue->wf = wf;
+            cue->channels = wf->getChannels();
+            cue->startFrame = startFrame;
+            cue->loop = loop;
+            cue->gain = (gainDB == -INFINITY) ? 0.0f : powf(10, gainDB/20.0);
+            CueSet node;
+            node.insert(cue);
+            cue->node = node.extract(node.begin());
+            std::lock_guard<std::mutex> lock(mx);
+            collectLocked();
+            if (cues.size() >= maxCues) {
+                printf("Cue: too many cues (%u)\n", maxCues);
+                releaseCue(cue);
+                return -1;
+            }
+            cue->id = nextId++;
+            cues[cue->id] = cue;
+            pendingCount.fetch_add(1, std::memory_order_relaxed);
+            Command command = {cue, false};
+            commands.put_data_memcpy(&command, 1);
+            return cue->id;
+        }
+        int addCue(const CueSpec& spec) {
+            return addCue(spec.fileName, spec.startFrame, spec.gainDB, spec.loop, spec.loopStart, spec.loopEnd);
+        }
+
+        // stop (or unschedule) a cue at the next block
+        void cancel(int id) {
+            std::lock_guard<std::mutex> lock(mx);
+            collectLocked();
+            std::unordered_map<int, Cue*>::iterator it = cues.find(id);
+            if ((it == cues.end()) || it->second->cancelSent) {
+                return;
+            }
+            it->second->cancelSent = true;
+            Command command = {it->second, true};
+            commands.put_data_memcpy(&command, 1);
+        }
+
+        // close and free the cues render() has finished with (control side)
+        void collect() {
+            std::lock_guard<std::mutex> lock(mx);
+            collectLocked();
+        }
+
+        uint64_t getTimelineFrame() {
+            return now;
+        }
+        uint32_t getActiveCount() {
+            return activeCount.load(std::memory_order_relaxed);
+        }
+        uint32_t getPendingCount() {
+            return pendingCount.load(std::memory_order_relaxed);
+        }
+        bool isIdle() {
+            return (getActiveCount() == 0) && (getPendingCount() == 0);
+        }
+
+        // add the next frames (<= block length) of the timeline to dest (interleaved).
+        // no mutex, allocation, open or close; cues are read with stdio (from the
+        // render thread only)
+        uint32_t render(float* dest, uint32_t frames) {
+            if (frames > blockLength) {
+                frames = blockLength;
+            }
+            uint64_t blockEnd = now + frames;
+            applyCommands();
+            for (Cue* cue=activeHead; cue; ) {
+                Cue* next = cue->next;
+                if (!renderCue(cue, dest, 0, frames)) {
+                    unlinkActive(cue);
+                    retire(cue, false);
+                }
+                cue = next;
+            }
+            while (!pending.empty() && ((*pending.begin())->startFrame < blockEnd)) {
+                Cue* cue = *pending.begin();
+                cue->node = pending.extract(pending.begin());
+                pendingCount.fetch_sub(1, std::memory_order_relaxed);
+                // a cue added after its start frame has passed starts at the top of this block
+                uint32_t offset = (cue->startFrame > now) ? (uint32_t)(cue->startFrame - now) : 0;
+                if (renderCue(cue, dest, offset, frames)) {
+                    appendActive(cue);
+                } else {
+                    retire(cue, false);
+                }
+            }
+            now = blockEnd;
+            return frames;
+        }
+};
+
+#endif
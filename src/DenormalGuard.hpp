@@ -0,0 +1,83 @@
+#ifndef DENORMAL_GUARD_H_INCLUDED
+#define DENORMAL_GUARD_H_INCLUDED
+
+#include "stdint.h"
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#endif
+
+// Sets flush-to-zero / denormals-are-zero for the calling thread while alive,
+// restores the previous mode on destruction.
+// pollEvents() reports whether an underflow / denormal operand was seen since the last poll.
+class ScopedFlushDenormals {
+    private:
+#if defined(__SSE__)
+        static constexpr uint32_t csrFTZ = 0x8000;
+        static constexpr uint32_t csrDAZ = 0x0040;
+        static constexpr uint32_t csrDenormalFlag = 0x0002;
+        static constexpr uint32_t csrUnderflowFlag = 0x0010;
+        uint32_t savedMode = 0;
+#elif defined(__aarch64__)
+        static constexpr uint64_t fpcrFZ = (1ULL << 24);
+        static constexpr uint64_t fpsrUnderflowFlag = (1ULL << 3);
+        static constexpr uint64_t fpsrInputDenormalFlag = (1ULL << 7);
+        uint64_t savedMode = 0;
+#endif
+
+    public:
+        ScopedFlushDenormals() {
+#if defined(__SSE__)
+            savedMode = _mm_getcsr();
+            _mm_setcsr(savedMode | csrFTZ | csrDAZ);
+#elif defined(__aarch64__)
+            uint64_t fpcr = 0;
+            asm volatile("mrs %0, fpcr" : "=r"(fpcr));
+            savedMode = fpcr;
+            asm volatile("msr fpcr, %0" : : "r"(fpcr | fpcrFZ));
+#endif
+        }
+        ~ScopedFlushDenormals() {
+#if defined(__SSE__)
+            // keep the sticky flags raised while the guard was active
+            uint32_t flags = _mm_getcsr() & (csrDenormalFlag | csrUnderflowFlag);
+            _mm_setcsr(savedMode | flags);
+#elif defined(__aarch64__)
+            asm volatile("msr fpcr, %0" : : "r"(savedMode));
+#endif
+        }
+        ScopedFlushDenormals(const ScopedFlushDenormals&) = delete;
+        ScopedFlushDenormals& operator=(const ScopedFlushDenormals&) = delete;
+
+        static bool isSupported() {
+#if defined(__SSE__) || defined(__aarch64__)
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        // read and clear the sticky underflow / denormal flags of the calling thread
+        static bool pollEvents() {
+#if defined(__SSE__)
+            uint32_t csr = _mm_getcsr();
+            if ((csr & (csrDenormalFlag | csrUnderflowFlag)) == 0) {
+                return false;
+            }
+            _mm_setcsr(csr & ~(csrDenormalFlag | csrUnderflowFlag));
+            return true;
+#elif defined(__aarch64__)
+            uint64_t fpsr = 0;
+            asm volatile("mrs %0, fpsr" : "=r"(fpsr));
+            if ((fpsr & (fpsrUnderflowFlag | fpsrInputDenormalFlag)) == 0) {
+                return false;
+            }
+            asm volatile("msr fpsr, %0" : : "r"(fpsr & ~(fpsrUnderflowFlag | fpsrInputDenormalFlag)));
+            return true;
+#else
+            return false;
+#endif
+        }
+};
+
+#endif
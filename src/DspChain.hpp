@@ -0,0 +1,230 @@
+#ifndef DSP_CHAIN_H_INCLUDED
+#define DSP_CHAIN_H_INCLUDED
+
+#include "stdint.h"
+#include "string.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "LevelMeter.hpp"
+#include "MatrixFader.hpp"
+
+// Stage of a DspChain. prepare() is called before the first block (and again when the
+// format changes) and allocates everything the stage needs; process() runs on the
+// decode thread for every block and must not allocate, lock or block.
+class DspProcessor {
+    public:
+        virtual ~DspProcessor() {}
+        // false if the stage cannot run with this format (it is skipped)
+        virtual bool prepare(uint32_t maxBlock, uint32_t channels, double fs) = 0;
+        // data[channel][frame], frames <= maxBlock, processed in place
+        virtual void process(float** data, uint32_t frames) = 0;
+        virtual const char* getName() = 0;
+        // frames by which the stage delays its input (look-ahead)
+        virtual uint32_t getLatency() {
+            return 0;
+        }
+};
+
+// Stages run in order on planar buffers of the chain. process() takes interleaved data
+// (the read chunk) and converts it to / from the planar buffers allocated in prepare().
+// The stages are not owned by the chain.
+class DspChain {
+    private:
+        std::vector<DspProcessor*> stages;
+        std::vector<char> enabled;
+        std::vector<float> planarData;
+        std::vector<float*> planar;
+        uint32_t maxBlock = 0;
+        uint32_t nCH = 0;
+        double fs = 0;
+        bool prepared = false;
+
+    public:
+        DspChain() {}
+        DspChain(const DspChain&) = delete;
+        DspChain& operator=(const DspChain&) = delete;
+
+        // add before prepare()
+        void add(DspProcessor* stage) {
+            if (stage) {
+                stages.push_back(stage);
+                enabled.push_back(0);
+                prepared = false;
+            }
+        }
+
+        bool prepare(uint32_t maxBlockLength, uint32_t channels, double fSample) {
+            maxBlock = maxBlockLength;
+            nCH = channels;
+            fs = fSample;
+            planarData.assign((std::size_t)maxBlock*nCH, 0.0f);
+            planar.resize(nCH);
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                planar.at(ch) = &(planarData.at((std::size_t)ch*maxBlock));
+            }
+            for (std::vector<DspProcessor*>::size_type idx=0; idx<stages.size(); idx++) {
+                enabled.at(idx) = stages.at(idx)->prepare(maxBlock, nCH, fs) ? 1 : 0;
+            }
+            prepared = (maxBlock > 0) && (nCH > 0);
+            return prepared;
+        }
+        bool isPrepared() {
+            return prepared;
+        }
+        bool isEmpty() {
+            return stages.empty();
+        }
+        uint32_t getChannels() {
+            return nCH;
+        }
+        uint32_t getMaxBlock() {
+            return maxBlock;
+        }
+        double getSampleFreq() {
+            return fs;
+        }
+        std::vector<DspProcessor*>::size_type getStageCount() {
+            return stages.size();
+        }
+        DspProcessor* getStage(std::vector<DspProcessor*>::size_type idx) {
+            return (idx < stages.size()) ? stages.at(idx) : nullptr;
+        }
+        // frames by which the output lags the input (sum over the stages)
+        uint32_t getLatency() {
+            uint32_t latency = 0;
+            for (std::vector<DspProcessor*>::size_type idx=0; idx<stages.size(); idx++) {
+                if (enabled.at(idx)) {
+                    latency += stages.at(idx)->getLatency();
+                }
+            }
+            return latency;
+        }
+
+        // planar data of the chain's format, frames <= maxBlock
+        void processPlanar(float** data, uint32_t frames) {
+            for (std::vector<DspProcessor*>::size_type idx=0; idx<stages.size(); idx++) {
+                if (enabled[idx]) {
+                    stages[idx]->process(data, frames);
+                }
+            }
+        }
+
+        // interleaved data of getChannels() channels, in place (in blocks of maxBlock)
+        void process(float* data, uint32_t frames) {
+            if (!prepared || stages.empty()) {
+                return;
+            }
+            for (uint32_t done=0; done<frames; ) {
+                uint32_t length = std::min(frames - done, maxBlock);
+                float* block = &(data[(std::size_t)done*nCH]);
+                for (uint32_t frame=0; frame<length; frame++) {
+                    for (uint32_t ch=0; ch<nCH; ch++) {
+                        planar[ch][frame] = block[frame*nCH + ch];
+                    }
+                }
+                processPlanar(planar.data(), length);
+                for (uint32_t frame=0; frame<length; frame++) {
+                    for (uint32_t ch=0; ch<nCH; ch++) {
+                        block[frame*nCH + ch] = planar[ch][frame];
+                    }
+                }
+                done += length;
+            }
+        }
+};
+
+// MatrixFader as a stage: one input / output per channel (identity routing), so the
+// input gains (setInputGain) apply a gain per channel. The cross points can be changed
+// through getFader() for other routings within the channel count.
+class FaderStage : public DspProcessor {
+    private:
+        MatrixFader fader;
+        std::vector<float> outData;
+        std::vector<float*> in;
+        std::vector<float*> out;
+        std::vector<float> silence;
+        uint32_t nCH = 0;
+
+    public:
+        FaderStage(uint32_t maxChannels=16) : fader(maxChannels, maxChannels) {
+            for (uint32_t ch=0; ch<maxChannels; ch++) {
+                fader.setCrossPointGain(ch, ch, 0.0);
+            }
+        }
+
+        MatrixFader& getFader() {
+            return fader;
+        }
+        // same gain for every input
+        void setGain(float gainDB) {
+            for (uint32_t ch=0; ch<fader.getInputCount(); ch++) {
+                fader.setInputGain(ch, gainDB);
+            }
+        }
+
+        bool prepare(uint32_t maxBlock, uint32_t channels, double fs) override {
+            nCH = channels;
+            if ((channels == 0) || (channels > fader.getInputCount())) {
+                return false;
+            }
+            // mix() reads every routed input and writes every output of the fader: the
+            // inputs above the channel count read silence
+            silence.assign(maxBlock, 0.0f);
+            in.assign(fader.getInputCount(), silence.data());
+            uint32_t outputs = fader.getOutputCount();
+            outData.assign((std::size_t)maxBlock*outputs, 0.0f);
+            out.resize(outputs);
+            for (uint32_t ch=0; ch<outputs; ch++) {
+                out.at(ch) = &(outData.at((std::size_t)ch*maxBlock));
+            }
+            return true;
+        }
+        void process(float** data, uint32_t frames) override {
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                in[ch] = data[ch];
+            }
+            fader.mix(in.data(), frames, out.data(), frames);
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                memcpy(data[ch], out[ch], sizeof(float)*frames);
+            }
+        }
+        const char* getName() override {
+            return "fader";
+        }
+};
+
+// LevelMeter as a stage (it reads interleaved data: the block is interleaved into a
+// buffer of the stage). The meter is configured to the chain's format in prepare().
+class MeterStage : public DspProcessor {
+    private:
+        LevelMeter& meter;
+        std::vector<float> interleaved;
+        uint32_t nCH = 0;
+
+    public:
+        MeterStage(LevelMeter& levelMeter) : meter(levelMeter) {}
+
+        bool prepare(uint32_t maxBlock, uint32_t channels, double fs) override {
+            nCH = channels;
+            interleaved.assign((std::size_t)maxBlock*channels, 0.0f);
+            if (meter.getSourceChannels() != channels) {
+                meter.configure(channels, fs);
+            }
+            return channels > 0;
+        }
+        void process(float** data, uint32_t frames) override {
+            for (uint32_t frame=0; frame<frames; frame++) {
+                for (uint32_t ch=0; ch<nCH; ch++) {
+                    interleaved[frame*nCH + ch] = data[ch][frame];
+                }
+            }
+            meter.process(interleaved.data(), frames);
+        }
+        const char* getName() override {
+            return "meter";
+        }
+};
+
+#endif
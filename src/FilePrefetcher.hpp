@@ -0,0 +1,248 @@
+#ifndef FILE_PREFETCHER_H_INCLUDED
+#define FILE_PREFETCHER_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "GaplessLooper.hpp"
+#include "PcmCache.hpp"
+#include "Playlist.hpp"
+#include "ReaderPool.hpp"
+
+// A playlist entry opened ahead of time, with its first frames already decoded.
+// read() plays the decoded head first and then continues from the reader.
+struct PrefetchedFile {
+    Playlist::Iterator item;
+    GaplessLooper* reader = nullptr;
+    std::string path;
+    std::vector<float> head;
+    uint32_t headFrames = 0;
+    uint32_t headPos = 0;
+
+    PrefetchedFile() {
+        path.reserve(4096);
+    }
+
+    // file frame of the next read()
+    uint64_t getPosition() {
+        return reader ? reader->getPositionFrames() - (headFrames - headPos) : 0;
+    }
+    // frames left to play
+    uint64_t getRemaining() {
+        if (!reader) {
+            return 0;
+        }
+        uint64_t end = reader->getFrameCount();
+        uint64_t pos = reader->getPositionFrames();
+        return ((end > pos) ? end - pos : 0) + (headFrames - headPos);
+    }
+    // shorter than frames at the end of the file
+    uint32_t read(float* dest, uint32_t frames) {
+        if (!reader) {
+            return 0;
+        }
+        uint32_t channels = reader->getChannels();
+        uint32_t fromHead = std::min(frames, headFrames - headPos);
+        if (fromHead > 0) {
+            memcpy(dest, &(head[headPos*channels]), sizeof(float)*fromHead*channels);
+            headPos += fromHead;
+        }
+        if (fromHead == frames) {
+            return frames;
+        }
+        return fromHead + reader->prepareFrame(&(dest[fromHead*channels]), frames - fromHead, true);
+    }
+};
+
+// Opens the next playlist entry on its own thread while the current one plays, so a
+// file change (or a crossfade into the head of the next file) does not wait for the
+// disk. The finished reader is handed back with the request and retired to the cache
+// / returned to the pool here: after start() PcmCache and ReaderPool are used only by
+// this thread. request() / isReady() / take() are called from the decode thread.
+class FilePrefetcher {
+    private:
+        Playlist& playlist;
+        PcmCache& pcmCache;
+        ReaderPool& readers;
+        bool verbose = false;
+        // channels of the output (0: not known yet); other entries are skipped
+        std::atomic<uint32_t> channels{0};
+        std::thread worker;
+        std::mutex mx;
+        std::condition_variable cvRequest;
+        std::condition_variable cvDone;
+        bool quit = false;
+        bool requested = false;
+        bool pending = false;
+        bool done = false;
+        bool found = false;
+        // request
+        Playlist::Iterator requestItem;
+        bool advance = true;
+        GaplessLooper* finished = nullptr;
+        uint32_t requestFrames = 0;
+        // result
+        PrefetchedFile result;
+
+        // the reader for item, or the next entry in the play order that can be played with
+        // the output's channel count (files from a list are not checked up front).
+        // nullptr if none of them can be played.
+        GaplessLooper* open(Playlist::Iterator& item, std::string& path) {
+            GaplessLooper* wf = readers.acquire();
+            for (std::size_t tries=0; item.isValid() && (tries <= playlist.size()); tries++) {
+                WaveHeader header;
+                item.getPath(path);
+                bool opened = false;
+                if (item.getHeader(header)) {
+                    opened = pcmCache.reopen(wf, path, verbose, &header);
+                } else {
+                    opened = pcmCache.reopen(wf, path, verbose);
+                }
+                uint32_t outputChannels = channels.load();
+                if (!opened || !wf->isFileOpened() || !wf->isWaveFile() || (wf->getChannels() == 0) || (wf->getFrameCount() == 0)) {
+                    printf("Skipped (cannot play): %s\n", path.c_str());
+                } else if ((outputChannels > 0) && ((uint32_t)wf->getChannels() != outputChannels)) {
+                    printf("Skipped (%u channels, playback: %u channels): %s\n", wf->getChannels(), outputChannels, path.c_str());
+                } else {
+                    return wf;
+                }
+                item = item.next();
+            }
+            readers.release(wf);
+            return nullptr;
+        }
+
+        void run() {
+            while (true) {
+                Playlist::Iterator item;
+                GaplessLooper* retired = nullptr;
+                uint32_t frames = 0;
+                bool moveNext = true;
+                {
+                    std::unique_lock<std::mutex> lock(mx);
+                    cvRequest.wait(lock, [&]() { return quit || requested; });
+                    if (quit) {
+                        return;
+                    }
+                    requested = false;
+                    item = requestItem;
+                    retired = finished;
+                    finished = nullptr;
+                    frames = requestFrames;
+                    moveNext = advance;
+                }
+                if (retired) {
+                    pcmCache.retire(retired);
+                    readers.release(retired);
+                }
+                if (moveNext) {
+                    item = item.next();
+                }
+                GaplessLooper* wf = open(item, result.path);
+                if (wf) {
+                    result.item = item;
+                    result.reader = wf;
+                    result.head.resize(frames*wf->getChannels());
+                    result.headFrames = (frames > 0) ? wf->prepareFrame(result.head.data(), frames, true) : 0;
+                    result.headPos = 0;
+                }
+                std::lock_guard<std::mutex> lock(mx);
+                found = (wf != nullptr);
+                done = true;
+                cvDone.notify_all();
+            }
+        }
+
+    public:
+        FilePrefetcher(Playlist& list, PcmCache& cache, ReaderPool& pool, bool verboseOutput=false)
+            : playlist(list), pcmCache(cache), readers(pool) {
+            verbose = verboseOutput;
+        }
+        ~FilePrefetcher() {
+            stop();
+        }
+        FilePrefetcher(const FilePrefetcher&) = delete;
+        FilePrefetcher& operator=(const FilePrefetcher&) = delete;
+
+        // channel count of the output (the first file); call before the next request()
+        void setChannels(uint32_t outputChannels) {
+            channels.store(outputChannels);
+        }
+
+        void start() {
+            if (!worker.joinable()) {
+                worker = std::thread([this]() { run(); });
+            }
+        }
+        // a prefetched reader that was not taken goes back to the pool
+        void stop() {
+            {
+                std::lock_guard<std::mutex> lock(mx);
+                quit = true;
+                cvRequest.notify_all();
+            }
+            if (worker.joinable()) {
+                // wakes up an Iterator::next() waiting for the scan
+                playlist.close();
+                worker.join();
+            }
+            if (finished) {
+                pcmCache.retire(finished);
+                readers.release(finished);
+                finished = nullptr;
+            }
+            if (done && found) {
+                readers.release(result.reader);
+            }
+            result.reader = nullptr;
+            done = false;
+            pending = false;
+        }
+
+        // open the entry after item (or item itself with next=false) and decode headFrames
+        // of it. finished: the reader that has been played (retired / released, may be nullptr)
+        void request(const Playlist::Iterator& item, GaplessLooper* finishedReader, uint32_t headFrames, bool next=true) {
+            std::lock_guard<std::mutex> lock(mx);
+            requestItem = item;
+            advance = next;
+            finished = finishedReader;
+            requestFrames = headFrames;
+            requested = true;
+            pending = true;
+            done = false;
+            cvRequest.notify_one();
+        }
+        bool isReady() {
+            std::lock_guard<std::mutex> lock(mx);
+            return pending && done;
+        }
+        // waits for the requested entry and swaps it into dest (dest's reader must have
+        // been handed back). false if there is nothing to play next (end of the list)
+        bool take(PrefetchedFile& dest) {
+            std::unique_lock<std::mutex> lock(mx);
+            if (!pending) {
+                return false;
+            }
+            cvDone.wait(lock, [&]() { return done || quit; });
+            pending = false;
+            if (!done || !found) {
+                return false;
+            }
+            done = false;
+            std::swap(dest, result);
+            result.reader = nullptr;
+            return true;
+        }
+};
+
+#endif
@@ -0,0 +1,92 @@
+#ifndef GAPLESS_LOOPER_H_INCLUDED
+#define GAPLESS_LOOPER_H_INCLUDED
+
+#include "stdint.h"
+#include "string.h"
+
+#include <memory>
+#include <string>
+
+#include "WaveLoader.hpp"
+
+class GaplessLooper : public WaveFile {
+    public:
+        // file frame at the start of the last prepared chunk, and the chunk offset
+        // where it wrapped (to chunkWrapFrame). a short loop region may wrap several
+        // times in one chunk: the last wrap is recorded.
+        uint64_t chunkStartFrame = 0;
+        uint32_t chunkWrapOffset = 0;
+        uint64_t chunkWrapFrame = 0;
+        bool chunkWrapped = false;
+
+        GaplessLooper(std::string fileName, bool verbose=false): WaveFile(fileName, "r", verbose) {}
+        GaplessLooper(std::string fileName, const WaveHeader& header): WaveFile(fileName, header) {}
+        GaplessLooper() {}
+        GaplessLooper(const std::shared_ptr<DecodedPcm>& cached): WaveFile(cached) {}
+
+        bool reopen(const std::string& fileName, bool verbose=false) {
+            resetChunkInfo();
+            return WaveFile::reopen(fileName, verbose);
+        }
+        bool reopen(const std::string& fileName, const WaveHeader& header) {
+            resetChunkInfo();
+            return WaveFile::reopen(fileName, header);
+        }
+        bool reopen(const std::shared_ptr<DecodedPcm>& cached) {
+            resetChunkInfo();
+            return WaveFile::reopen(cached);
+        }
+        void resetChunkInfo() {
+            chunkStartFrame = 0;
+            chunkWrapOffset = 0;
+            chunkWrapFrame = 0;
+            chunkWrapped = false;
+        }
+
+        // fill chunkLength frames, wrapping from the loop end (or the end of data) to the
+        // loop start (or the top of the file). with noloop the data is read once and the
+        // returned length is shorter at the end of data.
+        uint32_t prepareFrame(float* dest, uint32_t chunkLength, bool noloop=false) {
+            if (!isFileOpened()) {
+                return 0;
+            }
+            uint32_t channels = getChannels();
+            uint32_t filled = 0;
+            chunkStartFrame = getPositionFrames();
+            chunkWrapped = false;
+            while (filled < chunkLength) {
+                uint64_t pos = getPositionFrames();
+                uint64_t end = getFrameCount();
+                if (!noloop && hasLoopRegion() && (pos <= getLoopEnd())) {
+                    end = getLoopEnd();
+                }
+                uint32_t want = chunkLength - filled;
+                if (want > end - pos) {
+                    want = (end > pos) ? (uint32_t)(end - pos) : 0;
+                }
+                uint32_t got = (want > 0) ? read(&(dest[filled*channels]), want) : 0;
+                filled += got;
+                if ((filled == chunkLength) || noloop) {
+                    break;
+                }
+                // at the loop end or the end of data (got < want: truncated data)
+                uint64_t target = hasLoopRegion() ? getLoopStart() : 0;
+                if ((got == 0) && (pos == target)) {
+                    // nothing to play between target and end
+                    break;
+                }
+                if (!seekFrame(target)) {
+                    break;
+                }
+                chunkWrapOffset = filled;
+                chunkWrapFrame = target;
+                chunkWrapped = true;
+            }
+            if (!noloop && (filled < chunkLength)) {
+                memset(&(dest[filled*channels]), 0, sizeof(float)*(chunkLength-filled)*channels);
+            }
+            return filled;
+        }
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef LATENCY_CALIBRATOR_H_INCLUDED
+#define LATENCY_CALIBRATOR_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "time.h"
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "AudioManipulator.hpp"
+
+// Output configuration found by LatencyCalibrator
+struct LatencySetting {
+    unsigned long framesPerBuffer = 0;
+    double suggestedLatency = -1;  // [sec]
+    uint32_t chunkLength = 0;
+    uint32_t rbLength = 0;
+};
+
+// Per-device storage of calibrated settings (one tab separated line per device and fs)
+// device \t fs \t framesPerBuffer \t suggestedLatency \t chunkLength \t rbLength
+class LatencyProfile {
+    private:
+        struct Entry {
+            std::string device;
+            double fs;
+            LatencySetting setting;
+        };
+        std::vector<Entry> entries;
+
+    public:
+        bool load(const std::string& path) {
+            entries.clear();
+            FILE* pFile = fopen(path.c_str(), "r");
+            if (!pFile) {
+                return false;
+            }
+            char line[1024] = {};
+            while (fgets(line, sizeof(line), pFile)) {
+                std::string str(line);
+                std::string::size_type tab = str.find('\t');
+                if (tab == std::string::npos) {
+                    continue;
+                }
+                Entry entry;
+                entry.device = str.substr(0, tab);
+                unsigned long chunk = 0;
+                unsigned long rb = 0;
+                if (sscanf(str.c_str()+tab+1, "%lf\t%lu\t%lf\t%lu\t%lu", &(entry.fs),
+                           &(entry.setting.framesPerBuffer), &(entry.setting.suggestedLatency),
+                           &chunk, &rb) != 5) {
+                    continue;
+                }
+                entry.setting.chunkLength = chunk;
+                entry.setting.rbLength = rb;
+                entries.push_back(entry);
+            }
+            fclose(pFile);
+            return true;
+        }
+
+        bool save(const std::string& path) {
+            FILE* pFile = fopen(path.c_str(), "w");
+            if (!pFile) {
+                return false;
+            }
+            for (std::vector<Entry>::size_type ctr=0; ctr<entries.size(); ctr++) {
+                const Entry& entry = entries.at(ctr);
+                fprintf(pFile, "%s\t%.0f\t%lu\t%.6f\t%u\t%u\n", entry.device.c_str(), entry.fs,
+                        entry.setting.framesPerBuffer, entry.setting.suggestedLatency,
+                        entry.setting.chunkLength, entry.setting.rbLength);
+            }
+            fclose(pFile);
+            return true;
+        }
+
+        bool find(const std::string& device, double fs, LatencySetting& dest) {
+            for (std::vector<Entry>::size_type ctr=0; ctr<entries.size(); ctr++) {
+                if ((entries.at(ctr).device == device) && (entries.at(ctr).fs == fs)) {
+                    dest = entries.at(ctr).setting;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        void store(const std::string& device, double fs, const LatencySetting& setting) {
+            for (std::vector<Entry>::size_type ctr=0; ctr<entries.size(); ctr++) {
+                if ((entries.at(ctr).device == device) && (entries.at(ctr).fs == fs)) {
+                    entries.at(ctr).setting = setting;
+                    return;
+                }
+            }
+            Entry entry;
+            entry.device = device;
+            entry.fs = fs;
+            entry.setting = setting;
+            entries.push_back(entry);
+        }
+};
+
+// Steps the callback buffer size and suggested latency down while playing,
+// and keeps the lowest configuration which produced neither callback
+// underflow flags nor ring buffer underruns during the soak interval.
+class LatencyCalibrator {
+    public:
+        // fills dest with `frames` interleaved frames
+        typedef std::function<void(float* dest, uint32_t frames)> Source;
+
+    private:
+        int deviceIndex = 0;
+        double fs = 48000;
+        int channels = 2;
+        double soakTime = 5.0;
+        uint32_t rbFactor = 4;
+        std::atomic<bool>* abortFlag = nullptr;
+        Source source;
+        std::string deviceName;
+
+        bool soak(unsigned long cbFrames, double latency, LatencySetting& setting,
+                  unsigned long& xruns, unsigned long& underruns, double& streamLatency) {
+            setting.framesPerBuffer = cbFrames;
+            setting.suggestedLatency = latency;
+            setting.chunkLength = cbFrames;
+            setting.rbLength = cbFrames*rbFactor;
+            AudioManipulator aOut(deviceIndex, "o", fs, "f32", channels,
+                                  setting.rbLength, setting.chunkLength,
+                                  setting.framesPerBuffer, setting.suggestedLatency);
+            if (!aOut.isDeviceAvailable()) {
+                return false;
+            }
+            deviceName = aOut.getDeviceName();
+            int nCH = aOut.getChannelCount();
+            std::vector<AudioData> block(setting.chunkLength*channels);
+            std::vector<AudioData> outBlock(setting.chunkLength*nCH);
+            aOut.start();
+            timespec startTime = {};
+            timespec curTime = {};
+            clock_gettime(CLOCK_MONOTONIC, &startTime);
+            bool warmedUp = false;
+            double elapsed = 0.0;
+            while (elapsed < (soakTime + 0.5)) {
+                if (abortFlag && abortFlag->load()) {
+                    break;
+                }
+                source(&(block[0].f32), setting.chunkLength);
+                // fold the source channels onto the device channels
+                for (uint32_t fctr=0; fctr<setting.chunkLength; fctr++) {
+                    for (int ch=0; ch<nCH; ch++) {
+                        outBlock[fctr*nCH+ch] = block[fctr*channels+(ch % channels)];
+                    }
+                }
+                aOut.blockingWrite(outBlock.data(), setting.chunkLength, 1000);
+                clock_gettime(CLOCK_MONOTONIC, &curTime);
+                elapsed = (double)(curTime.tv_sec - startTime.tv_sec)
+                          + (double)(curTime.tv_nsec - startTime.tv_nsec)*1e-9;
+                if (!warmedUp && (elapsed >= 0.5)) {
+                    // ignore the start-up transient
+                    aOut.resetXrunCounts();
+                    warmedUp = true;
+                }
+            }
+            xruns = aOut.getCbXrunCount();
+            underruns = aOut.getRbUnderrunCount();
+            streamLatency = aOut.getStreamLatency();
+            aOut.stop();
+            aOut.close();
+            return warmedUp;
+        }
+
+    public:
+        LatencyCalibrator(int device, double fSample, int nChannels, Source src) {
+            deviceIndex = device;
+            fs = fSample;
+            channels = nChannels;
+            source = src;
+        }
+
+        void setSoakTime(double sec) {
+            soakTime = sec;
+        }
+        void setAbortFlag(std::atomic<bool>* flag) {
+            abortFlag = flag;
+        }
+        std::string getDeviceName() {
+            return deviceName;
+        }
+
+        // returns false when no configuration was stable
+        bool run(LatencySetting& best, unsigned long maxFrames=4096, unsigned long minFrames=16) {
+            const double latencyFactors[] = {2.0, 1.0, 0.5};
+            bool found = false;
+            printf("Calibrating output latency (soak: %.1f sec per step)\n", soakTime);
+            printf("%8s|%10s|%10s|%7s|%9s|\n", "frames", "suggested", "reported", "xruns", "underrun");
+            for (unsigned long frames=maxFrames; frames>=minFrames; frames /= 2) {
+                bool anyStable = false;
+                for (double factor : latencyFactors) {
+                    LatencySetting setting;
+                    unsigned long xruns = 0;
+                    unsigned long underruns = 0;
+                    double streamLatency = 0.0;
+                    double latency = factor*(double)frames / fs;
+                    if (!soak(frames, latency, setting, xruns, underruns, streamLatency)) {
+                        if (abortFlag && abortFlag->load()) {
+                            return found;
+                        }
+                        printf("%8lu|%8.2fms|%10s|%7s|%9s| open failed\n", frames, latency*1000, "-", "-", "-");
+                        continue;
+                    }
+                    bool stable = (xruns == 0) && (underruns == 0);
+                    printf("%8lu|%8.2fms|%8.2fms|%7lu|%9lu| %s\n", frames, latency*1000,
+                           streamLatency*1000, xruns, underruns, stable ? "OK" : "NG");
+                    fflush(stdout);
+                    if (stable) {
+                        best = setting;
+                        found = true;
+                        anyStable = true;
+                    }
+                }
+                if (!anyStable) {
+                    break;
+                }
+            }
+            return found;
+        }
+};
+
+#endif
@@ -0,0 +1,348 @@
+#ifndef LATENCY_PROBE_H_INCLUDED
+#define LATENCY_PROBE_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+
+#include <atomic>
+#include <complex>
+#include <string>
+#include <vector>
+
+#include "portaudio.h"
+#include "RTCheck.hpp"
+#include "DenormalGuard.hpp"
+
+typedef enum {
+    PROBE_MLS = 0,
+    PROBE_IMPULSE
+} ProbeSignal;
+
+// Round-trip latency measurement.
+// process() is driven by a duplex callback: it plays the test signal on every output
+// channel and captures the sum of the input channels, both indexed by the same frame
+// counter. analyze() cross-correlates the capture with the test signal; the lag of the
+// correlation peak is the round-trip delay in frames.
+class LatencyProbe {
+    private:
+        double fs = 48000;
+        int inChannels = 1;
+        int outChannels = 2;
+        uint32_t leadFrames = 0;
+        std::vector<float> signal;
+        std::vector<float> capture;
+        uint32_t position = 0;
+        std::atomic<bool> armed{false};
+        std::atomic<bool> finished{false};
+
+        // maximal length LFSR feedback masks for order 10 - 18 (right shift, output bit 0)
+        static uint32_t mlsTaps(int order) {
+            switch (order) {
+                case 10: return 0x9;     // x^10 + x^7 + 1
+                case 11: return 0x5;     // x^11 + x^9 + 1
+                case 12: return 0x941;   // x^12 + x^6 + x^4 + x + 1
+                case 13: return 0x1601;  // x^13 + x^4 + x^3 + x + 1
+                case 14: return 0x2A01;  // x^14 + x^5 + x^3 + x + 1
+                case 15: return 0x3;     // x^15 + x^14 + 1
+                case 16: return 0x100B;  // x^16 + x^15 + x^13 + x^4 + 1
+                case 17: return 0x9;     // x^17 + x^14 + 1
+                case 18: return 0x81;    // x^18 + x^11 + 1
+                default: return 0;
+            }
+        }
+
+        static void fft(std::vector<std::complex<double>>& data, bool inverse) {
+            size_t n = data.size();
+            for (size_t i=1, j=0; i<n; i++) {
+                size_t bit = n >> 1;
+                for (; j & bit; bit >>= 1) {
+                    j ^= bit;
+                }
+                j ^= bit;
+                if (i < j) {
+                    std::swap(data[i], data[j]);
+                }
+            }
+            for (size_t len=2; len<=n; len <<= 1) {
+                double angle = 2.0*M_PI/(double)len*(inverse ? 1.0 : -1.0);
+                std::complex<double> wlen(cos(angle), sin(angle));
+                for (size_t i=0; i<n; i+=len) {
+                    std::complex<double> w(1.0, 0.0);
+                    for (size_t j=0; j<len/2; j++) {
+                        std::complex<double> u = data[i+j];
+                        std::complex<double> v = data[i+j+len/2]*w;
+                        data[i+j] = u + v;
+                        data[i+j+len/2] = u - v;
+                        w *= wlen;
+                    }
+                }
+            }
+            if (inverse) {
+                for (size_t i=0; i<n; i++) {
+                    data[i] /= (double)n;
+                }
+            }
+        }
+
+    public:
+        // maxDelay: longest round trip searched [sec]
+        LatencyProbe(double fSample, int inputChannels, int outputChannels,
+                     ProbeSignal type=PROBE_MLS, int mlsOrder=15, double maxDelay=1.0, float level=0.25f) {
+            fs = fSample;
+            inChannels = (inputChannels > 0) ? inputChannels : 1;
+            outChannels = (outputChannels > 0) ? outputChannels : 1;
+            leadFrames = (uint32_t)(fs*0.05);
+            if (type == PROBE_IMPULSE) {
+                signal.assign(1, level);
+            } else {
+                uint32_t taps = mlsTaps(mlsOrder);
+                if (taps == 0) {
+                    mlsOrder = 15;
+                    taps = mlsTaps(mlsOrder);
+                }
+                uint32_t length = (1u << mlsOrder) - 1;
+                uint32_t state = 1;
+                signal.resize(length);
+                for (uint32_t ctr=0; ctr<length; ctr++) {
+                    signal[ctr] = (state & 1) ? level : -level;
+                    uint32_t feedback = 0;
+                    for (uint32_t bits = state & taps; bits; bits &= bits-1) {
+                        feedback ^= 1;
+                    }
+                    state = (state >> 1) | (feedback << (mlsOrder-1));
+                }
+            }
+            capture.assign(leadFrames + signal.size() + (uint32_t)(fs*maxDelay), 0.0f);
+        }
+
+        // start a new measurement (call while the probe is idle)
+        void arm() {
+            position = 0;
+            finished.store(false, std::memory_order_relaxed);
+            armed.store(true, std::memory_order_release);
+        }
+        bool isFinished() {
+            return finished.load(std::memory_order_acquire);
+        }
+
+        // audio callback side: no allocation, no locking
+        void process(const float* in, float* out, unsigned long frames) {
+            bool running = armed.load(std::memory_order_acquire);
+            for (unsigned long frame=0; frame<frames; frame++) {
+                float value = 0.0f;
+                if (running && (position < capture.size())) {
+                    uint32_t sigPos = position - leadFrames;
+                    if ((position >= leadFrames) && (sigPos < signal.size())) {
+                        value = signal[sigPos];
+                    }
+                    float sum = 0.0f;
+                    if (in) {
+                        for (int ch=0; ch<inChannels; ch++) {
+                            sum += in[frame*inChannels+ch];
+                        }
+                    }
+                    capture[position] = sum;
+                    position++;
+                    if (position == capture.size()) {
+                        armed.store(false, std::memory_order_relaxed);
+                        finished.store(true, std::memory_order_release);
+                        running = false;
+                    }
+                }
+                if (out) {
+                    for (int ch=0; ch<outChannels; ch++) {
+                        out[frame*outChannels+ch] = value;
+                    }
+                }
+            }
+        }
+
+        // delayFrames: round trip [frames], quality: correlation peak to sidelobe ratio [dB]
+        bool analyze(long& delayFrames, double& quality, double minQuality=20.0) {
+            size_t n = 1;
+            while (n < capture.size() + signal.size()) {
+                n <<= 1;
+            }
+            std::vector<std::complex<double>> capSpec(n);
+            std::vector<std::complex<double>> sigSpec(n);
+            for (size_t ctr=0; ctr<capture.size(); ctr++) {
+                capSpec[ctr] = capture[ctr];
+            }
+            for (size_t ctr=0; ctr<signal.size(); ctr++) {
+                sigSpec[ctr] = signal[ctr];
+            }
+            fft(capSpec, false);
+            fft(sigSpec, false);
+            for (size_t ctr=0; ctr<n; ctr++) {
+                capSpec[ctr] *= std::conj(sigSpec[ctr]);
+            }
+            fft(capSpec, true);
+            // lags which keep the whole signal inside the capture
+            size_t lagCount = capture.size() - signal.size() + 1;
+            size_t peakLag = 0;
+            double peak = 0;
+            for (size_t lag=0; lag<lagCount; lag++) {
+                double value = fabs(capSpec[lag].real());
+                if (value > peak) {
+                    peak = value;
+                    peakLag = lag;
+                }
+            }
+            // RMS of the correlation away from the peak
+            double energy = 0;
+            size_t count = 0;
+            size_t guard = (size_t)(fs*0.002);
+            for (size_t lag=0; lag<lagCount; lag++) {
+                if ((lag + guard >= peakLag) && (lag <= peakLag + guard)) {
+                    continue;
+                }
+                energy += capSpec[lag].real()*capSpec[lag].real();
+                count++;
+            }
+            double floor = (count > 0) ? sqrt(energy/count) : 0;
+            quality = (floor > 0) ? 20*log10(peak/floor) : (peak > 0 ? 200.0 : 0.0);
+            delayFrames = (long)peakLag - (long)leadFrames;
+            return (peak > 0) && (quality >= minQuality) && (delayFrames >= 0);
+        }
+
+        double getSampleRate() {
+            return fs;
+        }
+        int getInputChannels() {
+            return inChannels;
+        }
+        int getOutputChannels() {
+            return outChannels;
+        }
+        uint32_t getSignalLength() {
+            return signal.size();
+        }
+};
+
+// Software loopback: feeds the probe output back to its input through a delay line,
+// so that the measurement itself can be checked without audio hardware.
+class LoopbackSink {
+    private:
+        uint32_t delay = 0;
+        float gain = 0.5f;
+        float noise = 0.0f;
+        uint32_t noiseState = 22222;
+
+    public:
+        LoopbackSink(uint32_t delayFrames, float loopGain=0.5f, float noiseLevel=0.01f) {
+            delay = delayFrames;
+            gain = loopGain;
+            noise = noiseLevel;
+        }
+
+        // run one measurement with callback blocks of blockFrames
+        // (a round trip shorter than one block is not possible: the delay is at least blockFrames)
+        void run(LatencyProbe& probe, unsigned long blockFrames=256) {
+            if (delay < blockFrames) {
+                delay = blockFrames;
+            }
+            int inCH = probe.getInputChannels();
+            int outCH = probe.getOutputChannels();
+            std::vector<float> in(blockFrames*inCH);
+            std::vector<float> out(blockFrames*outCH);
+            std::vector<float> line(delay + blockFrames, 0.0f);
+            size_t writePos = delay;
+            size_t readPos = 0;
+            probe.arm();
+            while (!probe.isFinished()) {
+                for (unsigned long frame=0; frame<blockFrames; frame++) {
+                    noiseState = noiseState*1664525u + 1013904223u;
+                    float dither = noise*((float)(noiseState >> 8)/8388608.0f - 1.0f);
+                    for (int ch=0; ch<inCH; ch++) {
+                        in[frame*inCH+ch] = (ch == 0) ? gain*line[readPos] + dither : dither;
+                    }
+                    readPos = (readPos + 1) % line.size();
+                }
+                probe.process(in.data(), out.data(), blockFrames);
+                for (unsigned long frame=0; frame<blockFrames; frame++) {
+                    line[writePos] = out[frame*outCH];
+                    writePos = (writePos + 1) % line.size();
+                }
+            }
+        }
+};
+
+// Duplex PortAudio stream driving a LatencyProbe
+class LatencyProbeStream {
+    private:
+        PaStream* aStream = nullptr;
+        PaError openStatus = paNotInitialized;
+        LatencyProbe* probe = nullptr;
+        const PaStreamInfo* streamInfo = nullptr;
+
+        static int duplexCallback(const void* input, void* output, unsigned long frameCount,
+                                  const PaStreamCallbackTimeInfo* timeInfo,
+                                  PaStreamCallbackFlags statusFlags, void* userData) {
+            RtScope rtContext;
+            ScopedFlushDenormals ftz;
+            reinterpret_cast<LatencyProbe*>(userData)->process((const float*)input, (float*)output, frameCount);
+            return 0;
+        }
+
+    public:
+        // PortAudio has to be initialized by the caller
+        LatencyProbeStream(int inDevice, int outDevice, LatencyProbe& target,
+                           unsigned long framesPerBuffer=0, double latency=-1) {
+            probe = &target;
+            const PaDeviceInfo* inInfo = Pa_GetDeviceInfo(inDevice);
+            const PaDeviceInfo* outInfo = Pa_GetDeviceInfo(outDevice);
+            if (!inInfo || !outInfo) {
+                fprintf(stderr, "PortAudio - invalid device index: %d / %d\n", inDevice, outDevice);
+                openStatus = paInvalidDevice;
+                return;
+            }
+            PaStreamParameters inParams = {};
+            inParams.device = inDevice;
+            inParams.channelCount = target.getInputChannels();
+            inParams.sampleFormat = paFloat32;
+            inParams.suggestedLatency = (latency >= 0) ? latency : inInfo->defaultLowInputLatency;
+            PaStreamParameters outParams = {};
+            outParams.device = outDevice;
+            outParams.channelCount = target.getOutputChannels();
+            outParams.sampleFormat = paFloat32;
+            outParams.suggestedLatency = (latency >= 0) ? latency : outInfo->defaultLowOutputLatency;
+            openStatus = Pa_OpenStream(&aStream, &inParams, &outParams, target.getSampleRate(),
+                                       framesPerBuffer, paNoFlag, duplexCallback, probe);
+            if (openStatus != paNoError) {
+                fprintf(stderr, "PortAudio - opening duplex stream failed: %s ( %d )\n",
+                        Pa_GetErrorText(openStatus), openStatus);
+                aStream = nullptr;
+                return;
+            }
+            streamInfo = Pa_GetStreamInfo(aStream);
+        }
+        ~LatencyProbeStream() {
+            if (aStream) {
+                Pa_StopStream(aStream);
+                Pa_CloseStream(aStream);
+            }
+        }
+
+        bool isOpened() {
+            return aStream != nullptr;
+        }
+        bool start() {
+            return aStream && (Pa_StartStream(aStream) == paNoError);
+        }
+        void stop() {
+            if (aStream) {
+                Pa_StopStream(aStream);
+            }
+        }
+        // input + output latency reported by PortAudio for the open stream [sec]
+        double getReportedLatency() {
+            if (!streamInfo) {
+                return -1;
+            }
+            return streamInfo->inputLatency + streamInfo->outputLatency;
+        }
+};
+
+#endif
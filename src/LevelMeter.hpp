@@ -0,0 +1,314 @@
+#ifndef LEVEL_METER_H_INCLUDED
+#define LEVEL_METER_H_INCLUDED
+
+#include "stdint.h"
+#include "math.h"
+
+#include <atomic>
+#include <cstring>
+#include <limits>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+constexpr uint32_t METER_MAX_CHANNELS = 32;
+constexpr uint32_t TP_PHASES = 4;  // oversampling factor for true-peak
+constexpr uint32_t TP_TAPS = 12;   // taps per polyphase branch (48 taps total)
+
+// Per-channel sample peak / RMS / true-peak meter.
+// process() takes one interleaved block: peak and RMS of every channel come from one
+// SIMD pass over it, the true peak from a second pass per channel (vectorized over the
+// polyphase branches). Sources with more than METER_MAX_CHANNELS channels are read
+// with their own stride and the first METER_MAX_CHANNELS channels are metered.
+// Results are published through atomics so that another thread (UI, stats) can read them.
+class LevelMeter {
+    private:
+        // metered channels / channels of the interleaved source
+        uint32_t nCH = 0;
+        uint32_t srcCH = 0;
+        double fs = 48000;
+        bool truePeakEnabled = false;
+        float holdTime = 1.5;    // [sec]
+        float decayRate = 20.0;  // [dB/sec]
+        float rmsTime = 0.3;     // [sec]
+
+        // tpCoeffs[tap][phase]: one SIMD vector per tap, lanes are the 4 output phases
+        alignas(16) float tpCoeffs[TP_TAPS][TP_PHASES] = {};
+        // double-length history per channel; tpHistory[ch][tpPos+j] = x[n-j]
+        alignas(16) float tpHistory[METER_MAX_CHANNELS][TP_TAPS*2] = {};
+        uint32_t tpPos = 0;
+
+        float msState[METER_MAX_CHANNELS] = {};
+        float holdRemain[METER_MAX_CHANNELS] = {};
+        float heldState[METER_MAX_CHANNELS] = {};
+        float blockPeak[METER_MAX_CHANNELS] = {};
+        float blockSq[METER_MAX_CHANNELS] = {};
+        float blockTP[METER_MAX_CHANNELS] = {};
+
+        std::atomic<float> peak[METER_MAX_CHANNELS];
+        std::atomic<float> rms[METER_MAX_CHANNELS];
+        std::atomic<float> truePeak[METER_MAX_CHANNELS];
+        std::atomic<float> heldPeak[METER_MAX_CHANNELS];
+        std::atomic<float> maxPeak[METER_MAX_CHANNELS];
+        std::atomic<float> maxTruePeak[METER_MAX_CHANNELS];
+
+        static uint32_t gcd(uint32_t a, uint32_t b) {
+            while (b != 0) {
+                uint32_t t = a % b;
+                a = b;
+                b = t;
+            }
+            return a;
+        }
+
+        // peak and sum of squares, vectorized over lcm(srcCH, 4) floats per step
+        uint32_t scanPeakSquare(const float* src, uint32_t frames) {
+            uint32_t total = frames*srcCH;
+            uint32_t idx = 0;
+#if defined(__SSE2__)
+            constexpr uint32_t maxVec = METER_MAX_CHANNELS;
+            uint32_t stride = (srcCH*4) / gcd(srcCH, 4);
+            uint32_t nVec = stride / 4;
+            if (nVec <= maxVec) {
+                __m128 vMax[maxVec];
+                __m128 vSq[maxVec];
+                const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+                for (uint32_t v=0; v<nVec; v++) {
+                    vMax[v] = _mm_setzero_ps();
+                    vSq[v] = _mm_setzero_ps();
+                }
+                for (; (idx+stride) <= total; idx += stride) {
+                    for (uint32_t v=0; v<nVec; v++) {
+                        __m128 x = _mm_loadu_ps(&(src[idx+v*4]));
+                        vMax[v] = _mm_max_ps(vMax[v], _mm_and_ps(x, absMask));
+                        vSq[v] = _mm_add_ps(vSq[v], _mm_mul_ps(x, x));
+                    }
+                }
+                alignas(16) float lMax[4];
+                alignas(16) float lSq[4];
+                for (uint32_t v=0; v<nVec; v++) {
+                    _mm_store_ps(lMax, vMax[v]);
+                    _mm_store_ps(lSq, vSq[v]);
+                    for (uint32_t lane=0; lane<4; lane++) {
+                        uint32_t ch = (v*4+lane) % srcCH;
+                        if (ch >= nCH) {
+                            continue;
+                        }
+                        if (blockPeak[ch] < lMax[lane]) {
+                            blockPeak[ch] = lMax[lane];
+                        }
+                        blockSq[ch] += lSq[lane];
+                    }
+                }
+            }
+#endif
+            for (; idx<total; idx++) {
+                uint32_t ch = idx % srcCH;
+                if (ch >= nCH) {
+                    continue;
+                }
+                float x = src[idx];
+                float ax = fabsf(x);
+                if (blockPeak[ch] < ax) {
+                    blockPeak[ch] = ax;
+                }
+                blockSq[ch] += x*x;
+            }
+            return total;
+        }
+
+        // 4x oversampled peak, vectorized over the polyphase branches
+        void scanTruePeak(const float* src, uint32_t frames) {
+            for (uint32_t fctr=0; fctr<frames; fctr++) {
+                tpPos = (tpPos == 0) ? (TP_TAPS-1) : (tpPos-1);
+                for (uint32_t ch=0; ch<nCH; ch++) {
+                    float x = src[fctr*srcCH+ch];
+                    float* hist = tpHistory[ch];
+                    hist[tpPos] = x;
+                    hist[tpPos+TP_TAPS] = x;
+#if defined(__SSE2__)
+                    __m128 acc = _mm_setzero_ps();
+                    for (uint32_t j=0; j<TP_TAPS; j++) {
+                        acc = _mm_add_ps(acc, _mm_mul_ps(_mm_load_ps(tpCoeffs[j]),
+                                                         _mm_set1_ps(hist[tpPos+j])));
+                    }
+                    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+                    acc = _mm_and_ps(acc, absMask);
+                    acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(1, 0, 3, 2)));
+                    acc = _mm_max_ps(acc, _mm_shuffle_ps(acc, acc, _MM_SHUFFLE(2, 3, 0, 1)));
+                    float tp = _mm_cvtss_f32(acc);
+#else
+                    float tp = 0.0;
+                    for (uint32_t p=0; p<TP_PHASES; p++) {
+                        float y = 0.0;
+                        for (uint32_t j=0; j<TP_TAPS; j++) {
+                            y += tpCoeffs[j][p]*hist[tpPos+j];
+                        }
+                        y = fabsf(y);
+                        if (tp < y) {
+                            tp = y;
+                        }
+                    }
+#endif
+                    if (blockTP[ch] < tp) {
+                        blockTP[ch] = tp;
+                    }
+                }
+            }
+        }
+
+    public:
+        // coeffs[tap][phase] (also used by the true-peak detector of Limiter)
+        static void designTruePeakFilter(float coeffs[TP_TAPS][TP_PHASES]) {
+            // windowed sinc interpolator (cutoff at the original Nyquist frequency),
+            // each phase normalized to unity DC gain
+            constexpr uint32_t nTaps = TP_TAPS*TP_PHASES;
+            double h[nTaps] = {};
+            const double center = (double)(nTaps-1) / 2.0;
+            for (uint32_t k=0; k<nTaps; k++) {
+                double x = ((double)k - center) / (double)TP_PHASES;
+                double sinc = (x == 0.0) ? 1.0 : sin(M_PI*x) / (M_PI*x);
+                double w = 2.0*M_PI*(double)k / (double)(nTaps-1);
+                double bh = 0.35875 - 0.48829*cos(w) + 0.14128*cos(2*w) - 0.01168*cos(3*w);
+                h[k] = sinc * bh;
+            }
+            for (uint32_t p=0; p<TP_PHASES; p++) {
+                double sum = 0.0;
+                for (uint32_t j=0; j<TP_TAPS; j++) {
+                    sum += h[j*TP_PHASES+p];
+                }
+                for (uint32_t j=0; j<TP_TAPS; j++) {
+                    coeffs[j][p] = (float)(h[j*TP_PHASES+p] / sum);
+                }
+            }
+        }
+
+        LevelMeter(uint32_t channels=2, double fSample=48000, bool enableTruePeak=false) {
+            designTruePeakFilter(tpCoeffs);
+            truePeakEnabled = enableTruePeak;
+            configure(channels, fSample);
+        }
+
+        void configure(uint32_t channels, double fSample) {
+            srcCH = channels;
+            nCH = channels;
+            if (nCH > METER_MAX_CHANNELS) {
+                nCH = METER_MAX_CHANNELS;
+            }
+            fs = fSample;
+            reset();
+        }
+
+        void reset() {
+            tpPos = 0;
+            memset(tpHistory, 0, sizeof(tpHistory));
+            for (uint32_t ch=0; ch<METER_MAX_CHANNELS; ch++) {
+                msState[ch] = 0.0;
+                holdRemain[ch] = 0.0;
+                heldState[ch] = 0.0;
+                peak[ch].store(0.0, std::memory_order_relaxed);
+                rms[ch].store(0.0, std::memory_order_relaxed);
+                truePeak[ch].store(0.0, std::memory_order_relaxed);
+                heldPeak[ch].store(0.0, std::memory_order_relaxed);
+                maxPeak[ch].store(0.0, std::memory_order_relaxed);
+                maxTruePeak[ch].store(0.0, std::memory_order_relaxed);
+            }
+        }
+
+        void setTruePeak(bool enable) {
+            truePeakEnabled = enable;
+        }
+        bool isTruePeakEnabled() {
+            return truePeakEnabled;
+        }
+
+        void setBallistics(float holdSec, float decayDBPerSec, float rmsWindowSec) {
+            holdTime = holdSec;
+            decayRate = decayDBPerSec;
+            rmsTime = rmsWindowSec;
+        }
+
+        // src: interleaved block of (frames * channels) samples
+        void process(const float* src, uint32_t frames) {
+            if (!src || (nCH == 0) || (frames == 0)) {
+                return;
+            }
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                blockPeak[ch] = 0.0;
+                blockSq[ch] = 0.0;
+                blockTP[ch] = 0.0;
+            }
+            scanPeakSquare(src, frames);
+            if (truePeakEnabled) {
+                scanTruePeak(src, frames);
+            }
+
+            float dt = (float)frames / (float)fs;
+            float rmsCoef = 1.0 - expf(-dt / rmsTime);
+            float decay = powf(10.0, -decayRate*dt/20.0);
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                float ms = blockSq[ch] / (float)frames;
+                msState[ch] += rmsCoef*(ms - msState[ch]);
+                float tp = truePeakEnabled ? blockTP[ch] : blockPeak[ch];
+                if (tp < blockPeak[ch]) {
+                    tp = blockPeak[ch];
+                }
+                // peak hold, then exponential decay
+                if (blockPeak[ch] >= heldState[ch]) {
+                    heldState[ch] = blockPeak[ch];
+                    holdRemain[ch] = holdTime;
+                } else if (holdRemain[ch] > 0) {
+                    holdRemain[ch] -= dt;
+                } else {
+                    heldState[ch] *= decay;
+                }
+                peak[ch].store(blockPeak[ch], std::memory_order_relaxed);
+                rms[ch].store(sqrtf(msState[ch]), std::memory_order_relaxed);
+                truePeak[ch].store(tp, std::memory_order_relaxed);
+                heldPeak[ch].store(heldState[ch], std::memory_order_relaxed);
+                if (maxPeak[ch].load(std::memory_order_relaxed) < blockPeak[ch]) {
+                    maxPeak[ch].store(blockPeak[ch], std::memory_order_relaxed);
+                }
+                if (maxTruePeak[ch].load(std::memory_order_relaxed) < tp) {
+                    maxTruePeak[ch].store(tp, std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // metered channels (at most METER_MAX_CHANNELS)
+        uint32_t getChannels() {
+            return nCH;
+        }
+        // channels of the blocks given to process()
+        uint32_t getSourceChannels() {
+            return srcCH;
+        }
+        float getPeak(uint32_t ch) {
+            return (ch < nCH) ? peak[ch].load(std::memory_order_relaxed) : 0.0f;
+        }
+        float getRms(uint32_t ch) {
+            return (ch < nCH) ? rms[ch].load(std::memory_order_relaxed) : 0.0f;
+        }
+        float getTruePeak(uint32_t ch) {
+            return (ch < nCH) ? truePeak[ch].load(std::memory_order_relaxed) : 0.0f;
+        }
+        float getHeldPeak(uint32_t ch) {
+            return (ch < nCH) ? heldPeak[ch].load(std::memory_order_relaxed) : 0.0f;
+        }
+        float getMaxPeak(uint32_t ch) {
+            return (ch < nCH) ? maxPeak[ch].load(std::memory_order_relaxed) : 0.0f;
+        }
+        float getMaxTruePeak(uint32_t ch) {
+            return (ch < nCH) ? maxTruePeak[ch].load(std::memory_order_relaxed) : 0.0f;
+        }
+
+        static float toDB(float linear) {
+            if (linear <= 0) {
+                return -std::numeric_limits<float>::infinity();
+            }
+            return 20*log10f(linear);
+        }
+};
+
+#endif
@@ -0,0 +1,292 @@
+#ifndef LIBRARY_SCAN_H_INCLUDED
+#define LIBRARY_SCAN_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "LoudnessAnalyzer.hpp"
+#include "Playlist.hpp"
+#include "SilenceTrim.hpp"
+#include "ThreadPool.hpp"
+#include "WaveIndex.hpp"
+
+// Recursive scan of a directory on a background thread: the tree is listed (top level
+// subdirectories in parallel), sorted, and the headers are looked up (WaveIndex) on a
+// thread pool in batches of sorted entries. Each batch is appended to the playlist in
+// order as soon as it is done, so playback starts with the first entry while the rest
+// is checked. The playlist is closed when the scan ends.
+// With setSilenceTrim() the entries are appended with the silence at their ends cut off.
+// With setLoudnessAnalysis() the files without a stored loudness are analysed after that
+// on every core (while the first ones play) and the playlist / index are updated.
+class LibraryScan {
+    private:
+        std::string dirName;
+        WaveIndex index;
+        bool useIndex = true;
+        uint32_t nThreads = 0;
+        bool verbose = false;
+        bool trimSilence = false;
+        bool analyzeLoudness = false;
+        std::thread scanThread;
+        std::atomic<bool> stopRequest{false};
+
+        Playlist& playlist;
+        std::mutex mx;
+        std::condition_variable cvComplete;
+        bool complete = false;
+        std::size_t playableCount = 0;
+        uint32_t playbackFs = 0;
+        uint32_t playbackChannels = 0;
+        std::size_t fileCount = 0;
+        double scanTime = 0;
+        std::size_t trimmedCount = 0;
+        double trimmedTime = 0;
+        std::atomic<uint32_t> analysedCount{0};
+        std::size_t storedLoudnessCount = 0;
+        double analysisTime = 0;
+
+        // a published entry without a stored loudness: its data chunk before the silence trim
+        struct PendingFile {
+            std::size_t entry;
+            int64_t dataOffset;
+            uint64_t dataSize;
+        };
+
+        static bool isWaveName(const std::filesystem::path& path) {
+            std::string ext = path.extension().string();
+            for (std::string::size_type sidx=0; sidx<ext.length(); sidx++) {
+                ext.at(sidx) = std::tolower(ext.at(sidx));
+            }
+            return ext == ".wav";
+        }
+
+        static void listTree(const std::filesystem::path& dir, std::vector<std::filesystem::directory_entry>& files) {
+            std::error_code ec;
+            std::filesystem::recursive_directory_iterator it(dir,
+                std::filesystem::directory_options::skip_permission_denied, ec);
+            for (; !ec && (it != std::filesystem::recursive_directory_iterator()); it.increment(ec)) {
+                if (it->is_regular_file(ec) && isWaveName(it->path())) {
+                    files.push_back(*it);
+                }
+            }
+        }
+
+        void publish(std::vector<std::filesystem::directory_entry>& files, std::vector<WaveHeader>& found,
+                     std::vector<char>& playable, std::vector<PendingFile>& pending,
+                     std::size_t begin, std::size_t end) {
+            for (std::size_t idx=begin; idx<end; idx++) {
+                std::string path(files.at(idx).path().c_str());
+                if (!playable.at(idx)) {
+                    printf("Skipped (not a playable WAVE file): %s\n", path.c_str());
+                    continue;
+                }
+                // the output device is opened with the channel count of the first file
+                if (playbackChannels == 0) {
+                    playbackChannels = found.at(idx).channels;
+                } else if (found.at(idx).channels != playbackChannels) {
+                    printf("Skipped (%u channels, playback: %u channels): %s\n", found.at(idx).channels,
+                           playbackChannels, path.c_str());
+                    continue;
+                }
+                if (playbackFs == 0) {
+                    playbackFs = found.at(idx).fs;
+                } else if (found.at(idx).fs != playbackFs) {
+                    printf("Warning: %s is %u Hz (playback: %u Hz)\n", path.c_str(), found.at(idx).fs, playbackFs);
+                }
+                WaveHeader header = trimSilence ? SilenceTrim::apply(found.at(idx)) : found.at(idx);
+                if (playlist.append(path, &header)) {
+                    uint64_t trimmed = trimSilence ? SilenceTrim::getTrimmedFrames(found.at(idx)) : 0;
+                    // printStats() may read the counters while the scan runs
+                    std::lock_guard<std::mutex> lock(mx);
+                    if (analyzeLoudness && found.at(idx).hasLoudness) {
+                        storedLoudnessCount++;
+                    } else if (analyzeLoudness) {
+                        pending.push_back({playableCount, found.at(idx).dataOffset, found.at(idx).dataSize});
+                    }
+                    playableCount++;
+                    if (trimmed > 0) {
+                        trimmedCount++;
+                        trimmedTime += (double)trimmed / header.fs;
+                    }
+                }
+            }
+        }
+
+        // K-weighted loudness of the files to analyse (the header is rebuilt from the playlist)
+        void analyze(std::vector<PendingFile>& pending) {
+            std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            // CPU bound: one thread per hardware thread
+            ThreadPool pool(0);
+            pool.parallelFor(pending.size(), [&](uint32_t ctr) {
+                if (stopRequest.load(std::memory_order_relaxed)) {
+                    return;
+                }
+                const PendingFile& file = pending.at(ctr);
+                WaveHeader header;
+                if (!playlist.getHeader(file.entry, header)) {
+                    return;
+                }
+                header.dataOffset = file.dataOffset;
+                header.dataSize = file.dataSize;
+                std::string path = playlist.getPath(file.entry);
+                if (LoudnessAnalyzer::analyze(path, header)) {
+                    index.setLoudness(path, header.mtime, header.loudness, header.truePeak);
+                    playlist.setLoudness(file.entry, header.loudness, header.truePeak);
+                    analysedCount++;
+                }
+            });
+            analysisTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+        }
+
+        void run() {
+            std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+            ThreadPool pool(nThreads);
+            if (useIndex) {
+                index.load();
+            }
+            // top level files, then the subdirectories on the pool
+            std::vector<std::filesystem::directory_entry> files;
+            std::vector<std::filesystem::path> subdirs;
+            std::error_code ec;
+            for (std::filesystem::directory_iterator it(dirName, ec);
+                 !ec && (it != std::filesystem::directory_iterator()); it.increment(ec)) {
+                if (it->is_directory(ec)) {
+                    subdirs.push_back(it->path());
+                } else if (it->is_regular_file(ec) && isWaveName(it->path())) {
+                    files.push_back(*it);
+                }
+            }
+            std::vector<std::vector<std::filesystem::directory_entry>> subFiles(subdirs.size());
+            pool.parallelFor(subdirs.size(), [&](uint32_t idx) {
+                listTree(subdirs.at(idx), subFiles.at(idx));
+            });
+            for (std::vector<std::vector<std::filesystem::directory_entry>>::size_type idx=0; idx<subFiles.size(); idx++) {
+                files.insert(files.end(), subFiles.at(idx).begin(), subFiles.at(idx).end());
+            }
+            subFiles.clear();
+            std::sort(files.begin(), files.end());
+
+            // small batches first: the first entry is published quickly
+            std::vector<WaveHeader> found(files.size());
+            std::vector<char> playable(files.size(), 0);
+            std::vector<PendingFile> pending;
+            playlist.reserve(files.size());
+            std::size_t batch = pool.getThreadCount();
+            std::size_t done = 0;
+            while ((done < files.size()) && !stopRequest.load()) {
+                std::size_t end = std::min(done + batch, files.size());
+                pool.parallelFor(end - done, [&](uint32_t idx) {
+                    if (!stopRequest.load(std::memory_order_relaxed)) {
+                        playable.at(done+idx) = index.lookup(files.at(done+idx), found.at(done+idx)) ? 1 : 0;
+                    }
+                });
+                if (stopRequest.load()) {
+                    break;
+                }
+                publish(files, found, playable, pending, done, end);
+                done = end;
+                batch = std::min<std::size_t>(batch*2, 1024);
+            }
+            playlist.close();
+            {
+                std::lock_guard<std::mutex> lock(mx);
+                fileCount = done;
+                scanTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+            }
+            bool listed = (done == files.size());
+            // the headers are in the index and the playlist now
+            files.clear();
+            files.shrink_to_fit();
+            found.clear();
+            found.shrink_to_fit();
+            playable.clear();
+            playable.shrink_to_fit();
+            if (analyzeLoudness && listed) {
+                analyze(pending);
+            }
+            // every file has been looked up (the analysis may have been stopped)
+            if (useIndex && listed && !index.save()) {
+                printf("Warning: Cannot write the index: %s\n", index.getPath().c_str());
+            }
+            std::lock_guard<std::mutex> lock(mx);
+            complete = true;
+            cvComplete.notify_all();
+        }
+
+    public:
+        // threads: for listing and parsing (0: two per hardware thread, as it waits on I/O)
+        LibraryScan(Playlist& dest, const std::string& directory, const std::string& indexFile="",
+                    bool withIndex=true, uint32_t threads=0, bool verboseOutput=false)
+            : index(directory, indexFile), playlist(dest) {
+            dirName = directory;
+            useIndex = withIndex;
+            nThreads = (threads > 0) ? threads : std::max(2u*std::thread::hardware_concurrency(), 2u);
+            verbose = verboseOutput;
+        }
+        ~LibraryScan() {
+            stopRequest.store(true);
+            if (scanThread.joinable()) {
+                scanThread.join();
+            }
+        }
+        LibraryScan(const LibraryScan&) = delete;
+        LibraryScan& operator=(const LibraryScan&) = delete;
+
+        // cut the silence (below thresholdDB) at the ends of the files; call before start()
+        void setSilenceTrim(double thresholdDB) {
+            trimSilence = true;
+            index.setSilenceTrim(true, thresholdDB);
+        }
+
+        // analyse the loudness of the files (after the scan, see analyze()); call before start()
+        void setLoudnessAnalysis(bool enable) {
+            analyzeLoudness = enable;
+        }
+
+        void start() {
+            scanThread = std::thread([this]() { run(); });
+        }
+
+        // wait for the whole tree (and the loudness analysis)
+        void wait() {
+            std::unique_lock<std::mutex> lock(mx);
+            cvComplete.wait(lock, [&]() { return complete; });
+        }
+        bool isComplete() {
+            std::lock_guard<std::mutex> lock(mx);
+            return complete;
+        }
+        // files / sec (after the scan)
+        void printStats() {
+            std::lock_guard<std::mutex> lock(mx);
+            printf("Scan: %lu files (%lu playable) in %.3f s, %.0f files/sec with %u threads\n",
+                   (unsigned long)fileCount, (unsigned long)playableCount, scanTime,
+                   (scanTime > 0) ? fileCount / scanTime : 0.0, nThreads);
+            if (useIndex && verbose) {
+                printf("Index: %u files from %s, %u parsed\n", index.getReusedCount(), index.getPath().c_str(),
+                       index.getParsedCount());
+            }
+            if (analyzeLoudness && complete) {
+                printf("Loudness: %u files analysed in %.3f s, %lu from the index\n", analysedCount.load(),
+                       analysisTime, (unsigned long)storedLoudnessCount);
+            } else if (analyzeLoudness) {
+                printf("Loudness: %u files analysed (not finished)\n", analysedCount.load());
+            }
+            if (trimSilence) {
+                printf("Silence: %lu files trimmed, %.3f s in total (%u files scanned)\n",
+                       (unsigned long)trimmedCount, trimmedTime, index.getTrimScanCount());
+            }
+        }
+};
+
+#endif
@@ -0,0 +1,288 @@
+#ifndef LIMITER_H_INCLUDED
+#define LIMITER_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "DspChain.hpp"
+#include "LevelMeter.hpp"
+
+// Look-ahead brickwall limiter on the output, one gain for all channels.
+// The detector takes the sample peaks and the 4x oversampled true peaks (LevelMeter's
+// interpolator) of every channel, vectorized over the frames of each channel. The largest
+// peak of the last look-ahead window comes from a sliding-window maximum (monotonic deque,
+// O(1) per frame); the gain that keeps it under the ceiling is released by a one-pole
+// filter and averaged over the look-ahead, so it has ramped down by the time the peak
+// leaves the delay line. Gain reduction is published through atomics for the display.
+class Limiter : public DspProcessor {
+    private:
+        // the interpolator is centered between x[n-6] and x[n-5]: peaks found at frame n
+        // belong to those two samples
+        static constexpr uint32_t detectDelay = TP_TAPS/2;
+        double ceilingDB = -1.0;
+        double lookahead = 0.005;
+        double release = 0.1;
+        bool truePeak = true;
+        // tpVec[tap][phase]: coefficient broadcast to the 4 lanes (4 frames)
+        alignas(16) float tpVec[TP_TAPS][TP_PHASES][4] = {};
+        uint32_t nCH = 0;
+        double fs = 48000;
+        uint32_t window = 0;    // look-ahead (frames): length of the gain ramp
+        uint32_t latency = 0;   // delay of the output (frames)
+        float ceiling = 1.0f;
+        float releaseCoef = 0.0f;
+        // per channel: the last latency frames of input followed by the block
+        std::vector<float> historyData;
+        std::vector<float*> history;
+        std::vector<float> peaks;
+        std::vector<float> gains;
+        // sliding maximum: ring of (frame, peak), peaks decreasing from head
+        std::vector<uint64_t> dequeFrame;
+        std::vector<float> dequePeak;
+        uint32_t dequeCapacity = 0;
+        uint32_t dequeHead = 0;
+        uint32_t dequeCount = 0;
+        uint64_t frameCount = 0;
+        // released gain and its moving average over window frames
+        float held = 1.0f;
+        std::vector<float> averageRing;
+        uint32_t averagePos = 0;
+        double averageSum = 0;
+        // stats (read from other threads)
+        std::atomic<float> reduction{1.0f};
+        std::atomic<float> maxReduction{1.0f};
+        std::atomic<uint64_t> limitedFrames{0};
+        std::atomic<uint64_t> processedFrames{0};
+
+        // peaks[frame] = max(peaks[frame], peak of channel x around frame)
+        void detect(const float* x, uint32_t frames) {
+            uint32_t frame = 0;
+#if defined(__SSE2__)
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            for (; frame+4 <= frames; frame += 4) {
+                __m128 s = _mm_max_ps(_mm_and_ps(_mm_loadu_ps(&(x[(int)frame-(int)detectDelay])), absMask),
+                                      _mm_and_ps(_mm_loadu_ps(&(x[(int)frame-(int)detectDelay+1])), absMask));
+                if (truePeak) {
+                    __m128 acc0 = _mm_setzero_ps();
+                    __m128 acc1 = _mm_setzero_ps();
+                    __m128 acc2 = _mm_setzero_ps();
+                    __m128 acc3 = _mm_setzero_ps();
+                    for (uint32_t j=0; j<TP_TAPS; j++) {
+                        __m128 v = _mm_loadu_ps(&(x[(int)frame-(int)j]));
+                        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_load_ps(tpVec[j][0]), v));
+                        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_load_ps(tpVec[j][1]), v));
+                        acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_load_ps(tpVec[j][2]), v));
+                        acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_load_ps(tpVec[j][3]), v));
+                    }
+                    s = _mm_max_ps(s, _mm_max_ps(_mm_and_ps(acc0, absMask), _mm_and_ps(acc1, absMask)));
+                    s = _mm_max_ps(s, _mm_max_ps(_mm_and_ps(acc2, absMask), _mm_and_ps(acc3, absMask)));
+                }
+                _mm_storeu_ps(&(peaks[frame]), _mm_max_ps(_mm_loadu_ps(&(peaks[frame])), s));
+            }
+#endif
+            for (; frame<frames; frame++) {
+                const float* xn = &(x[frame]);
+                float s = std::max(fabsf(xn[-(int)detectDelay]), fabsf(xn[1-(int)detectDelay]));
+                for (uint32_t p=0; truePeak && (p<TP_PHASES); p++) {
+                    float y = 0.0f;
+                    for (uint32_t j=0; j<TP_TAPS; j++) {
+                        y += tpVec[j][p][0]*xn[-(int)j];
+                    }
+                    s = std::max(s, fabsf(y));
+                }
+                peaks[frame] = std::max(peaks[frame], s);
+            }
+        }
+
+        // gain of the frame whose detector output is peak
+        float nextGain(float peak) {
+            // push into the deque (smaller peaks before it can no longer be the maximum)
+            uint32_t tail = dequeHead + dequeCount;
+            tail = (tail >= dequeCapacity) ? tail - dequeCapacity : tail;
+            while (dequeCount > 0) {
+                uint32_t last = (tail == 0) ? dequeCapacity - 1 : tail - 1;
+                if (dequePeak[last] > peak) {
+                    break;
+                }
+                tail = last;
+                dequeCount--;
+            }
+            dequeFrame[tail] = frameCount;
+            dequePeak[tail] = peak;
+            dequeCount++;
+            // hold over window+1 frames (the two samples a peak belongs to)
+            while (dequeFrame[dequeHead] + window + 1 <= frameCount) {
+                dequeHead = (dequeHead + 1 == dequeCapacity) ? 0 : dequeHead + 1;
+                dequeCount--;
+            }
+            frameCount++;
+            float maxPeak = dequePeak[dequeHead];
+            float target = (maxPeak > ceiling) ? ceiling / maxPeak : 1.0f;
+            held = (target < held) ? target : target + (held - target)*releaseCoef;
+            averageSum += held - averageRing[averagePos];
+            averageRing[averagePos] = held;
+            averagePos++;
+            if (averagePos == window) {
+                // no drift of the running sum
+                averagePos = 0;
+                averageSum = 0;
+                for (uint32_t idx=0; idx<window; idx++) {
+                    averageSum += averageRing[idx];
+                }
+            }
+            return std::min((float)(averageSum / window), 1.0f);
+        }
+
+    public:
+        Limiter() {
+            float coeffs[TP_TAPS][TP_PHASES];
+            LevelMeter::designTruePeakFilter(coeffs);
+            for (uint32_t j=0; j<TP_TAPS; j++) {
+                for (uint32_t p=0; p<TP_PHASES; p++) {
+                    for (uint32_t lane=0; lane<4; lane++) {
+                        tpVec[j][p][lane] = coeffs[j][p];
+                    }
+                }
+            }
+        }
+        Limiter(const Limiter&) = delete;
+        Limiter& operator=(const Limiter&) = delete;
+
+        // set before prepare()
+        void setCeiling(double dB) {
+            ceilingDB = dB;
+        }
+        void setLookahead(double sec) {
+            lookahead = sec;
+        }
+        void setRelease(double sec) {
+            release = sec;
+        }
+        void setTruePeak(bool enable) {
+            truePeak = enable;
+        }
+        double getCeiling() {
+            return ceilingDB;
+        }
+        double getLookahead() {
+            return lookahead;
+        }
+        double getRelease() {
+            return release;
+        }
+
+        bool prepare(uint32_t maxBlock, uint32_t channels, double fSample) override {
+            if (channels == 0) {
+                return false;
+            }
+            nCH = channels;
+            fs = fSample;
+            // the delay line holds the interpolator's taps too
+            window = std::max<uint32_t>((uint32_t)lround(lookahead*fs), TP_TAPS);
+            latency = window - 1 + detectDelay;
+            ceiling = (float)pow(10.0, ceilingDB/20.0);
+            releaseCoef = (float)exp(-1.0 / (std::max(release, 1e-4)*fs));
+            historyData.assign((std::size_t)(latency + maxBlock)*nCH, 0.0f);
+            history.resize(nCH);
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                history.at(ch) = &(historyData.at((std::size_t)ch*(latency + maxBlock)));
+            }
+            peaks.assign(maxBlock, 0.0f);
+            gains.assign(maxBlock, 1.0f);
+            dequeCapacity = window + 2;
+            dequeFrame.assign(dequeCapacity, 0);
+            dequePeak.assign(dequeCapacity, 0.0f);
+            dequeHead = 0;
+            dequeCount = 0;
+            frameCount = 0;
+            held = 1.0f;
+            averageRing.assign(window, 1.0f);
+            averagePos = 0;
+            averageSum = window;
+            return true;
+        }
+
+        void process(float** data, uint32_t frames) override {
+            if (frames == 0) {
+                return;
+            }
+            std::fill(peaks.begin(), peaks.begin() + frames, 0.0f);
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                memcpy(&(history[ch][latency]), data[ch], sizeof(float)*frames);
+                detect(&(history[ch][latency]), frames);
+            }
+            float minGain = 1.0f;
+            uint64_t limited = 0;
+            for (uint32_t frame=0; frame<frames; frame++) {
+                float gain = nextGain(peaks[frame]);
+                gains[frame] = gain;
+                if (gain < 1.0f) {
+                    minGain = std::min(minGain, gain);
+                    limited++;
+                }
+            }
+            // output: the input latency frames ago, times the gain (clipped at the ceiling
+            // against rounding)
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                const float* x = history[ch];
+                float* y = data[ch];
+                uint32_t frame = 0;
+#if defined(__SSE2__)
+                const __m128 hi = _mm_set1_ps(ceiling);
+                const __m128 lo = _mm_set1_ps(-ceiling);
+                for (; frame+4 <= frames; frame += 4) {
+                    __m128 v = _mm_mul_ps(_mm_loadu_ps(&(x[frame])), _mm_loadu_ps(&(gains[frame])));
+                    _mm_storeu_ps(&(y[frame]), _mm_max_ps(_mm_min_ps(v, hi), lo));
+                }
+#endif
+                for (; frame<frames; frame++) {
+                    y[frame] = std::max(std::min(x[frame]*gains[frame], ceiling), -ceiling);
+                }
+                memmove(history[ch], &(history[ch][frames]), sizeof(float)*latency);
+            }
+            reduction.store(minGain, std::memory_order_relaxed);
+            if (minGain < maxReduction.load(std::memory_order_relaxed)) {
+                maxReduction.store(minGain, std::memory_order_relaxed);
+            }
+            limitedFrames.fetch_add(limited, std::memory_order_relaxed);
+            processedFrames.fetch_add(frames, std::memory_order_relaxed);
+        }
+        const char* getName() override {
+            return "limiter";
+        }
+        uint32_t getLatency() override {
+            return latency;
+        }
+
+        // gain reduction of the last block / the largest one (dB, <= 0)
+        float getReduction() {
+            return LevelMeter::toDB(reduction.load(std::memory_order_relaxed));
+        }
+        float getMaxReduction() {
+            return LevelMeter::toDB(maxReduction.load(std::memory_order_relaxed));
+        }
+        uint64_t getLimitedFrames() {
+            return limitedFrames.load(std::memory_order_relaxed);
+        }
+
+        void printStats() {
+            uint64_t frames = processedFrames.load(std::memory_order_relaxed);
+            uint64_t limited = limitedFrames.load(std::memory_order_relaxed);
+            printf("Limiter: ceiling %.1f dBTP, look-ahead %.1f msec, release %.0f msec\n",
+                   ceilingDB, lookahead*1000.0, release*1000.0);
+            printf("  max gain reduction %.1f dB, limiting %.2f sec (%.1f %%)\n", getMaxReduction(),
+                   (fs > 0) ? limited / fs : 0.0, (frames > 0) ? 100.0*limited / frames : 0.0);
+        }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef LOUDNESS_ANALYZER_H_INCLUDED
+#define LOUDNESS_ANALYZER_H_INCLUDED
+
+#include "stdint.h"
+#include "math.h"
+
+#include <algorithm>
+#include <limits>
+#include <string>
+#include <vector>
+
+#include "LevelMeter.hpp"
+#include "WaveLoader.hpp"
+
+// Integrated loudness (ITU-R BS.1770 / EBU R128) and true peak of a whole file.
+// Each channel is K-weighted (high shelf + high pass), the mean square is taken over
+// 400 ms blocks overlapping by 75 %, and the blocks are gated at -70 LUFS and at
+// 10 LU below the loudness of the blocks above that. True peak is the 4x oversampled
+// peak of LevelMeter.
+class LoudnessAnalyzer {
+    private:
+        struct Biquad {
+            double b0 = 1, b1 = 0, b2 = 0, a1 = 0, a2 = 0;
+        };
+        Biquad shelf;
+        Biquad highPass;
+        uint32_t nCH = 0;
+        double fs = 48000;
+        // filter state per channel: shelf (2), high pass (2)
+        std::vector<double> state;
+        std::vector<double> weights;
+        // energy of the current 100 ms step per channel, and of the last 4 steps
+        std::vector<double> stepSum;
+        uint32_t stepLength = 0;
+        uint32_t stepPos = 0;
+        double steps[4] = {};
+        uint32_t stepCount = 0;
+        std::vector<double> blocks;
+        LevelMeter peakMeter;
+
+        static constexpr double absoluteGate = -70.0;
+        static constexpr double relativeGate = -10.0;
+
+        void designFilters() {
+            // pre-filter (head), as in BS.1770 annex 1 for any sampling rate
+            double f0 = 1681.974450955533;
+            double gain = 3.999843853973347;
+            double q = 0.7071752369554196;
+            double k = tan(M_PI*f0/fs);
+            double vh = pow(10.0, gain/20.0);
+            double vb = pow(vh, 0.4996667741545416);
+            double a0 = 1.0 + k/q + k*k;
+            shelf.b0 = (vh + vb*k/q + k*k) / a0;
+            shelf.b1 = 2.0*(k*k - vh) / a0;
+            shelf.b2 = (vh - vb*k/q + k*k) / a0;
+            shelf.a1 = 2.0*(k*k - 1.0) / a0;
+            shelf.a2 = (1.0 - k/q + k*k) / a0;
+            // RLB weighting
+            f0 = 38.13547087602444;
+            q = 0.5003270373238773;
+            k = tan(M_PI*f0/fs);
+            a0 = 1.0 + k/q + k*k;
+            highPass.b0 = 1.0;
+            highPass.b1 = -2.0;
+            highPass.b2 = 1.0;
+            highPass.a1 = 2.0*(k*k - 1.0) / a0;
+            highPass.a2 = (1.0 - k/q + k*k) / a0;
+        }
+
+        static double toLoudness(double energy) {
+            return (energy > 0) ? -0.691 + 10.0*log10(energy) : -std::numeric_limits<double>::infinity();
+        }
+
+        void endStep() {
+            double sum = 0;
+            for (uint32_t ch=0; ch<nCH; ch++) {
+                sum += weights.at(ch)*stepSum.at(ch);
+                stepSum.at(ch) = 0;
+            }
+            steps[stepCount % 4] = sum / stepLength;
+            stepCount++;
+            stepPos = 0;
+            if (stepCount >= 4) {
+                blocks.push_back((steps[0] + steps[1] + steps[2] + steps[3]) / 4.0);
+            }
+        }
+
+    public:
+        LoudnessAnalyzer(uint32_t channels, double fSample) : peakMeter(channels, fSample, true) {
+            nCH = channels;
+            fs = fSample;
+            designFilters();
+            state.assign(nCH*4, 0.0);
+            stepSum.assign(nCH, 0.0);
+            stepLength = std::max<uint32_t>((uint32_t)(fs / 10.0), 1);
+            // L, R, C: 1.0, LFE: excluded, surround: 1.41 (5.1 in the WAVE channel order)
+            weights.assign(nCH, 1.0);
+            if (nCH >= 5) {
+                for (uint32_t ch=3; ch<nCH; ch++) {
+                    weights.at(ch) = 1.41;
+                }
+                if (nCH >= 6) {
+                    weights.at(3) = 0.0;
+                }
+            }
+        }
+
+        // src: interleaved block of (frames * channels) samples
+        void process(const float* src, uint32_t frames) {
+            peakMeter.process(src, frames);
+            for (uint32_t frame=0; frame<frames; frame++) {
+                for (uint32_t ch=0; ch<nCH; ch++) {
+                    double* z = &(state[ch*4]);
+                    double x = src[frame*nCH + ch];
+                    // transposed direct form II
+                    double y = shelf.b0*x + z[0];
+                    z[0] = shelf.b1*x - shelf.a1*y + z[1];
+                    z[1] = shelf.b2*x - shelf.a2*y;
+                    double w = highPass.b0*y + z[2];
+                    z[2] = highPass.b1*y - highPass.a1*w + z[3];
+                    z[3] = highPass.b2*y - highPass.a2*w;
+                    stepSum[ch] += w*w;
+                }
+                stepPos++;
+                if (stepPos == stepLength) {
+                    endStep();
+                }
+            }
+        }
+
+        // LUFS (-inf if nothing is above the absolute gate)
+        double getIntegratedLoudness() {
+            double sum = 0;
+            std::size_t count = 0;
+            double absoluteEnergy = pow(10.0, (absoluteGate + 0.691)/10.0);
+            for (std::vector<double>::size_type idx=0; idx<blocks.size(); idx++) {
+                if (blocks.at(idx) > absoluteEnergy) {
+                    sum += blocks.at(idx);
+                    count++;
+                }
+            }
+            if (count == 0) {
+                return -std::numeric_limits<double>::infinity();
+            }
+            double relativeEnergy = pow(10.0, (toLoudness(sum / count) + relativeGate + 0.691)/10.0);
+            double gateEnergy = std::max(absoluteEnergy, relativeEnergy);
+            sum = 0;
+            count = 0;
+            for (std::vector<double>::size_type idx=0; idx<blocks.size(); idx++) {
+                if (blocks.at(idx) > gateEnergy) {
+                    sum += blocks.at(idx);
+                    count++;
+                }
+            }
+            return (count > 0) ? toLoudness(sum / count) : -std::numeric_limits<double>::infinity();
+        }
+        // dBTP
+        double getTruePeak() {
+            float peak = 0;
+            for (uint32_t ch=0; ch<peakMeter.getChannels(); ch++) {
+                peak = std::max(peak, peakMeter.getMaxTruePeak(ch));
+            }
+            return LevelMeter::toDB(peak);
+        }
+
+        // read the whole file (opened with header, no chunk walk) and store the result in
+        // header.loudness / truePeak. false if it cannot be read
+        static bool analyze(const std::string& path, WaveHeader& header) {
+            WaveFile wf;
+            if (!wf.reopen(path, header)) {
+                return false;
+            }
+            constexpr uint32_t blockFrames = 4096;
+            LoudnessAnalyzer analyzer(header.channels, header.fs);
+            std::vector<float> buf(blockFrames*header.channels);
+            uint64_t frames = wf.getFrameCount();
+            for (uint64_t pos=0; pos<frames; ) {
+                uint32_t got = wf.read(buf.data(), (uint32_t)std::min<uint64_t>(blockFrames, frames - pos));
+                if (got == 0) {
+                    return false;
+                }
+                analyzer.process(buf.data(), got);
+                pos += got;
+            }
+            header.hasLoudness = true;
+            header.loudness = (float)analyzer.getIntegratedLoudness();
+            header.truePeak = (float)analyzer.getTruePeak();
+            return true;
+        }
+
+        // gain (dB) to bring a file to targetLUFS with its true peak at most peakCeiling dBTP.
+        // 0 for a file that has not been analysed (or is silent)
+        static double getNormalizeGain(const WaveHeader& header, double targetLUFS, double peakCeiling=-1.0) {
+            if (!header.hasLoudness || !std::isfinite(header.loudness)) {
+                return 0.0;
+            }
+            double gain = targetLUFS - header.loudness;
+            if (std::isfinite(header.truePeak) && (header.truePeak + gain > peakCeiling)) {
+                gain = peakCeiling - header.truePeak;
+            }
+            return gain;
+        }
+};
+
+#endif
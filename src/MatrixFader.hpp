@@ -6,6 +6,7 @@
 #include "stdio.h"
 #include "math.h"
 
+#include <limits>
 #include <vector>
 
 constexpr float inf = std::numeric_limits<float>::infinity();
@@ -18,8 +19,28 @@ class MatrixFader {
         float* inputBuf = nullptr;
         float* outputBuf = nullptr;
         float** cpGains = nullptr;
+        float** cpLinear = nullptr;
         float* inputGains = nullptr;
         float* outputGains = nullptr;
+        // per output: inputs with a non-zero gain and their combined gain
+        std::vector<std::vector<uint32_t>> activeInputs;
+        std::vector<std::vector<float>> activeGains;
+        bool routingDirty = true;
+
+        void updateRouting() {
+            for (uint32_t octr=0; octr<numOutputs; octr++) {
+                activeInputs[octr].clear();
+                activeGains[octr].clear();
+                for (uint32_t ictr=0; ictr<numInputs; ictr++) {
+                    float gain = inputGains[ictr]*cpLinear[ictr][octr]*outputGains[octr];
+                    if (gain != 0.0f) {
+                        activeInputs[octr].push_back(ictr);
+                        activeGains[octr].push_back(gain);
+                    }
+                }
+            }
+            routingDirty = false;
+        }
 
     public:
         MatrixFader(uint32_t inputs, uint32_t outputs) {
@@ -33,19 +54,27 @@ class MatrixFader {
             if (!inputGains) {
                 return;
             }
+            for (uint32_t ctr=0; ctr<numInputs; ctr++) {
+                inputGains[ctr] = 1.0;
+            }
             // allocate outputGains[outputCH]
             outputGains = new float[numOutputs];
             if (!outputGains) {
                 return;
             }
+            for (uint32_t ctr=0; ctr<numOutputs; ctr++) {
+                outputGains[ctr] = 1.0;
+            }
             // allocate cpGains[inputCH][outputCH]
             cpGains = new float*[numInputs];
+            cpLinear = new float*[numInputs];
             if (!cpGains) {
                 return;
             }
             bool allocErr = false;
             for (uint32_t ctr=0; ctr<numInputs; ctr++) {
                 cpGains[ctr] = new float[numOutputs];
+                cpLinear[ctr] = new float[numOutputs];
                 if (!cpGains[ctr]) {
                     allocErr = true;
                     break;
@@ -62,8 +91,15 @@ class MatrixFader {
             for (uint32_t ictr=0; ictr<numInputs; ictr++) {
                 for (uint32_t octr=0; octr<numOutputs; octr++) {
                     cpGains[ictr][octr] = -inf;
+                    cpLinear[ictr][octr] = 0.0f;
                 }
             }
+            activeInputs.resize(numOutputs);
+            activeGains.resize(numOutputs);
+            for (uint32_t octr=0; octr<numOutputs; octr++) {
+                activeInputs[octr].reserve(numInputs);
+                activeGains[octr].reserve(numInputs);
+            }
         }
         ~MatrixFader() {
             if (inputGains) {
@@ -84,26 +120,53 @@ class MatrixFader {
                 }
                 delete[] cpGains;
             }
+            if (cpLinear) {
+                for (uint32_t ictr=0; ictr<numInputs; ictr++) {
+                    delete[] cpLinear[ictr];
+                }
+                delete[] cpLinear;
+            }
         }
 
+        // gainDB: -inf disconnects the cross point
         void setCrossPointGain(uint32_t idxIn, uint32_t idxOut, float gainDB) {
-            if (cpGains) {
-                cpGains[idxIn][idxOut] = gainDB;
+            if (!cpGains || (idxIn >= numInputs) || (idxOut >= numOutputs)) {
+                return;
+            }
+            cpGains[idxIn][idxOut] = gainDB;
+            cpLinear[idxIn][idxOut] = (gainDB == -inf) ? 0.0f : powf(10, gainDB/20.0);
+            routingDirty = true;
+        }
+
+        float getCrossPointGain(uint32_t idxIn, uint32_t idxOut) {
+            if (!cpGains || (idxIn >= numInputs) || (idxOut >= numOutputs)) {
+                return -inf;
             }
+            return cpGains[idxIn][idxOut];
         }
 
+        // gainDB: -inf mutes the input (it is skipped by mix())
         void setInputGain(uint32_t idxIn, float gainDB) {
-            if (idxIn > numInputs) {
+            if (idxIn >= numInputs) {
                 return;
             }
-            inputGains[idxIn] = powf(10, gainDB/20.0);
+            inputGains[idxIn] = (gainDB == -inf) ? 0.0f : powf(10, gainDB/20.0);
+            routingDirty = true;
         }
 
         void setOutputGain(uint32_t idxOut, float gainDB) {
-            if (idxOut > numInputs) {
+            if (idxOut >= numOutputs) {
                 return;
             }
-            outputGains[idxOut] = powf(10, gainDB/20.0);
+            outputGains[idxOut] = (gainDB == -inf) ? 0.0f : powf(10, gainDB/20.0);
+            routingDirty = true;
+        }
+
+        uint32_t getInputCount() {
+            return numInputs;
+        }
+        uint32_t getOutputCount() {
+            return numOutputs;
         }
 
         void mix(float** inputDataArr, uint32_t inputDataLength,
@@ -117,18 +180,24 @@ class MatrixFader {
             if (!outputDataArr) {
                 return;
             }
+            if (routingDirty) {
+                updateRouting();
+            }
+            uint32_t length = (inputDataLength < outputDataLength) ? inputDataLength : outputDataLength;
             for (uint32_t octr=0; octr < numOutputs; octr++) {
+                float* out = outputDataArr[octr];
                 for (uint32_t odctr=0; odctr<outputDataLength; odctr++) {
-                    outputDataArr[octr][odctr] = 0;
-                    // add input data to output
-                    for (uint32_t ictr=0; ictr<numInputs; ictr++) {
-                        if (odctr >= inputDataLength) {
-                            break;
-                        }
-                        outputDataArr[octr][odctr] += (inputDataArr[ictr][odctr]*inputGains[ictr]);
+                    out[odctr] = 0;
+                }
+                // out += in * (input gain * cross point gain * output gain)
+                std::vector<uint32_t>& inputs = activeInputs[octr];
+                std::vector<float>& gains = activeGains[octr];
+                for (std::vector<uint32_t>::size_type actr=0; actr<inputs.size(); actr++) {
+                    const float* in = inputDataArr[inputs[actr]];
+                    float gain = gains[actr];
+                    for (uint32_t odctr=0; odctr<length; odctr++) {
+                        out[odctr] += in[odctr]*gain;
                     }
-                    // apply output volume
-                    outputDataArr[octr][odctr] *= outputGains[octr];
                 }
             }
         }
@@ -0,0 +1,242 @@
+#ifndef MIX_ENGINE_H_INCLUDED
+#define MIX_ENGINE_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+
+#include <atomic>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "GaplessLooper.hpp"
+#include "MatrixFader.hpp"
+#include "ThreadPool.hpp"
+
+// Plays many WAVE files at once.
+// Each stream has its own decoder and owns two MatrixFader inputs (L/R, a mono file
+// feeds both outputs from one input). render() decodes every playing stream on the
+// ThreadPool, mixes them through the MatrixFader and interleaves the result.
+// start/stop/loop/gain requests may come from any thread and are applied at the
+// next block.
+class MixEngine {
+    private:
+        struct Stream {
+            GaplessLooper* wf = nullptr;
+            uint32_t channels = 0;
+            uint32_t firstInput = 0;
+            bool playing = false;
+            float appliedGain = 0.0f;
+            std::atomic<bool> playRequest{false};
+            std::atomic<bool> rewindRequest{false};
+            std::atomic<bool> loop{true};
+            std::atomic<float> gainDB{0.0f};
+            std::atomic<bool> finished{false};
+            std::vector<float> decodeBuf;
+        };
+        uint32_t maxStreams = 0;
+        uint32_t nOutputs = 2;
+        uint32_t blockLength = 1024;
+        uint32_t fs = 48000;
+        std::vector<Stream*> streams;
+        MatrixFader mixer;
+        ThreadPool pool;
+        std::vector<std::vector<float>> inBufs;
+        std::vector<float*> inPtrs;
+        std::vector<std::vector<float>> outBufs;
+        std::vector<float*> outPtrs;
+        std::vector<uint32_t> active;
+
+        static constexpr uint32_t inputsPerStream = 2;
+
+        // decode frames of stream into its MatrixFader inputs
+        void decode(Stream* st, uint32_t frames) {
+            float* buf = st->decodeBuf.data();
+            // loops the whole file, or the loop region of its smpl chunk
+            uint32_t done = st->wf->prepareFrame(buf, frames, !st->loop.load(std::memory_order_relaxed));
+            if (done < frames) {
+                memset(&(buf[done*st->channels]), 0, sizeof(float)*(frames-done)*st->channels);
+                st->finished.store(true, std::memory_order_relaxed);
+            }
+            for (uint32_t ch=0; ch<st->channels && ch<inputsPerStream; ch++) {
+                float* in = inBufs[st->firstInput + ch].data();
+                for (uint32_t frame=0; frame<frames; frame++) {
+                    in[frame] = buf[frame*st->channels + ch];
+                }
+            }
+        }
+
+        void applyRequests() {
+            for (std::vector<Stream*>::size_type idx=0; idx<streams.size(); idx++) {
+                Stream* st = streams.at(idx);
+                if (st->finished.load(std::memory_order_relaxed)) {
+                    st->finished.store(false, std::memory_order_relaxed);
+                    st->playRequest.store(false, std::memory_order_relaxed);
+                    st->rewindRequest.store(true, std::memory_order_relaxed);
+                }
+                bool request = st->playRequest.load(std::memory_order_acquire);
+                if (st->rewindRequest.exchange(false, std::memory_order_acq_rel)) {
+                    st->wf->rewind();
+                }
+                float gain = st->gainDB.load(std::memory_order_relaxed);
+                if ((request != st->playing) || (request && (gain != st->appliedGain))) {
+                    for (uint32_t in=0; in<inputsPerStream; in++) {
+                        mixer.setInputGain(st->firstInput + in, request ? gain : -inf);
+                    }
+                    st->playing = request;
+                    st->appliedGain = gain;
+                }
+            }
+        }
+
+    public:
+        // threads: decode threads including the caller (0: one per hardware thread)
+        MixEngine(uint32_t streamCapacity, uint32_t outputs=2, uint32_t fSample=48000,
+                  uint32_t block=1024, uint32_t threads=0) :
+            mixer(streamCapacity*inputsPerStream, outputs), pool(threads) {
+            maxStreams = streamCapacity;
+            nOutputs = outputs;
+            fs = fSample;
+            blockLength = block;
+            inBufs.assign(maxStreams*inputsPerStream, std::vector<float>(blockLength, 0.0f));
+            for (uint32_t in=0; in<maxStreams*inputsPerStream; in++) {
+                inPtrs.push_back(inBufs[in].data());
+                mixer.setInputGain(in, -inf);
+            }
+            outBufs.assign(nOutputs, std::vector<float>(blockLength, 0.0f));
+            for (uint32_t out=0; out<nOutputs; out++) {
+                outPtrs.push_back(outBufs[out].data());
+            }
+            active.reserve(maxStreams);
+        }
+        ~MixEngine() {
+            for (std::vector<Stream*>::size_type idx=0; idx<streams.size(); idx++) {
+                delete streams.at(idx)->wf;
+                delete streams.at(idx);
+            }
+        }
+
+        // returns the stream id, or -1 (file error, sampling rate mismatch or no free stream)
+        int addStream(const std::string& fileName, bool loop=true, float gainDB=0.0f) {
+            if (streams.size() >= maxStreams) {
+                printf("Mix: stream limit (%u) reached\n", maxStreams);
+                return -1;
+            }
+            GaplessLooper* wf = new GaplessLooper(fileName);
+            if (!wf->isFileOpened() || !wf->isWaveFile()) {
+                printf("Mix: cannot open %s\n", fileName.c_str());
+                delete wf;
+                return -1;
+            }
+            if (wf->getSampleFreq() != fs) {
+                printf("Mix: %s is %u Hz (engine: %u Hz)\n", fileName.c_str(), wf->getSampleFreq(), fs);
+                delete wf;
+                return -1;
+            }
+            Stream* st = new Stream();
+            st->wf = wf;
+            st->channels = wf->getChannels();
+            st->firstInput = streams.size()*inputsPerStream;
+            st->loop.store(loop);
+            st->gainDB.store(gainDB);
+            st->decodeBuf.resize(blockLength*st->channels);
+            if (st->channels == 1) {
+                mixer.setCrossPointGain(st->firstInput, 0, 0.0);
+                if (nOutputs > 1) {
+                    mixer.setCrossPointGain(st->firstInput, 1, 0.0);
+                }
+            } else {
+                for (uint32_t ch=0; ch<inputsPerStream; ch++) {
+                    mixer.setCrossPointGain(st->firstInput + ch, ch % nOutputs, 0.0);
+                }
+            }
+            streams.push_back(st);
+            return streams.size()-1;
+        }
+
+        void start(int id, bool fromTop=false) {
+            if ((id < 0) || ((uint32_t)id >= streams.size())) {
+                return;
+            }
+            if (fromTop) {
+                streams.at(id)->rewindRequest.store(true, std::memory_order_relaxed);
+            }
+            streams.at(id)->playRequest.store(true, std::memory_order_release);
+        }
+        void stop(int id) {
+            if ((id < 0) || ((uint32_t)id >= streams.size())) {
+                return;
+            }
+            streams.at(id)->playRequest.store(false, std::memory_order_release);
+        }
+        void setLoop(int id, bool loop) {
+            if ((id < 0) || ((uint32_t)id >= streams.size())) {
+                return;
+            }
+            streams.at(id)->loop.store(loop, std::memory_order_relaxed);
+        }
+        void setGain(int id, float gainDB) {
+            if ((id < 0) || ((uint32_t)id >= streams.size())) {
+                return;
+            }
+            streams.at(id)->gainDB.store(gainDB, std::memory_order_relaxed);
+        }
+        bool isPlaying(int id) {
+            if ((id < 0) || ((uint32_t)id >= streams.size())) {
+                return false;
+            }
+            return streams.at(id)->playRequest.load(std::memory_order_acquire);
+        }
+        uint32_t getPlayingCount() {
+            uint32_t count = 0;
+            for (std::vector<Stream*>::size_type idx=0; idx<streams.size(); idx++) {
+                if (streams.at(idx)->playRequest.load(std::memory_order_relaxed)) {
+                    count++;
+                }
+            }
+            return count;
+        }
+        uint32_t getStreamCount() {
+            return streams.size();
+        }
+        uint32_t getThreadCount() {
+            return pool.getThreadCount();
+        }
+        // fn() once on each decode worker (the caller renders too: give them its scheduling)
+        void runOnWorkers(const std::function<void()>& fn) {
+            pool.runOnWorkers(fn);
+        }
+        uint32_t getOutputCount() {
+            return nOutputs;
+        }
+        MatrixFader& getMixer() {
+            return mixer;
+        }
+
+        // render frames (<= block length) of interleaved output
+        uint32_t render(float* dest, uint32_t frames) {
+            if (frames > blockLength) {
+                frames = blockLength;
+            }
+            applyRequests();
+            active.clear();
+            for (std::vector<Stream*>::size_type idx=0; idx<streams.size(); idx++) {
+                if (streams.at(idx)->playing) {
+                    active.push_back(idx);
+                }
+            }
+            pool.parallelFor(active.size(), [&](uint32_t idx) {
+                decode(streams.at(active[idx]), frames);
+            });
+            mixer.mix(inPtrs.data(), frames, outPtrs.data(), frames);
+            for (uint32_t frame=0; frame<frames; frame++) {
+                for (uint32_t out=0; out<nOutputs; out++) {
+                    dest[frame*nOutputs + out] = outBufs[out][frame];
+                }
+            }
+            return frames;
+        }
+};
+
+#endif
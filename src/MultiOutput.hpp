@@ -0,0 +1,492 @@
+#ifndef MULTI_OUTPUT_H_INCLUDED
+#define MULTI_OUTPUT_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+#include "time.h"
+
+#include <deque>
+#include <functional>
+#include <vector>
+
+#include "AudioManipulator.hpp"
+
+// Synchronized playback of one decoded stream on several output devices.
+// Every device has its own ring buffer fed through an AdaptiveResampler. The first
+// device is the master and is fed 1:1; the others are resampled so that the source
+// frame at their DAC follows the master's. Device clocks are estimated from the
+// callback DAC timestamps (DriftEstimator) and the remaining offset is removed by
+// a PI loop on the resampling ratio.
+
+// Destination of one synchronized output
+class OutputSink {
+    public:
+        virtual ~OutputSink() {}
+        virtual uint32_t getFreeFrames() = 0;
+        virtual uint32_t writeFrames(const float* src, uint32_t frames) = 0;
+        // see AudioManipulator::getClockSnapshot
+        virtual bool getClockSnapshot(double& dacTime, uint64_t& cbFrames, uint64_t& rbFrames) = 0;
+};
+
+class DeviceOutputSink : public OutputSink {
+    private:
+        AudioManipulator* aOut = nullptr;
+
+    public:
+        DeviceOutputSink(AudioManipulator* device) {
+            aOut = device;
+        }
+        uint32_t getFreeFrames() {
+            // AudioManipulator::write needs one frame of headroom
+            unsigned long freeFrames = aOut->getRbFreeChunkLength();
+            return (freeFrames > 1) ? freeFrames-1 : 0;
+        }
+        uint32_t writeFrames(const float* src, uint32_t frames) {
+            aOut->write((AudioData*)src, frames);
+            return frames;
+        }
+        bool getClockSnapshot(double& dacTime, uint64_t& cbFrames, uint64_t& rbFrames) {
+            return aOut->getClockSnapshot(dacTime, cbFrames, rbFrames);
+        }
+};
+
+// Exponentially weighted least squares fit of (DAC time, frame count):
+// the slope is the actual sample rate of the device in stream-clock seconds.
+class DriftEstimator {
+    private:
+        double timeConstant = 30.0;
+        double originT = 0;
+        double originN = 0;
+        double lastT = 0;
+        double sw = 0;
+        double sx = 0;
+        double sy = 0;
+        double sxx = 0;
+        double sxy = 0;
+        uint32_t points = 0;
+
+    public:
+        DriftEstimator(double tau=30.0) {
+            timeConstant = tau;
+        }
+        void reset() {
+            sw = sx = sy = sxx = sxy = 0;
+            points = 0;
+        }
+        void addPoint(double t, double frames) {
+            if (points == 0) {
+                originT = t;
+                originN = frames;
+                lastT = t;
+            }
+            if (t <= lastT && points > 0) {
+                return;
+            }
+            double decay = exp(-(t-lastT) / timeConstant);
+            sw *= decay;
+            sx *= decay;
+            sy *= decay;
+            sxx *= decay;
+            sxy *= decay;
+            // keep the origin at the newest point for numerical stability
+            double dx = t - originT;
+            double dy = frames - originN;
+            sxx += -2*dx*sx + dx*dx*sw;
+            sxy += -dx*sy - dy*sx + dx*dy*sw;
+            sx -= dx*sw;
+            sy -= dy*sw;
+            originT = t;
+            originN = frames;
+            sw += 1;
+            lastT = t;
+            points++;
+        }
+        bool isValid() {
+            return (points > 50) && (getSpan() > 2.0);
+        }
+        // time spanned by the weighted points [sec]
+        double getSpan() {
+            if (sw <= 0) {
+                return 0;
+            }
+            return sqrt(fmax(sxx/sw - (sx/sw)*(sx/sw), 0.0))*2*sqrt(3.0);
+        }
+        // time of the newest point on the fitted line (timestamp jitter removed)
+        double getFittedTime() {
+            double rate = getRate();
+            if ((rate <= 0) || (sw <= 0)) {
+                return lastT;
+            }
+            return lastT - ((sy - rate*sx)/sw)/rate;
+        }
+        double getRate() {
+            double den = sw*sxx - sx*sx;
+            if (den <= 0) {
+                return 0;
+            }
+            return (sw*sxy - sx*sy) / den;
+        }
+};
+
+// Interleaved 4-point (Catmull-Rom) interpolator with a variable step
+class AdaptiveResampler {
+    private:
+        uint32_t nCH = 2;
+        std::vector<float> fifo;
+        uint64_t baseFrame = 0;   // source frame of fifo[0]
+        uint64_t posInt = 0;      // source position of the next output frame
+        double posFrac = 0;
+        uint32_t historyFrames = 0;
+
+    public:
+        AdaptiveResampler(uint32_t channels=2, uint32_t history=48000) {
+            nCH = channels;
+            historyFrames = history;
+        }
+
+        void push(const float* src, uint32_t frames) {
+            // drop what is older than the history kept for backward jumps
+            uint64_t keepFrom = (posInt > historyFrames + 1) ? posInt - historyFrames - 1 : 0;
+            if (keepFrom > baseFrame + historyFrames) {
+                fifo.erase(fifo.begin(), fifo.begin() + (keepFrom - baseFrame)*nCH);
+                baseFrame = keepFrom;
+            }
+            fifo.insert(fifo.end(), src, src + (size_t)frames*nCH);
+        }
+
+        uint64_t getEndFrame() {
+            return baseFrame + fifo.size()/nCH;
+        }
+        double getPosition() {
+            return (double)posInt + posFrac;
+        }
+        // source frames not consumed yet
+        double getBacklog() {
+            return (double)getEndFrame() - getPosition();
+        }
+
+        // step: source frames per output frame, returns the frames written to dest
+        uint32_t process(float* dest, uint32_t maxFrames, double step) {
+            uint32_t produced = 0;
+            uint64_t endFrame = getEndFrame();
+            while ((produced < maxFrames) && (posInt + 2 < endFrame)) {
+                const float* p1 = &(fifo[(posInt - baseFrame)*nCH]);
+                float* out = &(dest[(size_t)produced*nCH]);
+                if (posFrac == 0) {
+                    memcpy(out, p1, sizeof(float)*nCH);
+                } else {
+                    const float* p0 = (posInt > baseFrame) ? p1 - nCH : p1;
+                    const float* p2 = p1 + nCH;
+                    const float* p3 = p1 + 2*nCH;
+                    float f = (float)posFrac;
+                    for (uint32_t ch=0; ch<nCH; ch++) {
+                        float c1 = 0.5f*(p2[ch] - p0[ch]);
+                        float c2 = p0[ch] - 2.5f*p1[ch] + 2.0f*p2[ch] - 0.5f*p3[ch];
+                        float c3 = 0.5f*(p3[ch] - p0[ch]) + 1.5f*(p1[ch] - p2[ch]);
+                        out[ch] = ((c3*f + c2)*f + c1)*f + p1[ch];
+                    }
+                }
+                posFrac += step;
+                double advance = floor(posFrac);
+                posInt += (uint64_t)advance;
+                posFrac -= advance;
+                produced++;
+            }
+            return produced;
+        }
+
+        // move the read position by frames (negative: repeat from the history)
+        double jump(double frames) {
+            double target = getPosition() + frames;
+            if (target < (double)baseFrame + 1) {
+                target = (double)baseFrame + 1;
+            }
+            if (target > (double)getEndFrame()) {
+                target = (double)getEndFrame();
+            }
+            double moved = target - getPosition();
+            posInt = (uint64_t)floor(target);
+            posFrac = target - floor(target);
+            return moved;
+        }
+};
+
+class SyncedOutput {
+    private:
+        struct MapEntry {
+            uint64_t outFrame;  // first output frame written with this entry
+            double srcPos;      // its source position
+            double step;
+        };
+        OutputSink* sink = nullptr;
+        AdaptiveResampler resampler;
+        DriftEstimator drift;
+        std::deque<MapEntry> history;
+        std::vector<float> outBuf;
+        uint32_t nCH = 2;
+        double nominalRate = 48000;
+        uint64_t writtenFrames = 0;
+        double lastDacTime = 0;
+        double lastCbFrames = 0;
+        uint64_t lastRbFrames = 0;
+        bool hasClock = false;
+
+    public:
+        bool master = false;
+        double step = 1.0;
+        double integral = 0;
+        double lastError = 0;
+        uint64_t holdUntilFrame = 0;
+        unsigned long coarseJumps = 0;
+
+        SyncedOutput(OutputSink* destination, uint32_t channels, double fs, bool isMaster) :
+            resampler(channels, (uint32_t)fs) {
+            sink = destination;
+            nCH = channels;
+            nominalRate = fs;
+            master = isMaster;
+            outBuf.resize(4096*nCH);
+        }
+
+        void feed(const float* src, uint32_t frames) {
+            resampler.push(src, frames);
+        }
+        double getBacklog() {
+            return resampler.getBacklog();
+        }
+        double jump(double frames) {
+            return resampler.jump(frames);
+        }
+        uint64_t getWrittenFrames() {
+            return writtenFrames;
+        }
+
+        // move as much as fits into the device ring, returns frames written
+        uint32_t pump() {
+            uint32_t total = 0;
+            while (true) {
+                uint32_t freeFrames = sink->getFreeFrames();
+                uint32_t count = std::min<uint32_t>(freeFrames, outBuf.size()/nCH);
+                if (count == 0) {
+                    break;
+                }
+                double srcPos = resampler.getPosition();
+                uint32_t produced = resampler.process(outBuf.data(), count, master ? 1.0 : step);
+                if (produced == 0) {
+                    break;
+                }
+                history.push_back({writtenFrames, srcPos, master ? 1.0 : step});
+                sink->writeFrames(outBuf.data(), produced);
+                writtenFrames += produced;
+                total += produced;
+            }
+            return total;
+        }
+
+        // read the device clock, returns false when there is no new callback
+        bool updateClock() {
+            double dacTime = 0;
+            uint64_t cbFrames = 0;
+            uint64_t rbFrames = 0;
+            if (!sink->getClockSnapshot(dacTime, cbFrames, rbFrames)) {
+                return false;
+            }
+            if (hasClock && (cbFrames == (uint64_t)lastCbFrames)) {
+                return false;
+            }
+            drift.addPoint(dacTime, (double)cbFrames);
+            lastDacTime = dacTime;
+            lastCbFrames = (double)cbFrames;
+            lastRbFrames = rbFrames;
+            hasClock = true;
+            while ((history.size() > 1) && (history.at(1).outFrame <= rbFrames)) {
+                history.pop_front();
+            }
+            return true;
+        }
+        bool hasClockInfo() {
+            return hasClock;
+        }
+        uint64_t getConsumedFrames() {
+            return lastRbFrames;
+        }
+
+        // device rate in frames per stream-clock second
+        double getRate() {
+            if (drift.isValid()) {
+                return drift.getRate();
+            }
+            return nominalRate;
+        }
+        bool isRateValid() {
+            return drift.isValid();
+        }
+
+        // source position at the DAC at time t (from the latest callback)
+        double getSourceAt(double t) {
+            if (history.empty()) {
+                return 0;
+            }
+            const MapEntry* entry = &(history.front());
+            for (std::deque<MapEntry>::size_type ctr=0; ctr<history.size(); ctr++) {
+                if (history.at(ctr).outFrame > lastRbFrames) {
+                    break;
+                }
+                entry = &(history.at(ctr));
+            }
+            double src = entry->srcPos + (double)(lastRbFrames - entry->outFrame)*entry->step;
+            return src + (t - getLastDacTime())*getRate()*entry->step;
+        }
+        double getLastDacTime() {
+            if (drift.isValid()) {
+                return drift.getFittedTime();
+            }
+            return lastDacTime;
+        }
+};
+
+class MultiOutputSync {
+    private:
+        std::vector<SyncedOutput*> outputs;
+        uint32_t nCH = 2;
+        double fs = 48000;
+        double lastUpdate = -1;
+        double kp = 0;
+        double ki = 0;
+
+    public:
+        double maxCorrection = 1000e-6;   // resampling ratio range around the drift estimate
+        double coarseThreshold = 2048;    // [frames] larger offsets are jumped over
+        std::function<void()> waitHook;   // called while all rings are full
+
+        // settle: time constant of the phase loop [sec]
+        MultiOutputSync(uint32_t channels, double fSample, double settle=4.0) {
+            nCH = channels;
+            fs = fSample;
+            kp = 1.0 / (fs*settle);
+            ki = kp / (5.0*settle);
+            waitHook = []() {
+                timespec sleepTime = {};
+                sleepTime.tv_nsec = 1000000; //1msec
+                nanosleep(&sleepTime, nullptr);
+            };
+        }
+        ~MultiOutputSync() {
+            for (std::vector<SyncedOutput*>::size_type ctr=0; ctr<outputs.size(); ctr++) {
+                delete outputs.at(ctr);
+            }
+        }
+
+        // the first output added is the master
+        void addOutput(OutputSink* sink) {
+            outputs.push_back(new SyncedOutput(sink, nCH, fs, outputs.empty()));
+        }
+        std::vector<SyncedOutput*>::size_type getOutputCount() {
+            return outputs.size();
+        }
+        SyncedOutput* getOutput(std::vector<SyncedOutput*>::size_type index) {
+            return outputs.at(index);
+        }
+
+        // offset of each output from the master [source frames], slope of the device clock
+        void update() {
+            if (outputs.empty()) {
+                return;
+            }
+            bool fresh = false;
+            for (std::vector<SyncedOutput*>::size_type ctr=0; ctr<outputs.size(); ctr++) {
+                fresh |= outputs.at(ctr)->updateClock();
+            }
+            SyncedOutput* master = outputs.at(0);
+            if (!fresh || !master->hasClockInfo()) {
+                return;
+            }
+            double now = master->getLastDacTime();
+            double dt = (lastUpdate < 0) ? 0 : now - lastUpdate;
+            if (dt < 0) {
+                dt = 0;
+            }
+            lastUpdate = now;
+            double masterSrc = master->getSourceAt(now);
+            for (std::vector<SyncedOutput*>::size_type ctr=1; ctr<outputs.size(); ctr++) {
+                SyncedOutput* out = outputs.at(ctr);
+                if (!out->hasClockInfo()) {
+                    continue;
+                }
+                double ratio = 1.0;
+                if (out->isRateValid() && master->isRateValid()) {
+                    ratio = master->getRate() / out->getRate();
+                }
+                if (out->getConsumedFrames() < out->holdUntilFrame) {
+                    // a jump has not reached the DAC yet
+                    out->step = ratio;
+                    continue;
+                }
+                double error = out->getSourceAt(now) - masterSrc;
+                out->lastError = error;
+                if (fabs(error) > coarseThreshold) {
+                    out->jump(-error);
+                    out->holdUntilFrame = out->getWrittenFrames();
+                    out->integral = 0;
+                    out->coarseJumps++;
+                    out->step = ratio;
+                    continue;
+                }
+                out->integral += error*dt;
+                double integralLimit = maxCorrection / ki;
+                if (out->integral > integralLimit) {
+                    out->integral = integralLimit;
+                } else if (out->integral < -integralLimit) {
+                    out->integral = -integralLimit;
+                }
+                double correction = kp*error + ki*out->integral;
+                if (correction > maxCorrection) {
+                    correction = maxCorrection;
+                } else if (correction < -maxCorrection) {
+                    correction = -maxCorrection;
+                }
+                out->step = ratio*(1.0 - correction);
+            }
+        }
+
+        // queue one decoded chunk for every output and wait until all of them took it.
+        // returns false on timeout [msec]
+        bool write(const float* src, uint32_t frames, long timeout=1000) {
+            for (std::vector<SyncedOutput*>::size_type ctr=0; ctr<outputs.size(); ctr++) {
+                outputs.at(ctr)->feed(src, frames);
+            }
+            long waited = 0;
+            while (true) {
+                update();
+                bool pending = false;
+                for (std::vector<SyncedOutput*>::size_type ctr=0; ctr<outputs.size(); ctr++) {
+                    outputs.at(ctr)->pump();
+                    // the interpolator keeps a few frames of look-ahead
+                    if (outputs.at(ctr)->getBacklog() > 4) {
+                        pending = true;
+                    }
+                }
+                if (!pending) {
+                    return true;
+                }
+                if (waited >= timeout) {
+                    return false;
+                }
+                waitHook();
+                waited++;
+            }
+        }
+
+        // largest |offset| from the master of the last update [source frames]
+        double getMaxError() {
+            double maxError = 0;
+            for (std::vector<SyncedOutput*>::size_type ctr=1; ctr<outputs.size(); ctr++) {
+                maxError = fmax(maxError, fabs(outputs.at(ctr)->lastError));
+            }
+            return maxError;
+        }
+};
+
+#endif
@@ -0,0 +1,180 @@
+#ifndef PCM_CACHE_H_INCLUDED
+#define PCM_CACHE_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+
+#include <filesystem>
+#include <list>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "GaplessLooper.hpp"
+
+// LRU cache of decoded files (DecodedPcm) keyed by path and mtime, within a byte budget.
+// open() serves a cached file from memory without touching the disk; on a miss the file
+// is opened and, if it fits the budget, decoded into a new buffer while it plays.
+// retire() (before deleting / releasing the looper) adds a completely decoded buffer.
+// The budget covers the buffers still being decoded too: cached entries are evicted
+// before a new buffer is allocated, and a file that does not fit is read from the disk.
+// Not thread safe: with a playlist every call comes from the FilePrefetcher thread.
+class PcmCache {
+    private:
+        struct Entry {
+            std::shared_ptr<DecodedPcm> pcm;
+            std::list<std::string>::iterator lruPos;
+        };
+        uint64_t budget = 0;
+        uint64_t residentBytes = 0;
+        std::unordered_map<std::string, Entry> entries;
+        // most recently used first
+        std::list<std::string> lru;
+        // buffers handed to readers by reopen() and not retired yet
+        std::vector<std::shared_ptr<DecodedPcm>> recording;
+        uint64_t recordingBytes = 0;
+        unsigned long hits = 0;
+        unsigned long lookups = 0;
+
+        static int64_t getMtime(const std::string& path) {
+            std::error_code ec;
+            std::filesystem::file_time_type mtime = std::filesystem::last_write_time(path, ec);
+            if (ec) {
+                return 0;
+            }
+            return (int64_t)mtime.time_since_epoch().count();
+        }
+
+        void erase(std::unordered_map<std::string, Entry>::iterator it) {
+            residentBytes -= it->second.pcm->getBytes();
+            lru.erase(it->second.lruPos);
+            entries.erase(it);
+        }
+
+        // pcm is no longer decoded into (retired, or dropped by its reader)
+        void endRecording(std::vector<std::shared_ptr<DecodedPcm>>::size_type idx) {
+            recordingBytes -= recording.at(idx)->getBytes();
+            recording.at(idx) = recording.back();
+            recording.pop_back();
+        }
+        // readers reopened without retire() have let go of their buffers
+        void dropDetached() {
+            for (std::vector<std::shared_ptr<DecodedPcm>>::size_type idx=0; idx<recording.size(); ) {
+                if (recording.at(idx).use_count() == 1) {
+                    endRecording(idx);
+                } else {
+                    idx++;
+                }
+            }
+        }
+
+    public:
+        // budgetBytes 0 disables the cache (files are always read from the disk)
+        PcmCache(uint64_t budgetBytes=0) {
+            budget = budgetBytes;
+        }
+
+        bool isEnabled() {
+            return budget > 0;
+        }
+
+        // header: from WaveIndex (the file is opened without the chunk walk)
+        GaplessLooper* open(const std::string& path, bool verbose=false, const WaveHeader* header=nullptr) {
+            GaplessLooper* wf = new GaplessLooper();
+            reopen(wf, path, verbose, header);
+            return wf;
+        }
+        // open path with an existing reader (see ReaderPool); a cached file is attached
+        // to its buffer. false if the file cannot be opened
+        bool reopen(GaplessLooper* wf, const std::string& path, bool verbose=false, const WaveHeader* header=nullptr) {
+            if (!isEnabled()) {
+                return header ? wf->reopen(path, *header) : wf->reopen(path, verbose);
+            }
+            lookups++;
+            int64_t mtime = header ? header->mtime : getMtime(path);
+            std::unordered_map<std::string, Entry>::iterator it = entries.find(path);
+            if (it != entries.end()) {
+                if (it->second.pcm->mtime == mtime) {
+                    hits++;
+                    lru.splice(lru.begin(), lru, it->second.lruPos);
+                    return wf->reopen(it->second.pcm);
+                }
+                // the file has changed
+                erase(it);
+            }
+            bool opened = header ? wf->reopen(path, *header) : wf->reopen(path, verbose);
+            if (!opened || !wf->isFileOpened() || !wf->isWaveFile()) {
+                return false;
+            }
+            uint64_t bytes = wf->getFrameCount()*wf->getChannels()*sizeof(float);
+            dropDetached();
+            if ((bytes == 0) || (recordingBytes + bytes > budget)) {
+                return true;
+            }
+            // evict least recently used entries before the allocation
+            while (!lru.empty() && (residentBytes + recordingBytes + bytes > budget)) {
+                erase(entries.find(lru.back()));
+            }
+            std::shared_ptr<DecodedPcm> pcm = std::make_shared<DecodedPcm>(wf->getFrameCount(), wf->getChannels());
+            pcm->path = path;
+            pcm->mtime = mtime;
+            if (wf->recordTo(pcm)) {
+                recording.push_back(pcm);
+                recordingBytes += bytes;
+            }
+            return true;
+        }
+
+        // call before deleting (or releasing) a looper from open() / reopen()
+        void retire(GaplessLooper* wf) {
+            if (!isEnabled() || !wf) {
+                return;
+            }
+            std::shared_ptr<DecodedPcm> pcm = wf->getDecodedPcm();
+            for (std::vector<std::shared_ptr<DecodedPcm>>::size_type idx=0; idx<recording.size(); idx++) {
+                if (recording.at(idx) == pcm) {
+                    endRecording(idx);
+                    break;
+                }
+            }
+            if (!pcm || !pcm->isComplete() || pcm->path.empty() || (entries.count(pcm->path) > 0)) {
+                return;
+            }
+            // evict least recently used entries
+            while (!lru.empty() && (residentBytes + pcm->getBytes() > budget)) {
+                erase(entries.find(lru.back()));
+            }
+            lru.push_front(pcm->path);
+            entries[pcm->path] = {pcm, lru.begin()};
+            residentBytes += pcm->getBytes();
+        }
+
+        unsigned long getHits() {
+            return hits;
+        }
+        unsigned long getLookups() {
+            return lookups;
+        }
+        double getHitRate() {
+            return (lookups > 0) ? (double)hits / (double)lookups : 0.0;
+        }
+        uint64_t getResidentBytes() {
+            return residentBytes;
+        }
+        // buffers being decoded (counted against the budget)
+        uint64_t getRecordingBytes() {
+            return recordingBytes;
+        }
+        uint32_t getFileCount() {
+            return entries.size();
+        }
+
+        void printStats() {
+            printf("PCM cache: %lu / %lu hits (%.1f%%), %.1f MB resident in %u files (budget %.1f MB)\n",
+                   hits, lookups, getHitRate()*100.0, residentBytes/1048576.0, getFileCount(),
+                   budget/1048576.0);
+        }
+};
+
+#endif
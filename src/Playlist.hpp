@@ -0,0 +1,401 @@
+#ifndef PLAYLIST_H_INCLUDED
+#define PLAYLIST_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <filesystem>
+#include <mutex>
+#include <random>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "WaveLoader.hpp"
+
+// List of files to play with the play order (sequential / shuffle) and repeat mode.
+// Paths are stored as an interned directory and a file name in a character arena
+// (8 bytes per entry plus the name). Entries from LibraryScan keep a 48-byte record of
+// the header (what reopen() and the normalization need, not the whole WaveHeader), so
+// a million entries take tens of megabytes.
+// Entries may be appended from another thread (LibraryScan) until close(); an
+// Iterator waits for the next entry while the list is still open.
+class Playlist {
+    public:
+        enum Order {
+            ORDER_SEQUENTIAL = 0,
+            ORDER_SHUFFLE
+        };
+        enum Repeat {
+            REPEAT_OFF = 0,
+            REPEAT_ONE,
+            REPEAT_ALL
+        };
+
+        // position in the play order; next() looks ahead without moving this one
+        class Iterator {
+            friend class Playlist;
+            private:
+                Playlist* list = nullptr;
+                std::size_t step = 0;
+                Iterator(Playlist* playlist, std::size_t position) : list(playlist), step(position) {}
+
+            public:
+                Iterator() {}
+                bool isValid() const {
+                    return list != nullptr;
+                }
+                // steps from the top of the play order (repeat one stays on the same step)
+                std::size_t getStep() const {
+                    return step;
+                }
+                // entry index of the list
+                std::size_t getIndex() const {
+                    return list ? list->getEntryIndex(step) : 0;
+                }
+                std::string getPath() const {
+                    return list ? list->getPath(getIndex()) : std::string();
+                }
+                // into dest (no allocation while its capacity is enough)
+                void getPath(std::string& dest) const {
+                    if (list) {
+                        list->getPath(getIndex(), dest);
+                    } else {
+                        dest.clear();
+                    }
+                }
+                bool getHeader(WaveHeader& header) const {
+                    return list ? list->getHeader(getIndex(), header) : false;
+                }
+                // the entry played after this one (invalid at the end)
+                Iterator next() const {
+                    std::size_t nextStep = 0;
+                    if (!list || !list->nextStep(step, nextStep)) {
+                        return Iterator();
+                    }
+                    return Iterator(list, nextStep);
+                }
+        };
+
+    private:
+        struct Entry {
+            uint32_t dir;
+            uint32_t name;
+        };
+        // the part of a WaveHeader used for playback (format fields are 16 bits in the fmt chunk)
+        struct EntryHeader {
+            int64_t dataOffset = 0;
+            uint64_t dataSize = 0;
+            int64_t mtime = 0;
+            uint32_t fs = 0;
+            float loudness = 0;
+            float truePeak = 0;
+            uint16_t channels = 0;
+            uint16_t bytesPerFrame = 0;
+            uint16_t format = 0;
+            uint8_t flags = 0;
+        };
+        enum EntryFlag {
+            ENTRY_VALID = 1,
+            ENTRY_RF64 = 2,
+            ENTRY_LOOP = 4,
+            ENTRY_LOUDNESS = 8
+        };
+        struct LoopPoints {
+            uint64_t start;
+            uint64_t end;
+        };
+        std::mutex mx;
+        std::condition_variable cvAppended;
+        bool closed = false;
+        // directory part of the paths including the separator
+        std::vector<std::string> dirs;
+        std::unordered_map<std::string, uint32_t> dirIds;
+        // file names, '\0' terminated
+        std::vector<char> names;
+        std::vector<Entry> entries;
+        // headers of the entries (empty when they are not known, e.g. from a list file)
+        std::vector<EntryHeader> headers;
+        // loop points of the few entries with a smpl loop
+        std::unordered_map<uint32_t, LoopPoints> loops;
+        Order order = ORDER_SEQUENTIAL;
+        Repeat repeat = REPEAT_ALL;
+        // shuffled play order, made when the list is closed
+        std::vector<uint32_t> shuffled;
+        uint32_t seed = 0;
+
+        static std::string::size_type findSeparator(const std::string& path) {
+#if defined(_WIN32)
+            return path.find_last_of("/\\");
+#else
+            return path.rfind('/');
+#endif
+        }
+
+        static bool packHeader(const WaveHeader& header, EntryHeader& packed) {
+            if ((header.channels > UINT16_MAX) || (header.bytesPerFrame > UINT16_MAX)) {
+                return false;
+            }
+            packed.dataOffset = header.dataOffset;
+            packed.dataSize = header.dataSize;
+            packed.mtime = header.mtime;
+            packed.fs = header.fs;
+            packed.loudness = header.loudness;
+            packed.truePeak = header.truePeak;
+            packed.channels = header.channels;
+            packed.bytesPerFrame = header.bytesPerFrame;
+            packed.format = header.format;
+            packed.flags = (header.valid ? ENTRY_VALID : 0) | (header.isRF64 ? ENTRY_RF64 : 0)
+                           | (header.hasLoop ? ENTRY_LOOP : 0) | (header.hasLoudness ? ENTRY_LOUDNESS : 0);
+            return true;
+        }
+
+        void makeShuffle() {
+            shuffled.resize(entries.size());
+            for (std::vector<uint32_t>::size_type idx=0; idx<shuffled.size(); idx++) {
+                shuffled.at(idx) = idx;
+            }
+            std::mt19937 rng(seed);
+            std::shuffle(shuffled.begin(), shuffled.end(), rng);
+        }
+
+        std::size_t getEntryIndex(std::size_t step) {
+            std::lock_guard<std::mutex> lock(mx);
+            if ((order == ORDER_SHUFFLE) && (step < shuffled.size())) {
+                return shuffled.at(step);
+            }
+            return step;
+        }
+
+        bool nextStep(std::size_t step, std::size_t& next) {
+            std::unique_lock<std::mutex> lock(mx);
+            if (repeat == REPEAT_ONE) {
+                next = step;
+                return true;
+            }
+            cvAppended.wait(lock, [&]() { return closed || (step+1 < entries.size()); });
+            if (step+1 < entries.size()) {
+                next = step+1;
+                return true;
+            }
+            if ((repeat == REPEAT_ALL) && !entries.empty()) {
+                next = 0;
+                return true;
+            }
+            return false;
+        }
+
+    public:
+        Playlist() {
+            seed = std::random_device()();
+        }
+        Playlist(const Playlist&) = delete;
+        Playlist& operator=(const Playlist&) = delete;
+
+        void setOrder(Order playOrder) {
+            std::lock_guard<std::mutex> lock(mx);
+            order = playOrder;
+            if (closed && (order == ORDER_SHUFFLE)) {
+                makeShuffle();
+            }
+        }
+        void setRepeat(Repeat repeatMode) {
+            std::lock_guard<std::mutex> lock(mx);
+            repeat = repeatMode;
+        }
+        Repeat getRepeat() {
+            std::lock_guard<std::mutex> lock(mx);
+            return repeat;
+        }
+
+        // header: format / data location found by LibraryScan (opened without the chunk walk)
+        bool append(const std::string& path, const WaveHeader* header=nullptr) {
+            std::lock_guard<std::mutex> lock(mx);
+            if (closed || (names.size() + path.length() + 1 > UINT32_MAX) || (entries.size() >= UINT32_MAX)) {
+                return false;
+            }
+            std::string::size_type sep = findSeparator(path);
+            std::string dir = (sep == std::string::npos) ? std::string() : path.substr(0, sep+1);
+            std::unordered_map<std::string, uint32_t>::iterator it = dirIds.find(dir);
+            Entry entry;
+            if (it == dirIds.end()) {
+                entry.dir = dirs.size();
+                dirIds[dir] = entry.dir;
+                dirs.push_back(dir);
+            } else {
+                entry.dir = it->second;
+            }
+            entry.name = names.size();
+            names.insert(names.end(), path.begin() + dir.length(), path.end());
+            names.push_back('\0');
+            EntryHeader packed;
+            if (header && packHeader(*header, packed)) {
+                headers.resize(entries.size());
+                headers.push_back(packed);
+                if (header->hasLoop) {
+                    loops[entries.size()] = {header->loopStart, header->loopEnd};
+                }
+            }
+            entries.push_back(entry);
+            cvAppended.notify_all();
+            return true;
+        }
+
+        // room for count entries (LibraryScan: the number of files found), so that the
+        // vectors do not grow by doubling while the list is filled
+        void reserve(std::size_t count) {
+            std::lock_guard<std::mutex> lock(mx);
+            entries.reserve(count);
+            headers.reserve(count);
+        }
+
+        // no more entries (the shuffled order is made here)
+        void close() {
+            std::lock_guard<std::mutex> lock(mx);
+            closed = true;
+            names.shrink_to_fit();
+            entries.shrink_to_fit();
+            headers.shrink_to_fit();
+            if (order == ORDER_SHUFFLE) {
+                makeShuffle();
+            }
+            cvAppended.notify_all();
+        }
+
+        // M3U / M3U8 / plain list of files: one path per line, '#' lines are comments.
+        // relative paths are relative to the list file. URLs other than file:// are skipped.
+        bool loadList(const std::string& listPath) {
+            FILE* pFile = fopen(listPath.c_str(), "r");
+            if (!pFile) {
+                return false;
+            }
+            std::filesystem::path baseDir = std::filesystem::path(listPath).parent_path();
+            std::string line;
+            char buf[4096] = {};
+            bool firstLine = true;
+            while (fgets(buf, sizeof(buf), pFile)) {
+                line.append(buf);
+                if (!line.empty() && (line.back() != '\n') && !feof(pFile)) {
+                    // longer than buf
+                    continue;
+                }
+                while (!line.empty() && ((line.back() == '\n') || (line.back() == '\r'))) {
+                    line.pop_back();
+                }
+                if (firstLine && (line.compare(0, 3, "\xEF\xBB\xBF") == 0)) {
+                    line.erase(0, 3);
+                }
+                firstLine = false;
+                if (line.compare(0, 7, "file://") == 0) {
+                    line.erase(0, 7);
+                }
+                if (!line.empty() && (line.at(0) != '#') && (line.find("://") == std::string::npos)) {
+#if !defined(_WIN32)
+                    std::replace(line.begin(), line.end(), '\\', '/');
+#endif
+                    std::filesystem::path path(line);
+                    if (path.is_relative()) {
+                        path = baseDir / path;
+                    }
+                    append(path.string());
+                }
+                line.clear();
+            }
+            fclose(pFile);
+            return true;
+        }
+
+        std::size_t size() {
+            std::lock_guard<std::mutex> lock(mx);
+            return entries.size();
+        }
+        bool isClosed() {
+            std::lock_guard<std::mutex> lock(mx);
+            return closed;
+        }
+
+        std::string getPath(std::size_t idx) {
+            std::string path;
+            getPath(idx, path);
+            return path;
+        }
+        void getPath(std::size_t idx, std::string& dest) {
+            std::lock_guard<std::mutex> lock(mx);
+            dest.clear();
+            if (idx >= entries.size()) {
+                return;
+            }
+            const Entry& entry = entries.at(idx);
+            dest.append(dirs.at(entry.dir));
+            dest.append(&(names.at(entry.name)));
+        }
+        bool getHeader(std::size_t idx, WaveHeader& header) {
+            std::lock_guard<std::mutex> lock(mx);
+            if (idx >= headers.size()) {
+                return false;
+            }
+            const EntryHeader& packed = headers.at(idx);
+            header = WaveHeader();
+            header.valid = (packed.flags & ENTRY_VALID) != 0;
+            header.format = (WF_Format)packed.format;
+            header.channels = packed.channels;
+            header.fs = packed.fs;
+            header.bytesPerFrame = packed.bytesPerFrame;
+            header.dataOffset = packed.dataOffset;
+            header.dataSize = packed.dataSize;
+            header.isRF64 = (packed.flags & ENTRY_RF64) != 0;
+            header.mtime = packed.mtime;
+            if (packed.flags & ENTRY_LOOP) {
+                std::unordered_map<uint32_t, LoopPoints>::iterator it = loops.find(idx);
+                if (it != loops.end()) {
+                    header.hasLoop = true;
+                    header.loopStart = it->second.start;
+                    header.loopEnd = it->second.end;
+                }
+            }
+            header.hasLoudness = (packed.flags & ENTRY_LOUDNESS) != 0;
+            header.loudness = packed.loudness;
+            header.truePeak = packed.truePeak;
+            return header.valid;
+        }
+
+        // loudness found while the list is played (LibraryScan)
+        void setLoudness(std::size_t idx, float loudness, float truePeak) {
+            std::lock_guard<std::mutex> lock(mx);
+            if (idx >= headers.size()) {
+                return;
+            }
+            headers.at(idx).flags |= ENTRY_LOUDNESS;
+            headers.at(idx).loudness = loudness;
+            headers.at(idx).truePeak = truePeak;
+        }
+
+        // first entry of the play order; waits for one entry (shuffle: for close()).
+        // invalid if the list is empty
+        Iterator begin() {
+            std::unique_lock<std::mutex> lock(mx);
+            cvAppended.wait(lock, [&]() {
+                return closed || ((order == ORDER_SEQUENTIAL) && !entries.empty());
+            });
+            if (entries.empty()) {
+                return Iterator();
+            }
+            return Iterator(this, 0);
+        }
+
+        // bytes held for the paths, the header records and the play order
+        std::size_t getMemoryUsage() {
+            std::lock_guard<std::mutex> lock(mx);
+            std::size_t bytes = names.capacity() + entries.capacity()*sizeof(Entry)
+                                + headers.capacity()*sizeof(EntryHeader) + shuffled.capacity()*sizeof(uint32_t)
+                                + loops.size()*(sizeof(uint32_t) + sizeof(LoopPoints) + 2*sizeof(void*));
+            for (std::vector<std::string>::size_type idx=0; idx<dirs.size(); idx++) {
+                bytes += sizeof(std::string) + dirs.at(idx).capacity() + sizeof(uint32_t) + sizeof(std::string);
+            }
+            return bytes;
+        }
+};
+
+#endif
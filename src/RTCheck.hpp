@@ -0,0 +1,220 @@
+#ifndef RT_CHECK_H_INCLUDED
+#define RT_CHECK_H_INCLUDED
+
+// Real-time safety checker.
+// Code that must not allocate, free, lock a mutex or make a blocking syscall
+// (the stream callbacks) opens an RtScope. When built with WAVEPLAYER_RT_CHECK
+// (cmake -DWAVEPLAYER_RT_CHECK=ON, glibc only), malloc/free/pthread_mutex_lock
+// and a few syscalls are interposed, and every call made inside an RtScope is
+// counted and recorded with its backtrace. RtCheck::report() prints them.
+// Without WAVEPLAYER_RT_CHECK, RtScope and RtCheck compile to nothing.
+
+#include "stdint.h"
+#include "stdio.h"
+
+#if defined(WAVEPLAYER_RT_CHECK) && defined(__GLIBC__)
+#define WAVEPLAYER_RT_CHECK_ACTIVE 1
+#endif
+
+#if defined(WAVEPLAYER_RT_CHECK_ACTIVE)
+
+#include "stdlib.h"
+#include "dlfcn.h"
+#include "execinfo.h"
+#include "pthread.h"
+#include "time.h"
+#include "unistd.h"
+
+#include <atomic>
+
+typedef enum {
+    RT_VIOLATION_MALLOC = 0,
+    RT_VIOLATION_FREE,
+    RT_VIOLATION_MUTEX_LOCK,
+    RT_VIOLATION_SYSCALL,
+    RT_VIOLATION_KINDS
+} RT_ViolationKind;
+
+namespace rtcheck {
+    constexpr int maxFrames = 24;
+    constexpr uint32_t maxRecords = 64;
+    struct Record {
+        int kind;
+        const char* function;
+        int frameCount;
+        void* frames[maxFrames];
+    };
+
+    inline thread_local int rtDepth = 0;
+    inline thread_local bool inHandler = false;
+    inline std::atomic<uint64_t> counts[RT_VIOLATION_KINDS];
+    inline std::atomic<uint32_t> recordCount{0};
+    inline Record records[maxRecords];
+
+    inline void violation(int kind, const char* function) {
+        if ((rtDepth <= 0) || inHandler) {
+            return;
+        }
+        inHandler = true;
+        counts[kind].fetch_add(1, std::memory_order_relaxed);
+        uint32_t idx = recordCount.fetch_add(1, std::memory_order_relaxed);
+        if (idx < maxRecords) {
+            records[idx].kind = kind;
+            records[idx].function = function;
+            records[idx].frameCount = backtrace(records[idx].frames, maxFrames);
+        }
+        inHandler = false;
+    }
+
+    template <typename FTYPE> FTYPE resolve(FTYPE& cache, const char* name) {
+        if (!cache) {
+            cache = reinterpret_cast<FTYPE>(dlsym(RTLD_NEXT, name));
+        }
+        return cache;
+    }
+}
+
+extern "C" {
+    void* __libc_malloc(size_t size);
+    void* __libc_calloc(size_t count, size_t size);
+    void* __libc_realloc(void* ptr, size_t size);
+    void* __libc_memalign(size_t alignment, size_t size);
+    void __libc_free(void* ptr);
+
+    void* malloc(size_t size) noexcept {
+        rtcheck::violation(RT_VIOLATION_MALLOC, "malloc");
+        return __libc_malloc(size);
+    }
+    void* calloc(size_t count, size_t size) noexcept {
+        rtcheck::violation(RT_VIOLATION_MALLOC, "calloc");
+        return __libc_calloc(count, size);
+    }
+    void* realloc(void* ptr, size_t size) noexcept {
+        rtcheck::violation(RT_VIOLATION_MALLOC, "realloc");
+        return __libc_realloc(ptr, size);
+    }
+    void* aligned_alloc(size_t alignment, size_t size) noexcept {
+        rtcheck::violation(RT_VIOLATION_MALLOC, "aligned_alloc");
+        return __libc_memalign(alignment, size);
+    }
+    int posix_memalign(void** ptr, size_t alignment, size_t size) noexcept {
+        rtcheck::violation(RT_VIOLATION_MALLOC, "posix_memalign");
+        *ptr = __libc_memalign(alignment, size);
+        return (*ptr || (size == 0)) ? 0 : 12; // ENOMEM
+    }
+    void free(void* ptr) noexcept {
+        if (ptr) {
+            rtcheck::violation(RT_VIOLATION_FREE, "free");
+        }
+        __libc_free(ptr);
+    }
+
+    int pthread_mutex_lock(pthread_mutex_t* mutex) noexcept {
+        static int (*realLock)(pthread_mutex_t*) = nullptr;
+        rtcheck::violation(RT_VIOLATION_MUTEX_LOCK, "pthread_mutex_lock");
+        return rtcheck::resolve(realLock, "pthread_mutex_lock")(mutex);
+    }
+    int nanosleep(const struct timespec* req, struct timespec* rem) {
+        static int (*realSleep)(const struct timespec*, struct timespec*) = nullptr;
+        rtcheck::violation(RT_VIOLATION_SYSCALL, "nanosleep");
+        return rtcheck::resolve(realSleep, "nanosleep")(req, rem);
+    }
+    ssize_t write(int fd, const void* buf, size_t count) {
+        static ssize_t (*realWrite)(int, const void*, size_t) = nullptr;
+        rtcheck::violation(RT_VIOLATION_SYSCALL, "write");
+        return rtcheck::resolve(realWrite, "write")(fd, buf, count);
+    }
+    ssize_t read(int fd, void* buf, size_t count) {
+        static ssize_t (*realRead)(int, void*, size_t) = nullptr;
+        rtcheck::violation(RT_VIOLATION_SYSCALL, "read");
+        return rtcheck::resolve(realRead, "read")(fd, buf, count);
+    }
+}
+
+class RtScope {
+    public:
+        RtScope() {
+            rtcheck::rtDepth++;
+        }
+        ~RtScope() {
+            rtcheck::rtDepth--;
+        }
+};
+
+class RtCheck {
+    public:
+        static constexpr bool enabled = true;
+
+        // call once from a normal thread before streaming: backtrace() and
+        // dlsym() allocate on their first use
+        static void init() {
+            void* frames[2];
+            backtrace(frames, 2);
+            timespec zero = {};
+            nanosleep(&zero, nullptr);
+            pthread_mutex_t mx = PTHREAD_MUTEX_INITIALIZER;
+            pthread_mutex_lock(&mx);
+            pthread_mutex_unlock(&mx);
+        }
+
+        static uint64_t getViolationCount() {
+            uint64_t total = 0;
+            for (int kind=0; kind<RT_VIOLATION_KINDS; kind++) {
+                total += rtcheck::counts[kind].load(std::memory_order_relaxed);
+            }
+            return total;
+        }
+        // allocations and frees (the other kinds are not counted)
+        static uint64_t getAllocationCount() {
+            return rtcheck::counts[RT_VIOLATION_MALLOC].load(std::memory_order_relaxed)
+                   + rtcheck::counts[RT_VIOLATION_FREE].load(std::memory_order_relaxed);
+        }
+
+        // not RT-safe; call from a normal thread
+        static void report(FILE* dest=stderr) {
+            const char* kindNames[RT_VIOLATION_KINDS] = {
+                "allocation", "free", "mutex lock", "syscall"
+            };
+            fprintf(dest, "RT check: %lu violation(s) in RT context\n",
+                    (unsigned long)getViolationCount());
+            for (int kind=0; kind<RT_VIOLATION_KINDS; kind++) {
+                fprintf(dest, "  %-10s: %lu\n", kindNames[kind],
+                        (unsigned long)rtcheck::counts[kind].load(std::memory_order_relaxed));
+            }
+            uint32_t recorded = rtcheck::recordCount.load(std::memory_order_relaxed);
+            if (recorded > rtcheck::maxRecords) {
+                recorded = rtcheck::maxRecords;
+            }
+            for (uint32_t idx=0; idx<recorded; idx++) {
+                fprintf(dest, "--- #%u: %s ---\n", idx, rtcheck::records[idx].function);
+                fflush(dest);
+                backtrace_symbols_fd(rtcheck::records[idx].frames,
+                                     rtcheck::records[idx].frameCount, fileno(dest));
+            }
+            fflush(dest);
+        }
+};
+
+#else
+
+class RtScope {
+    public:
+        RtScope() {}
+};
+
+class RtCheck {
+    public:
+        static constexpr bool enabled = false;
+        static void init() {}
+        static uint64_t getViolationCount() {
+            return 0;
+        }
+        static uint64_t getAllocationCount() {
+            return 0;
+        }
+        static void report(FILE* dest=stderr) {}
+};
+
+#endif
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef READER_POOL_H_INCLUDED
+#define READER_POOL_H_INCLUDED
+
+#include "stdint.h"
+
+#include <vector>
+
+#include "GaplessLooper.hpp"
+
+// Pre-constructed readers for file changes on the decode thread: acquire() hands out an
+// idle reader to reopen() and release() takes it back, so a file change does not
+// construct / destroy a reader (nor its FILE object and buffers).
+// The pool grows (allocates) only if more readers are in use than it was made with.
+// Use from one thread.
+class ReaderPool {
+    private:
+        std::vector<GaplessLooper*> readers;
+        std::vector<GaplessLooper*> idle;
+        uint32_t growCount = 0;
+
+    public:
+        ReaderPool(uint32_t count=4) {
+            readers.reserve(count);
+            idle.reserve(count);
+            for (uint32_t ctr=0; ctr<count; ctr++) {
+                readers.push_back(new GaplessLooper());
+                idle.push_back(readers.back());
+            }
+        }
+        ~ReaderPool() {
+            for (std::vector<GaplessLooper*>::size_type idx=0; idx<readers.size(); idx++) {
+                delete readers.at(idx);
+            }
+        }
+        ReaderPool(const ReaderPool&) = delete;
+        ReaderPool& operator=(const ReaderPool&) = delete;
+
+        GaplessLooper* acquire() {
+            if (idle.empty()) {
+                growCount++;
+                readers.push_back(new GaplessLooper());
+                idle.reserve(readers.size());
+                return readers.back();
+            }
+            GaplessLooper* reader = idle.back();
+            idle.pop_back();
+            return reader;
+        }
+        // the reader keeps its FILE object for the next reopen, but not the decoded buffer
+        void release(GaplessLooper* reader) {
+            if (!reader) {
+                return;
+            }
+            reader->detachDecodedPcm();
+            idle.push_back(reader);
+        }
+
+        uint32_t getSize() {
+            return readers.size();
+        }
+        uint32_t getGrowCount() {
+            return growCount;
+        }
+};
+
+#endif
@@ -0,0 +1,179 @@
+#ifndef REALTIME_THREAD_H_INCLUDED
+#define REALTIME_THREAD_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+#include "errno.h"
+
+#include <string>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include "pthread.h"
+#include "sched.h"
+#include "sys/mman.h"
+#include "sys/resource.h"
+#endif
+
+// Scheduling / memory settings for the decode (read-ahead) thread.
+// Every request falls back to the default behaviour when the permission is missing;
+// what was actually granted is written to stdout.
+struct RealtimeConfig {
+    int priority = 0;        // 0: keep SCHED_OTHER
+    bool roundRobin = false; // SCHED_RR instead of SCHED_FIFO
+    std::vector<int> cpus;   // empty: no affinity change
+    bool lockMemory = false;
+};
+
+class RealtimeSetup {
+    public:
+        // "0,2,4-7" -> {0, 2, 4, 5, 6, 7}
+        static bool parseCpuList(const std::string& list, std::vector<int>& cpus) {
+            cpus.clear();
+            std::string::size_type pos = 0;
+            while (pos < list.length()) {
+                std::string::size_type next = list.find(',', pos);
+                if (next == std::string::npos) {
+                    next = list.length();
+                }
+                std::string item = list.substr(pos, next-pos);
+                pos = next+1;
+                if (item.empty()) {
+                    continue;
+                }
+                try {
+                    std::string::size_type dash = item.find('-');
+                    if (dash == std::string::npos) {
+                        cpus.push_back(std::stoi(item));
+                        continue;
+                    }
+                    int first = std::stoi(item.substr(0, dash));
+                    int last = std::stoi(item.substr(dash+1));
+                    for (int cpu=first; cpu<=last; cpu++) {
+                        cpus.push_back(cpu);
+                    }
+                } catch (const std::exception& e) {
+                    return false;
+                }
+            }
+            return !cpus.empty();
+        }
+
+        // apply to the calling thread (report: print what was granted, failures are always printed)
+        static bool applyScheduling(int priority, bool roundRobin, bool report=true) {
+            if (priority <= 0) {
+                return true;
+            }
+#if defined(__linux__) || defined(__APPLE__)
+            int policy = roundRobin ? SCHED_RR : SCHED_FIFO;
+            const char* policyName = roundRobin ? "SCHED_RR" : "SCHED_FIFO";
+            int pMin = sched_get_priority_min(policy);
+            int pMax = sched_get_priority_max(policy);
+            if (priority < pMin) {
+                priority = pMin;
+            }
+            if (priority > pMax) {
+                priority = pMax;
+            }
+            sched_param param = {};
+            param.sched_priority = priority;
+            int ret = pthread_setschedparam(pthread_self(), policy, &param);
+            if (ret != 0) {
+                printf("RT: %s priority %d not granted (%s), staying at normal priority\n",
+                       policyName, priority, strerror(ret));
+                return false;
+            }
+            if (!report) {
+                return true;
+            }
+            int grantedPolicy = 0;
+            pthread_getschedparam(pthread_self(), &grantedPolicy, &param);
+            printf("RT: %s priority %d granted\n",
+                   (grantedPolicy == SCHED_RR) ? "SCHED_RR" :
+                   (grantedPolicy == SCHED_FIFO) ? "SCHED_FIFO" : "SCHED_OTHER",
+                   param.sched_priority);
+            return true;
+#else
+            printf("RT: real-time scheduling is not supported on this platform\n");
+            return false;
+#endif
+        }
+
+        // apply to the calling thread (report: as applyScheduling())
+        static bool applyAffinity(const std::vector<int>& cpus, bool report=true) {
+            if (cpus.empty()) {
+                return true;
+            }
+#if defined(__linux__)
+            cpu_set_t cpuSet;
+            CPU_ZERO(&cpuSet);
+            for (std::vector<int>::size_type ctr=0; ctr<cpus.size(); ctr++) {
+                if ((cpus.at(ctr) >= 0) && (cpus.at(ctr) < CPU_SETSIZE)) {
+                    CPU_SET(cpus.at(ctr), &cpuSet);
+                }
+            }
+            int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+            if (ret != 0) {
+                printf("RT: CPU affinity not granted (%s)\n", strerror(ret));
+                return false;
+            }
+            if (!report) {
+                return true;
+            }
+            pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuSet);
+            printf("RT: pinned to CPU");
+            for (int cpu=0; cpu<CPU_SETSIZE; cpu++) {
+                if (CPU_ISSET(cpu, &cpuSet)) {
+                    printf(" %d", cpu);
+                }
+            }
+            printf("\n");
+            return true;
+#else
+            printf("RT: CPU affinity is not supported on this platform\n");
+            return false;
+#endif
+        }
+
+        static bool lockMemory() {
+#if defined(__linux__) || defined(__APPLE__)
+            if (mlockall(MCL_CURRENT | MCL_FUTURE) != 0) {
+                int err = errno;
+                rlimit lim = {};
+                getrlimit(RLIMIT_MEMLOCK, &lim);
+                if (lim.rlim_cur == RLIM_INFINITY) {
+                    printf("RT: mlockall not granted (%s)\n", strerror(err));
+                } else {
+                    printf("RT: mlockall not granted (%s, RLIMIT_MEMLOCK: %llu bytes)\n",
+                           strerror(err), (unsigned long long)lim.rlim_cur);
+                }
+                return false;
+            }
+            printf("RT: memory locked (mlockall)\n");
+            return true;
+#else
+            printf("RT: memory locking is not supported on this platform\n");
+            return false;
+#endif
+        }
+
+        // touch every page so that no page fault happens on the audio path
+        static void prefault(void* mem, size_t bytes) {
+            if (!mem) {
+                return;
+            }
+            memset(mem, 0, bytes);
+        }
+
+        static void prefaultStack() {
+            constexpr size_t stackBytes = 256*1024;
+            char stackMem[stackBytes];
+            volatile char* touch = stackMem;
+            for (size_t ctr=0; ctr<stackBytes; ctr += 4096) {
+                touch[ctr] = 0;
+            }
+        }
+};
+
+#endif
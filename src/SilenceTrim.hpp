@@ -0,0 +1,161 @@
+#ifndef SILENCE_TRIM_H_INCLUDED
+#define SILENCE_TRIM_H_INCLUDED
+
+#include "stdint.h"
+#include "math.h"
+
+#include <algorithm>
+#include <vector>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "WaveLoader.hpp"
+
+// Silence at the head / tail of the data chunk: the frames before the first and after
+// the last sample above a threshold. The trim points are kept in the WaveHeader (and
+// the WaveIndex), and apply() narrows the data chunk to the rest, so a trimmed file is
+// opened and played without reading the silent parts.
+class SilenceTrim {
+    private:
+        static constexpr uint32_t blockFrames = 4096;
+
+    public:
+        static float toLinear(double thresholdDB) {
+            return (float)pow(10.0, thresholdDB/20.0);
+        }
+
+        // index of the first sample above threshold (count if there is none)
+        static uint32_t findFirst(const float* src, uint32_t count, float threshold) {
+            uint32_t idx = 0;
+#if defined(__SSE2__)
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128 thr = _mm_set1_ps(threshold);
+            for (; idx+16 <= count; idx += 16) {
+                __m128 a = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[idx])), absMask), thr);
+                __m128 b = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[idx+4])), absMask), thr);
+                __m128 c = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[idx+8])), absMask), thr);
+                __m128 d = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[idx+12])), absMask), thr);
+                if (_mm_movemask_ps(_mm_or_ps(_mm_or_ps(a, b), _mm_or_ps(c, d))) != 0) {
+                    // the exact sample is found below
+                    break;
+                }
+            }
+#endif
+            for (; idx<count; idx++) {
+                if (fabsf(src[idx]) > threshold) {
+                    return idx;
+                }
+            }
+            return count;
+        }
+
+        // one past the last sample above threshold (0 if there is none)
+        static uint32_t findLast(const float* src, uint32_t count, float threshold) {
+            uint32_t end = count;
+#if defined(__SSE2__)
+            const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7FFFFFFF));
+            const __m128 thr = _mm_set1_ps(threshold);
+            for (; end >= 16; end -= 16) {
+                __m128 a = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[end-16])), absMask), thr);
+                __m128 b = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[end-12])), absMask), thr);
+                __m128 c = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[end-8])), absMask), thr);
+                __m128 d = _mm_cmpgt_ps(_mm_and_ps(_mm_loadu_ps(&(src[end-4])), absMask), thr);
+                if (_mm_movemask_ps(_mm_or_ps(_mm_or_ps(a, b), _mm_or_ps(c, d))) != 0) {
+                    break;
+                }
+            }
+#endif
+            for (; end>0; end--) {
+                if (fabsf(src[end-1]) > threshold) {
+                    return end;
+                }
+            }
+            return 0;
+        }
+
+        // find the trim points of an opened file (header.trim*). a file that is silent
+        // throughout is not trimmed. false if the data cannot be read
+        static bool scan(WaveFile& wf, WaveHeader& header, double thresholdDB) {
+            uint64_t frames = wf.getFrameCount();
+            uint32_t channels = wf.getChannels();
+            if (!wf.isFileOpened() || (channels == 0)) {
+                return false;
+            }
+            float threshold = toLinear(thresholdDB);
+            std::vector<float> buf(blockFrames*channels);
+            uint64_t start = frames;
+            for (uint64_t pos=0; pos<frames; ) {
+                uint32_t length = (uint32_t)std::min<uint64_t>(blockFrames, frames - pos);
+                if (!wf.seekFrame(pos)) {
+                    return false;
+                }
+                uint32_t got = wf.read(buf.data(), length);
+                if (got == 0) {
+                    return false;
+                }
+                uint32_t idx = findFirst(buf.data(), got*channels, threshold);
+                if (idx < got*channels) {
+                    start = pos + idx/channels;
+                    break;
+                }
+                pos += got;
+            }
+            uint64_t end = frames;
+            if (start == frames) {
+                start = 0;
+            } else {
+                for (uint64_t pos=frames; pos>start; ) {
+                    uint32_t length = (uint32_t)std::min<uint64_t>(blockFrames, pos - start);
+                    if (!wf.seekFrame(pos - length)) {
+                        return false;
+                    }
+                    uint32_t got = wf.read(buf.data(), length);
+                    if (got < length) {
+                        return false;
+                    }
+                    uint32_t idx = findLast(buf.data(), got*channels, threshold);
+                    if (idx > 0) {
+                        end = pos - length + (idx-1)/channels + 1;
+                        break;
+                    }
+                    pos -= length;
+                }
+            }
+            header.hasTrim = true;
+            header.trimThreshold = (float)thresholdDB;
+            header.trimStart = start;
+            header.trimEnd = end;
+            return true;
+        }
+
+        // header with the data chunk narrowed to [trimStart, trimEnd) (loop points follow)
+        static WaveHeader apply(const WaveHeader& header) {
+            WaveHeader trimmed = header;
+            uint64_t frames = (header.bytesPerFrame > 0) ? header.dataSize / header.bytesPerFrame : 0;
+            if (!header.valid || !header.hasTrim || (header.trimStart >= header.trimEnd) || (header.trimEnd > frames)) {
+                return trimmed;
+            }
+            trimmed.dataOffset += (int64_t)(header.trimStart*header.bytesPerFrame);
+            trimmed.dataSize = (header.trimEnd - header.trimStart)*header.bytesPerFrame;
+            if (header.hasLoop) {
+                uint64_t loopStart = std::max(header.loopStart, header.trimStart);
+                uint64_t loopEnd = std::min(header.loopEnd, header.trimEnd);
+                trimmed.hasLoop = (loopStart < loopEnd);
+                trimmed.loopStart = trimmed.hasLoop ? loopStart - header.trimStart : 0;
+                trimmed.loopEnd = trimmed.hasLoop ? loopEnd - header.trimStart : 0;
+            }
+            return trimmed;
+        }
+        // frames removed by apply()
+        static uint64_t getTrimmedFrames(const WaveHeader& header) {
+            uint64_t frames = (header.bytesPerFrame > 0) ? header.dataSize / header.bytesPerFrame : 0;
+            if (!header.valid || !header.hasTrim || (header.trimStart >= header.trimEnd) || (header.trimEnd > frames)) {
+                return 0;
+            }
+            return frames - (header.trimEnd - header.trimStart);
+        }
+};
+
+#endif
@@ -0,0 +1,205 @@
+#ifndef SYNC_SIMULATION_H_INCLUDED
+#define SYNC_SIMULATION_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "math.h"
+
+#include <chrono>
+#include <vector>
+
+#include "buffers.hpp"
+#include "MultiOutput.hpp"
+
+// Output device running on a simulated clock: callbacks of blockFrames at
+// fs*(1+ppm), DAC timestamps with a fixed latency plus random jitter.
+class SimulatedOutputSink : public OutputSink {
+    private:
+        ring_buffer<float> ring;
+        uint32_t nCH = 2;
+        double rate = 48000;
+        double latency = 0;
+        double jitter = 0;
+        uint32_t blockFrames = 256;
+        double nextCallback = 0;
+        uint64_t cbFrames = 0;
+        uint64_t rbFrames = 0;
+        bool started = false;
+        double snapDacTime = 0;
+        uint64_t snapCbFrames = 0;
+        uint64_t snapRbFrames = 0;
+        uint32_t noiseState = 12345;
+        std::vector<float> cbBuf;
+        // ground truth: source frame at the DAC for the first frame of the latest block
+        double blockSource = 0;
+        double blockDacTime = 0;
+        bool blockValid = false;
+
+    public:
+        unsigned long underruns = 0;
+
+        SimulatedOutputSink(uint32_t channels, double fs, double ppm, double latencySec,
+                            double jitterSec, uint32_t block, uint32_t ringFrames, double startTime) :
+            ring(ringFrames*channels) {
+            nCH = channels;
+            rate = fs*(1.0 + ppm*1e-6);
+            latency = latencySec;
+            jitter = jitterSec;
+            blockFrames = block;
+            nextCallback = startTime;
+            cbBuf.resize(blockFrames*nCH);
+        }
+
+        uint32_t getFreeFrames() {
+            return (ring.get_buf_length() - ring.get_stored_length()) / nCH;
+        }
+        uint32_t writeFrames(const float* src, uint32_t frames) {
+            return ring.put_data_memcpy((float*)src, frames*nCH) / nCH;
+        }
+        bool getClockSnapshot(double& dacTime, uint64_t& cbCount, uint64_t& rbCount) {
+            dacTime = snapDacTime;
+            cbCount = snapCbFrames;
+            rbCount = snapRbFrames;
+            return started;
+        }
+
+        // run every callback due up to time t
+        void advanceTo(double t) {
+            while (nextCallback <= t) {
+                noiseState = noiseState*1664525u + 1013904223u;
+                double noise = jitter*((double)(noiseState >> 8)/8388608.0 - 1.0);
+                snapDacTime = nextCallback + latency + noise;
+                snapCbFrames = cbFrames;
+                snapRbFrames = rbFrames;
+                started = true;
+                uint32_t got = ring.get_data_memcpy(cbBuf.data(), blockFrames*nCH) / nCH;
+                if ((got < blockFrames) && (cbFrames > 0)) {
+                    underruns++;
+                }
+                // source counter: ch0 = frame % 65536, ch1 = frame / 65536
+                blockValid = (got > 0) && (cbBuf[0] > 8) && (cbBuf[0] < 65536-8);
+                if (blockValid) {
+                    blockSource = (double)cbBuf[1]*65536.0 + cbBuf[0];
+                    blockDacTime = nextCallback + latency;
+                }
+                rbFrames += got;
+                cbFrames += blockFrames;
+                nextCallback += blockFrames / rate;
+            }
+        }
+
+        bool getTrueSourceAt(double t, double fs, double& source) {
+            if (!blockValid) {
+                return false;
+            }
+            source = blockSource + (t - blockDacTime)*fs;
+            return true;
+        }
+};
+
+// Drives MultiOutputSync with simulated devices and checks the alignment
+// of what each device plays against the master.
+class SyncSimulation {
+    public:
+        static bool run(double hours=2.0, bool verbose=true) {
+            constexpr double fs = 48000;
+            constexpr uint32_t nCH = 2;
+            constexpr uint32_t chunk = 1024;
+            constexpr double settleTime = 120.0;
+            const double ppm[] = {0.0, 45.0, -70.0, 180.0};
+            const double latency[] = {0.005, 0.012, 0.003, 0.009};
+            const uint32_t blocks[] = {256, 512, 128, 441};
+            const double starts[] = {0.0, 0.0013, 0.021, 0.0047};
+            constexpr int devices = 4;
+            constexpr double jitter = 0.0003;
+
+            std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+            printf("Sync simulation: %d devices, %.1f h, timestamp jitter +-%.1f msec\n",
+                   devices, hours, jitter*1000);
+            std::vector<SimulatedOutputSink*> sinks;
+            MultiOutputSync group(nCH, fs);
+            for (int dev=0; dev<devices; dev++) {
+                sinks.push_back(new SimulatedOutputSink(nCH, fs, ppm[dev], latency[dev], jitter,
+                                                        blocks[dev], chunk*8, starts[dev]));
+                group.addOutput(sinks.back());
+                printf("  dev %d: %+7.1f ppm, latency %4.1f msec, block %u\n",
+                       dev, ppm[dev], latency[dev]*1000, blocks[dev]);
+            }
+            double simTime = 0;
+            group.waitHook = [&]() {
+                simTime += 0.001;
+                for (int dev=0; dev<devices; dev++) {
+                    sinks.at(dev)->advanceTo(simTime);
+                }
+            };
+
+            std::vector<float> buf(chunk*nCH);
+            uint64_t srcFrame = 0;
+            double maxError = 0;
+            double sumSq = 0;
+            uint64_t samples = 0;
+            double nextReport = 600;
+            unsigned long settledUnderruns = 0;
+            while (simTime < hours*3600.0) {
+                for (uint32_t ctr=0; ctr<chunk; ctr++) {
+                    buf[ctr*nCH] = (float)(srcFrame % 65536);
+                    buf[ctr*nCH+1] = (float)(srcFrame / 65536);
+                    srcFrame++;
+                }
+                if (!group.write(buf.data(), chunk)) {
+                    printf("  write timed out at %.1f sec\n", simTime);
+                    break;
+                }
+                double masterSrc = 0;
+                if (!sinks.at(0)->getTrueSourceAt(simTime, fs, masterSrc)) {
+                    continue;
+                }
+                double worst = 0;
+                for (int dev=1; dev<devices; dev++) {
+                    double src = 0;
+                    if (sinks.at(dev)->getTrueSourceAt(simTime, fs, src)) {
+                        worst = fmax(worst, fabs(src - masterSrc));
+                    }
+                }
+                if (simTime > settleTime) {
+                    maxError = fmax(maxError, worst);
+                    sumSq += worst*worst;
+                    samples++;
+                }
+                if (verbose && (simTime >= nextReport)) {
+                    nextReport += 600;
+                    printf("  %6.0f sec: max offset %6.2f frames |", simTime, worst);
+                    for (int dev=1; dev<devices; dev++) {
+                        SyncedOutput* out = group.getOutput(dev);
+                        printf(" dev%d est %+7.2f ppm step %+8.2f ppm |", dev,
+                               (out->getRate()/group.getOutput(0)->getRate() - 1.0)*1e6,
+                               (out->step - 1.0)*1e6);
+                    }
+                    putchar('\n');
+                }
+                if (simTime <= settleTime) {
+                    settledUnderruns = 0;
+                    for (int dev=0; dev<devices; dev++) {
+                        settledUnderruns += sinks.at(dev)->underruns;
+                    }
+                }
+            }
+            unsigned long underruns = 0;
+            unsigned long jumps = 0;
+            for (int dev=0; dev<devices; dev++) {
+                underruns += sinks.at(dev)->underruns;
+                jumps += group.getOutput(dev)->coarseJumps;
+            }
+            double rms = (samples > 0) ? sqrt(sumSq/samples) : 0;
+            printf("After %.0f sec of settling: max offset %.2f frames, rms %.2f frames\n", settleTime, maxError, rms);
+            printf("Underruns after settling: %lu, coarse jumps: %lu\n", underruns - settledUnderruns, jumps);
+            printf("Wall time: %.1f sec\n",
+                   std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count());
+            for (int dev=0; dev<devices; dev++) {
+                delete sinks.at(dev);
+            }
+            return (maxError < 2.0) && (underruns == settledUnderruns);
+        }
+};
+
+#endif
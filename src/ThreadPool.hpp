@@ -0,0 +1,153 @@
+#ifndef THREAD_POOL_H_INCLUDED
+#define THREAD_POOL_H_INCLUDED
+
+#include "stdint.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for data parallel loops.
+// parallelFor() hands out indices one at a time (so uneven items balance out);
+// the calling thread works on the loop too and returns when every index is done.
+// runOnWorkers() runs a function once on each worker (e.g. to set its scheduling).
+class ThreadPool {
+    private:
+        std::vector<std::thread> workers;
+        std::mutex mx;
+        std::condition_variable cvWork;
+        std::condition_variable cvDone;
+        const std::function<void(uint32_t)>* task = nullptr;
+        uint32_t taskCount = 0;
+        std::atomic<uint32_t> nextIndex{0};
+        uint32_t busyWorkers = 0;
+        uint64_t generation = 0;
+        const std::function<void()>* setup = nullptr;
+        uint64_t setupGeneration = 0;
+        bool quit = false;
+
+        void runTask(const std::function<void(uint32_t)>& fn, uint32_t count) {
+            while (true) {
+                uint32_t index = nextIndex.fetch_add(1, std::memory_order_relaxed);
+                if (index >= count) {
+                    break;
+                }
+                fn(index);
+            }
+        }
+
+        void workerLoop() {
+            uint64_t seen = 0;
+            uint64_t setupSeen = 0;
+            while (true) {
+                const std::function<void(uint32_t)>* fn = nullptr;
+                const std::function<void()>* setupFn = nullptr;
+                uint32_t count = 0;
+                {
+                    std::unique_lock<std::mutex> lock(mx);
+                    cvWork.wait(lock, [&]() {
+                        return quit || (generation != seen) || (setupGeneration != setupSeen);
+                    });
+                    if (quit) {
+                        return;
+                    }
+                    if (setupGeneration != setupSeen) {
+                        setupSeen = setupGeneration;
+                        setupFn = setup;
+                    } else {
+                        seen = generation;
+                        fn = task;
+                        count = taskCount;
+                    }
+                }
+                if (setupFn) {
+                    (*setupFn)();
+                } else {
+                    runTask(*fn, count);
+                }
+                {
+                    std::lock_guard<std::mutex> lock(mx);
+                    busyWorkers--;
+                    if (busyWorkers == 0) {
+                        cvDone.notify_one();
+                    }
+                }
+            }
+        }
+
+    public:
+        // threads: total threads including the caller (0: one per hardware thread)
+        ThreadPool(uint32_t threads=0) {
+            if (threads == 0) {
+                threads = std::thread::hardware_concurrency();
+            }
+            if (threads == 0) {
+                threads = 1;
+            }
+            for (uint32_t ctr=1; ctr<threads; ctr++) {
+                workers.emplace_back([this]() { workerLoop(); });
+            }
+        }
+        ~ThreadPool() {
+            {
+                std::lock_guard<std::mutex> lock(mx);
+                quit = true;
+            }
+            cvWork.notify_all();
+            for (std::vector<std::thread>::size_type ctr=0; ctr<workers.size(); ctr++) {
+                workers.at(ctr).join();
+            }
+        }
+        ThreadPool(const ThreadPool&) = delete;
+        ThreadPool& operator=(const ThreadPool&) = delete;
+
+        uint32_t getThreadCount() {
+            return workers.size() + 1;
+        }
+
+        // fn() once on every worker thread (not on the caller); returns when all have run it
+        void runOnWorkers(const std::function<void()>& fn) {
+            if (workers.empty()) {
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mx);
+                setup = &fn;
+                busyWorkers = workers.size();
+                setupGeneration++;
+            }
+            cvWork.notify_all();
+            std::unique_lock<std::mutex> lock(mx);
+            cvDone.wait(lock, [&]() { return busyWorkers == 0; });
+        }
+
+        // fn(index) for index = 0 ... count-1
+        void parallelFor(uint32_t count, const std::function<void(uint32_t)>& fn) {
+            if (count == 0) {
+                return;
+            }
+            if (workers.empty() || (count == 1)) {
+                for (uint32_t index=0; index<count; index++) {
+                    fn(index);
+                }
+                return;
+            }
+            {
+                std::lock_guard<std::mutex> lock(mx);
+                task = &fn;
+                taskCount = count;
+                nextIndex.store(0, std::memory_order_relaxed);
+                busyWorkers = workers.size();
+                generation++;
+            }
+            cvWork.notify_all();
+            runTask(fn, count);
+            std::unique_lock<std::mutex> lock(mx);
+            cvDone.wait(lock, [&]() { return busyWorkers == 0; });
+        }
+};
+
+#endif
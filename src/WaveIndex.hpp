@@ -0,0 +1,307 @@
+#ifndef WAVE_INDEX_H_INCLUDED
+#define WAVE_INDEX_H_INCLUDED
+
+#include "stdint.h"
+#include "stdio.h"
+#include "string.h"
+
+#include <atomic>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "SilenceTrim.hpp"
+#include "WaveLoader.hpp"
+
+// On-disk index of the WAVE headers of a directory (one binary file), so that the
+// playlist is checked at startup and a file is opened with one fopen + fseek.
+// Entries are keyed by the path relative to the directory and reused while the file
+// size and mtime are unchanged; other files are parsed and the index is rewritten.
+// lookup() may be called from several threads (files are parsed outside the lock).
+// With setSilenceTrim() the trim points are found once and kept with the header;
+// loudness found by LoudnessAnalyzer is stored with setLoudness().
+//
+// layout (native byte order):
+//   "WPIX", uint32 version, uint32 entry count
+//   per entry: 96 bytes of fields (see putEntry) followed by the name (not terminated)
+class WaveIndex {
+    private:
+        static constexpr uint32_t version = 3;
+        static constexpr std::size_t recordSize = 96;
+        struct Entry {
+            int64_t mtime = 0;
+            uint64_t fileSize = 0;
+            WaveHeader header;
+            // looked up in this run (others are dropped when saved)
+            bool seen = false;
+        };
+        std::string dirPath;
+        std::string indexPath;
+        std::mutex mx;
+        std::unordered_map<std::string, Entry> entries;
+        bool dirty = false;
+        std::atomic<uint32_t> reusedCount{0};
+        std::atomic<uint32_t> parsedCount{0};
+        std::atomic<uint32_t> trimScanCount{0};
+        bool trimEnabled = false;
+        double trimThreshold = 0;
+
+        static void putEntry(uint8_t* rec, const std::string& name, const Entry& entry) {
+            const WaveHeader& hd = entry.header;
+            uint16_t nameLength = name.length();
+            uint16_t channels = hd.channels;
+            memcpy(&(rec[0]), &nameLength, 2);
+            rec[2] = hd.valid ? 1 : 0;
+            rec[3] = (uint8_t)hd.format;
+            rec[4] = hd.isRF64 ? 1 : 0;
+            rec[5] = hd.hasLoop ? 1 : 0;
+            memcpy(&(rec[6]), &channels, 2);
+            memcpy(&(rec[8]), &(hd.fs), 4);
+            memcpy(&(rec[12]), &(hd.bytesPerFrame), 4);
+            memcpy(&(rec[16]), &(entry.mtime), 8);
+            memcpy(&(rec[24]), &(entry.fileSize), 8);
+            memcpy(&(rec[32]), &(hd.dataOffset), 8);
+            memcpy(&(rec[40]), &(hd.dataSize), 8);
+            memcpy(&(rec[48]), &(hd.loopStart), 8);
+            memcpy(&(rec[56]), &(hd.loopEnd), 8);
+            memcpy(&(rec[64]), &(hd.trimStart), 8);
+            memcpy(&(rec[72]), &(hd.trimEnd), 8);
+            memcpy(&(rec[80]), &(hd.trimThreshold), 4);
+            rec[84] = hd.hasTrim ? 1 : 0;
+            rec[85] = hd.hasLoudness ? 1 : 0;
+            rec[86] = 0;
+            rec[87] = 0;
+            memcpy(&(rec[88]), &(hd.loudness), 4);
+            memcpy(&(rec[92]), &(hd.truePeak), 4);
+        }
+        static uint16_t getEntry(const uint8_t* rec, Entry& entry) {
+            WaveHeader& hd = entry.header;
+            uint16_t nameLength = 0;
+            uint16_t channels = 0;
+            memcpy(&nameLength, &(rec[0]), 2);
+            hd.valid = (rec[2] != 0);
+            hd.format = (rec[3] == 0xFE) ? EXTENSIBLE : (WF_Format)rec[3];
+            hd.isRF64 = (rec[4] != 0);
+            hd.hasLoop = (rec[5] != 0);
+            memcpy(&channels, &(rec[6]), 2);
+            hd.channels = channels;
+            memcpy(&(hd.fs), &(rec[8]), 4);
+            memcpy(&(hd.bytesPerFrame), &(rec[12]), 4);
+            memcpy(&(entry.mtime), &(rec[16]), 8);
+            memcpy(&(entry.fileSize), &(rec[24]), 8);
+            memcpy(&(hd.dataOffset), &(rec[32]), 8);
+            memcpy(&(hd.dataSize), &(rec[40]), 8);
+            memcpy(&(hd.loopStart), &(rec[48]), 8);
+            memcpy(&(hd.loopEnd), &(rec[56]), 8);
+            memcpy(&(hd.trimStart), &(rec[64]), 8);
+            memcpy(&(hd.trimEnd), &(rec[72]), 8);
+            memcpy(&(hd.trimThreshold), &(rec[80]), 4);
+            hd.hasTrim = (rec[84] != 0);
+            hd.hasLoudness = (rec[85] != 0);
+            memcpy(&(hd.loudness), &(rec[88]), 4);
+            memcpy(&(hd.truePeak), &(rec[92]), 4);
+            hd.mtime = entry.mtime;
+            return nameLength;
+        }
+
+    public:
+        static constexpr const char* defaultName = ".wpindex";
+
+        // indexFile empty: <directory>/.wpindex
+        WaveIndex(const std::string& directory, const std::string& indexFile="") {
+            dirPath = directory;
+            if (indexFile.empty()) {
+                indexPath = (std::filesystem::path(directory) / defaultName).string();
+            } else {
+                indexPath = indexFile;
+            }
+        }
+
+        const std::string& getPath() {
+            return indexPath;
+        }
+
+        // find the silence at the ends of each file (below thresholdDB) in lookup().
+        // entries found with another threshold are scanned again
+        void setSilenceTrim(bool enable, double thresholdDB) {
+            trimEnabled = enable;
+            trimThreshold = thresholdDB;
+        }
+
+        // false if there is no index or it is broken (everything is parsed again)
+        bool load() {
+            entries.clear();
+            FILE* pFile = fopen(indexPath.c_str(), "rb");
+            if (!pFile) {
+                return false;
+            }
+            char magic[4] = {};
+            uint32_t fileVersion = 0;
+            uint32_t count = 0;
+            if ((fread(magic, 1, 4, pFile) != 4) || (memcmp(magic, "WPIX", 4) != 0)
+                || (fread(&fileVersion, 4, 1, pFile) != 1) || (fileVersion != version)
+                || (fread(&count, 4, 1, pFile) != 1)) {
+                fclose(pFile);
+                dirty = true;
+                return false;
+            }
+            uint8_t rec[recordSize] = {};
+            std::string name;
+            for (uint32_t ctr=0; ctr<count; ctr++) {
+                Entry entry;
+                if (fread(rec, 1, recordSize, pFile) != recordSize) {
+                    break;
+                }
+                name.resize(getEntry(rec, entry));
+                if (fread(&(name[0]), 1, name.length(), pFile) != name.length()) {
+                    break;
+                }
+                entries[name] = entry;
+            }
+            bool complete = (entries.size() == count);
+            fclose(pFile);
+            if (!complete) {
+                entries.clear();
+                dirty = true;
+            }
+            return complete;
+        }
+
+        // written only if something has changed (through a temporary file)
+        bool save() {
+            std::unordered_map<std::string, Entry>::size_type seenCount = 0;
+            for (const std::pair<const std::string, Entry>& item : entries) {
+                if (item.second.seen) {
+                    seenCount++;
+                }
+            }
+            if (!dirty && (seenCount == entries.size())) {
+                return true;
+            }
+            std::string tempPath = indexPath + ".tmp";
+            FILE* pFile = fopen(tempPath.c_str(), "wb");
+            if (!pFile) {
+                return false;
+            }
+            uint32_t count = seenCount;
+            bool written = (fwrite("WPIX", 1, 4, pFile) == 4) && (fwrite(&version, 4, 1, pFile) == 1)
+                           && (fwrite(&count, 4, 1, pFile) == 1);
+            uint8_t rec[recordSize] = {};
+            for (const std::pair<const std::string, Entry>& item : entries) {
+                if (!written) {
+                    break;
+                }
+                if (!item.second.seen) {
+                    continue;
+                }
+                putEntry(rec, item.first, item.second);
+                written = (fwrite(rec, 1, recordSize, pFile) == recordSize)
+                          && (fwrite(item.first.c_str(), 1, item.first.length(), pFile) == item.first.length());
+            }
+            if (fclose(pFile) != 0) {
+                written = false;
+            }
+            std::error_code ec;
+            if (written) {
+                std::filesystem::rename(tempPath, indexPath, ec);
+            }
+            if (!written || ec) {
+                std::filesystem::remove(tempPath, ec);
+                return false;
+            }
+            dirty = false;
+            return true;
+        }
+
+        // header of a file in the directory: from the index while its size and mtime
+        // match, otherwise parsed (chunk walk) and stored. false if it cannot be played.
+        bool lookup(const std::filesystem::directory_entry& file, WaveHeader& header, bool verbose=false) {
+            std::error_code ec;
+            int64_t mtime = (int64_t)file.last_write_time(ec).time_since_epoch().count();
+            uint64_t fileSize = ec ? 0 : (uint64_t)file.file_size(ec);
+            std::string name = file.path().lexically_relative(dirPath).generic_string();
+            if (name.empty() || (name.length() > 0xFFFF)) {
+                name = file.path().generic_string();
+            }
+            Entry entry;
+            bool reused = false;
+            if (!ec) {
+                std::lock_guard<std::mutex> lock(mx);
+                std::unordered_map<std::string, Entry>::iterator it = entries.find(name);
+                if ((it != entries.end()) && (it->second.mtime == mtime) && (it->second.fileSize == fileSize)) {
+                    it->second.seen = true;
+                    entry = it->second;
+                    reused = true;
+                }
+            }
+            bool needTrim = trimEnabled && (!entry.header.hasTrim || (entry.header.trimThreshold != (float)trimThreshold));
+            if (reused && (!entry.header.valid || !needTrim)) {
+                header = entry.header;
+                reusedCount++;
+                return header.valid;
+            }
+            if (reused) {
+                // only the trim points are missing: opened without the chunk walk
+                WaveFile wf;
+                if (wf.reopen(file.path().string(), entry.header)) {
+                    SilenceTrim::scan(wf, entry.header, trimThreshold);
+                }
+                reusedCount++;
+            } else {
+                WaveFile wf(file.path().string(), "r", verbose);
+                if (wf.isFileOpened()) {
+                    wf.getHeader(entry.header);
+                    if (trimEnabled && entry.header.valid) {
+                        SilenceTrim::scan(wf, entry.header, trimThreshold);
+                    }
+                }
+                parsedCount++;
+            }
+            if (trimEnabled && entry.header.valid) {
+                trimScanCount++;
+            }
+            entry.mtime = mtime;
+            entry.fileSize = fileSize;
+            entry.header.mtime = mtime;
+            entry.seen = true;
+            header = entry.header;
+            // a file that could not be read (ec) is parsed again next time
+            if (!ec && (name.length() <= 0xFFFF)) {
+                std::lock_guard<std::mutex> lock(mx);
+                entries[name] = entry;
+                dirty = true;
+            }
+            return header.valid;
+        }
+
+        // store the loudness found after lookup() for the same file (mtime of its header)
+        void setLoudness(const std::filesystem::path& file, int64_t mtime, float loudness, float truePeak) {
+            std::string name = file.lexically_relative(dirPath).generic_string();
+            if (name.empty() || (name.length() > 0xFFFF)) {
+                name = file.generic_string();
+            }
+            std::lock_guard<std::mutex> lock(mx);
+            std::unordered_map<std::string, Entry>::iterator it = entries.find(name);
+            if ((it != entries.end()) && (it->second.header.mtime == mtime)) {
+                it->second.header.hasLoudness = true;
+                it->second.header.loudness = loudness;
+                it->second.header.truePeak = truePeak;
+                dirty = true;
+            }
+        }
+
+        uint32_t getReusedCount() {
+            return reusedCount.load();
+        }
+        uint32_t getParsedCount() {
+            return parsedCount.load();
+        }
+        // files scanned for silence in this run
+        uint32_t getTrimScanCount() {
+            return trimScanCount.load();
+        }
+};
+
+#endif
@@ -4,8 +4,12 @@
 #include "stdint.h"
 #include "stdlib.h"
 #include "stdio.h"
+#include "string.h"
 
+#include <memory>
+#include <new>
 #include <string>
+#include <vector>
 
 typedef enum {
     SIGNED_8 = 0,
@@ -16,6 +20,22 @@ typedef enum {
     EXTENSIBLE=65534
 } WF_Format;
 
+// 64-bit file positions (files over 2 GB)
+inline int64_t waveTell64(FILE* pFile) {
+#if defined(_WIN32)
+    return _ftelli64(pFile);
+#else
+    return ftello(pFile);
+#endif
+}
+inline int waveSeek64(FILE* pFile, int64_t offset, int origin) {
+#if defined(_WIN32)
+    return _fseeki64(pFile, offset, origin);
+#else
+    return fseeko(pFile, offset, origin);
+#endif
+}
+
 typedef union {
     int8_t s8[4];
     int16_t s16[2];
@@ -23,12 +43,81 @@ typedef union {
     float f32;
 } WaveData;
 
+// Decoded samples of a whole data chunk (interleaved float, 64-byte aligned) and the
+// format of the file they came from. validFrames grows while the file is decoded the
+// first time; a complete buffer is read only (see PcmCache).
+class DecodedPcm {
+    public:
+        static constexpr std::size_t alignment = 64;
+        float* data = nullptr;
+        uint64_t frames = 0;
+        uint64_t validFrames = 0;
+        uint32_t channels = 0;
+        uint32_t fs = 0;
+        uint32_t bytesPerFrame = 0;
+        WF_Format format = SIGNED_16;
+        bool hasLoop = false;
+        uint64_t loopStart = 0;
+        uint64_t loopEnd = 0;
+        std::string path;
+        int64_t mtime = 0;
+
+        DecodedPcm(uint64_t frameCount, uint32_t nCH) {
+            frames = frameCount;
+            channels = nCH;
+            data = static_cast<float*>(::operator new[](getBytes() + sizeof(float), std::align_val_t(alignment)));
+        }
+        ~DecodedPcm() {
+            ::operator delete[](data, std::align_val_t(alignment));
+        }
+        DecodedPcm(const DecodedPcm&) = delete;
+        DecodedPcm& operator=(const DecodedPcm&) = delete;
+
+        uint64_t getBytes() {
+            return frames*channels*sizeof(float);
+        }
+        bool isComplete() {
+            return validFrames == frames;
+        }
+};
+
+// Result of the chunk walk: enough to open the file with one fseek (see WaveIndex).
+// valid is set for a WAVE file with a supported format and a data chunk.
+struct WaveHeader {
+    bool valid = false;
+    WF_Format format = SIGNED_16;
+    uint32_t channels = 0;
+    uint32_t fs = 0;
+    uint32_t bytesPerFrame = 0;
+    int64_t dataOffset = 0;
+    uint64_t dataSize = 0;
+    bool isRF64 = false;
+    bool hasLoop = false;
+    uint64_t loopStart = 0;
+    uint64_t loopEnd = 0;
+    int64_t mtime = 0;
+    // silence at the ends of the data (see SilenceTrim): frames [trimStart, trimEnd) are
+    // played. trimThreshold (dBFS) is the level they were found with
+    bool hasTrim = false;
+    float trimThreshold = 0;
+    uint64_t trimStart = 0;
+    uint64_t trimEnd = 0;
+    // integrated loudness (LUFS) and true peak (dBTP) from LoudnessAnalyzer
+    bool hasLoudness = false;
+    float loudness = 0;
+    float truePeak = 0;
+};
+
 class WaveFile {
     private:
         FILE* wFile = nullptr;
         bool isClosed = false;
-        long dataChunkPos = 0;
-        uint32_t dataChunkSize = 0;
+        int64_t dataChunkPos = 0;
+        uint64_t dataChunkSize = 0;
+        // RF64/BW64: 64-bit sizes from the ds64 chunk
+        bool isRF64 = false;
+        uint64_t ds64RiffSize = 0;
+        uint64_t ds64DataSize = 0;
         union  {
             char raw[4] = {};
             uint32_t value;
@@ -62,20 +151,20 @@ class WaveFile {
             uint32_t data;
         } nBitsPerSample;
         union {
-            char raw[2];
+            char raw[2] = {};
             uint16_t data;
         } cbSize;
         union {
-            char raw[2];
+            char raw[2] = {};
             uint16_t data;
         } Samples;
         union {
-            char raw[4];
+            char raw[4] = {};
             uint32_t data;
         } dwChannelMask;
         uint8_t guid[16] = {};
         union {
-            char raw[4];
+            char raw[4] = {};
             uint32_t data;
         } subfmt;
 
@@ -86,256 +175,521 @@ class WaveFile {
         bool isWAVE = false;
         bool abortreq = false;
         bool errorStatus = false;
-        WF_Format wfmt;
-        uint32_t readSizeCount = 0;
+        WF_Format wfmt = SIGNED_16;
+        uint64_t readSizeCount = 0;
         char* tempRawData = nullptr;
+        // loop region [loopStart, loopEnd) in frames (from the smpl chunk or setLoopRegion())
+        bool hasLoop = false;
+        uint64_t loopStart = 0;
+        uint64_t loopEnd = 0;
+        // decoded samples: frames below pcm->validFrames are served from memory,
+        // and frames read from the file at validFrames are appended while it grows
+        std::shared_ptr<DecodedPcm> pcm;
+        bool fileSynced = true;
 
-    public:
-        WaveFile(){}
-        WaveFile(std::string fileName, std::string mode, bool verbose=false) {
-            bool isReadMode = true;
-            std::string rwmode("rb");
-            if (mode.find('r') != std::string::npos) {
-                rwmode.clear();
-                rwmode.assign("rb");
-            } else if (mode.find('w') != std::string::npos) {
-                rwmode.clear();
-                rwmode.assign("wb");
-                isReadMode = false;
-            } else {
-                rwmode.clear();
-                rwmode.assign("rb");
-            }
-            wFile = fopen(fileName.c_str(), rwmode.c_str());
+        uint32_t readFromFile(float* dest, uint32_t length) {
             if (!wFile) {
-                return;
+                return 0;
             }
-            if (isReadMode) {
-                // RIFF indicator check
-                std::string fHeader;
-                char wData[12] = {};
-                fread(wData, 1, 12, wFile);
-                fHeader.assign(wData, 4);
-                if (verbose) {
-                    printf("RIFF Header check: %s\n", fHeader.c_str());
+            WaveData wData;
+            size_t readCount = 0;
+            size_t readSize = 0;
+            float tempData = 0;
+            if (!tempRawData) {
+                return 0;
+            }
+            if (!fileSynced) {
+                waveSeek64(wFile, dataChunkPos + readSizeCount, SEEK_SET);
+                fileSynced = true;
+            }
+            for (uint32_t ctr=0; (ctr<length) && !isEndOfFile(); ctr++) {
+                if (readSizeCount >= dataChunkSize) {
+                    isWaveDataEnd = true;
+                    break;
                 }
-                memcpy(fSize.raw, &(wData[4]), 4);
-                if (verbose) {
-                    printf("File size: %d\n", fSize.value);
+                readSize = fread(tempRawData, 1, nBytesPerSample, wFile);
+                if (readSize == 0) {
+                    break;
                 }
-                if (fSize.value == 0) {
-                    printf("Illegal file!\n");
-                    fclose(wFile);
-                    isClosed = true;
-                    errorStatus = true;
-                    return;
+                readSizeCount += readSize;
+                for (int chCount=0; chCount<nChannels.data; chCount++) {
+                    memcpy(wData.s8, &(tempRawData[chCount*nSingleSampleSize]), nSingleSampleSize);
+                    switch (wfmt) {
+                        case SIGNED_8:
+                        tempData = (float)wData.s8[0] / 128.0;
+                            break;
+                        case SIGNED_16:
+                            tempData = (float)wData.s16[0] / 32768.0;
+                            break;
+                        case SIGNED_24:
+                            tempData = (float)(wData.s32 << 8) / 2147483648.0;
+                            break;
+                        case SIGNED_32:
+                            tempData = (float)(wData.s32) / 2147483648.0;
+                            break;
+                        case FLOAT_32:
+                            tempData = wData.f32;
+                            break;
+                        default:
+                            tempData = 0.0;
+                            break;
+                    }
+                    dest[(ctr*nChannels.data)+chCount] = tempData;
                 }
-                // WAVE indicator check
-                std::string fID;
-                fID.clear();
-                fID.assign(&(wData[8]), 4);
+                readCount++;
+            }
+            return readCount;
+        }
+
+        // kept across reopen: the FILE object (freopen) and the buffers
+        FILE* spareFile = nullptr;
+        static constexpr std::size_t ioBufferSize = 65536;
+        char* ioBuffer = nullptr;
+        uint32_t tempRawCapacity = 0;
+        std::vector<char> chunkBuffer;
+
+        void resetState() {
+            isClosed = false;
+            dataChunkPos = 0;
+            dataChunkSize = 0;
+            isRF64 = false;
+            ds64RiffSize = 0;
+            ds64DataSize = 0;
+            fSize.value = 0;
+            chunkSize.data = 0;
+            wFormat.data = 0;
+            nChannels.data = 0;
+            nSPS.data = 0;
+            nBPS.data = 0;
+            nBlockAlign.data = 0;
+            nBitsPerSample.data = 0;
+            cbSize.data = 0;
+            Samples.data = 0;
+            dwChannelMask.data = 0;
+            memset(guid, 0, sizeof(guid));
+            subfmt.data = 0;
+            nSingleSampleSize = 0;
+            nBytesPerSample = 0;
+            isUnsupported = true;
+            isWaveDataEnd = false;
+            isWAVE = false;
+            abortreq = false;
+            errorStatus = false;
+            wfmt = SIGNED_16;
+            readSizeCount = 0;
+            hasLoop = false;
+            loopStart = 0;
+            loopEnd = 0;
+            pcm.reset();
+            fileSynced = true;
+        }
+
+        bool openStream(const std::string& fileName) {
+            FILE* reuse = wFile ? wFile : spareFile;
+            if (wFile && spareFile) {
+                fclose(spareFile);
+            }
+            wFile = nullptr;
+            spareFile = nullptr;
+            if (reuse) {
+                wFile = freopen(fileName.c_str(), "rb", reuse);
+            } else {
+                wFile = fopen(fileName.c_str(), "rb");
+            }
+            if (!wFile) {
+                return false;
+            }
+            if (!ioBuffer) {
+                ioBuffer = new char[ioBufferSize];
+            }
+            setvbuf(wFile, ioBuffer, _IOFBF, ioBufferSize);
+            return true;
+        }
+        void closeStream() {
+            if (wFile) {
+                fclose(wFile);
+                wFile = nullptr;
+            }
+        }
+
+        void reserveRawBuffer() {
+            if (nBytesPerSample > tempRawCapacity) {
+                delete[] tempRawData;
+                // 8 channels of 32 bits fit the first buffer
+                tempRawCapacity = (nBytesPerSample > 32) ? nBytesPerSample : 32;
+                tempRawData = new char[tempRawCapacity];
+            }
+        }
+
+        // chunk walk of the file opened by openStream(); false if it cannot be read
+        bool parseChunks(bool verbose) {
+            // RIFF indicator check
+            std::string fHeader;
+            char wData[12] = {};
+            fread(wData, 1, 12, wFile);
+            fHeader.assign(wData, 4);
+            if (verbose) {
+                printf("RIFF Header check: %s\n", fHeader.c_str());
+            }
+            memcpy(fSize.raw, &(wData[4]), 4);
+            if (verbose) {
+                printf("File size: %d\n", fSize.value);
+            }
+            if ((fHeader == "RF64") || (fHeader == "BW64")) {
+                isRF64 = true;
+            }
+            if (fSize.value == 0) {
+                printf("Illegal file!\n");
+                closeStream();
+                isClosed = true;
+                errorStatus = true;
+                return false;
+            }
+            // WAVE indicator check
+            std::string fID;
+            fID.clear();
+            fID.assign(&(wData[8]), 4);
+            if (verbose) {
+                printf("WAVE ID check: %s\n", fID.c_str());
+            }
+            if (fID == "WAVE") {
+                isWAVE = true;
+            } else {
+                printf("\x1b[40m \x1b[93mWarning: It's not WAVE file. \x1b[0m\n");
+            }
+            char rawChunkID[4] = {};
+            //size_t readSize = 0;
+            while (!abortreq) {
+                //readSize = fread(rawChunkID, 1, 4, wFile);
+                fread(rawChunkID, 1, 4, wFile);
+                if (feof(wFile)) {
+                    if (verbose) {
+                        printf("End of file.\n");
+                    }
+                    break;
+                }
+                std::string chunkID(rawChunkID, 4);
+                union {
+                    char raw[4] = {};
+                    uint32_t data;
+                } chunkSize;
+                fread(chunkSize.raw, 1 ,4, wFile);
                 if (verbose) {
-                    printf("WAVE ID check: %s\n", fID.c_str());
+                    printf("Chunk ID: %s, Chunk size: %d\n", chunkID.c_str(), chunkSize.data);
                 }
-                if (fID == "WAVE") {
-                    isWAVE = true;
-                } else {
-                    printf("\x1b[40m \x1b[93mWarning: It's not WAVE file. \x1b[0m\n");
+                
+                if (chunkID == "ds64") {
+                    // riff size, data size, sample count (64-bit each), then a table we skip
+                    uint8_t ds64[24] = {};
+                    if ((chunkSize.data < 24) || (fread(ds64, 1, 24, wFile) != 24)) {
+                        printf("Loader Warning: Broken ds64 chunk\n");
+                        break;
+                    }
+                    memcpy(&ds64RiffSize, &(ds64[0]), 8);
+                    memcpy(&ds64DataSize, &(ds64[8]), 8);
+                    if (verbose) {
+                        printf("ds64 chunk found - RIFF size: %llu, data size: %llu\n",
+                               (unsigned long long)ds64RiffSize, (unsigned long long)ds64DataSize);
+                    }
+                    waveSeek64(wFile, chunkSize.data - 24 + (chunkSize.data & 1), SEEK_CUR);
+                    continue;
                 }
-                char rawChunkID[4] = {};
-                //size_t readSize = 0;
-                while (!abortreq) {
-                    //readSize = fread(rawChunkID, 1, 4, wFile);
-                    fread(rawChunkID, 1, 4, wFile);
+                if (chunkID.find("fmt") != std::string::npos) {
+                    //printf("Format chunk found.\n");
+                    chunkBuffer.resize(chunkSize.data);
+                    char* chunkData = chunkBuffer.data();
+                    fread(chunkData, 1, chunkSize.data, wFile);
                     if (feof(wFile)) {
                         if (verbose) {
                             printf("End of file.\n");
                         }
                         break;
                     }
-                    std::string chunkID(rawChunkID, 4);
-                    union {
-                        char raw[4] = {};
-                        uint32_t data;
-                    } chunkSize;
-                    fread(chunkSize.raw, 1 ,4, wFile);
-                    if (verbose) {
-                        printf("Chunk ID: %s, Chunk size: %d\n", chunkID.c_str(), chunkSize.data);
-                    }
+                    memcpy(wFormat.raw, chunkData, 2);
+                    memcpy(nChannels.raw, &(chunkData[2]), 2);
+                    memcpy(nSPS.raw, &(chunkData[4]), 4);
+                    memcpy(nBPS.raw, &(chunkData[8]), 4);
+                    nBytesPerSample = nBPS.data /  nSPS.data;
                     
-                    if (chunkID.find("fmt") != std::string::npos) {
-                        //printf("Format chunk found.\n");
-                        char* chunkData = nullptr;
-                        chunkData = new char[chunkSize.data];
-                        fread(chunkData, 1, chunkSize.data, wFile);
-                        if (feof(wFile)) {
+                    switch (wFormat.data) {
+                        case 1:
+                            if (verbose) {
+                                printf("Format: %d - Signed int (WAVE_FORMAT_PCM)\n", wFormat.data);
+                            }
+                            isUnsupported = false;
+                            break;
+                        case 3:
+                            if (verbose) {
+                                printf("Format: %d - Float (WAVE_FORMAT_IEEE_FLOAT)\n", wFormat.data);
+                            }
+                            isUnsupported = false;
+                            wfmt = FLOAT_32;
+                            break;
+                        case 7:
+                            if (verbose) {
+                                printf("Format: %d - μ-law (WAVE_FORMAT_MULAW)\n", wFormat.data);
+                            }
+                            break;
+                        case 65534:
+                            if (verbose) {
+                                printf("Format: %d - WAVEFORMATEXTENSIBLE\n", wFormat.data);
+                            }
+                            isUnsupported = false;
+                            break;
+                        default:
                             if (verbose) {
-                                printf("End of file.\n");
+                                printf("Format: %d - Unknown\n", wFormat.data);
                             }
-                            delete[] chunkData;
                             break;
+                    }
+                    if (isUnsupported) {
+                        printf("Loader Warning: Unsupported data type\n");
+                    }
+                    if (verbose) {
+                        printf("Channels: %d\n", nChannels.data);
+                        printf("fs: %d\n", nSPS.data);
+                        printf("Bitrate: %dBytes/sec, %9.3fkbits/s\n", nBPS.data, (float)(nBPS.data*8)/1000.0);
+                        printf("         %dBytes/(sample*ch)\n", nBytesPerSample);
+                    }
+                    if (chunkSize.data >= 16) {
+                        memcpy(nBlockAlign.raw, &(chunkData[12]), 2);
+                        memcpy(nBitsPerSample.raw, &(chunkData[14]), 2);
+                        if (verbose) {
+                            printf("         %dbits/sample\n", nBitsPerSample.data);
+                            printf("Block Align: %d\n", nBlockAlign.data);
+                        }
+                    }
+                    if (chunkSize.data >= 18) {
+                        memcpy(cbSize.raw, &(chunkData[16]), 2);
+                        if (verbose) {
+                            printf("cbSize: %d\n", cbSize.data);
+                        }
+                    }
+                    if (chunkSize.data >= 20) {
+                        memcpy(Samples.raw, &(chunkData[18]), 2);
+                        if (verbose) {
+                            printf("Samples: %d\n", Samples.data);
+                        }
+                    }
+                    if (chunkSize.data >= 24) {
+                        memcpy(dwChannelMask.raw, &(chunkData[20]), 4);
+                        if (verbose) {
+                            printf("dwChannelMask: 0x%08X\n", dwChannelMask.data);
+                        }
+                    }
+                    if (chunkSize.data >= 40) {
+                        memcpy(guid, &(chunkData[24]), 16);
+                        if (verbose) {
+                            printf("Rest data (possibly subformat GUID):\n");
+                            for (int tempctr=0; tempctr<16; tempctr++) {
+                                printf("%02X ", guid[tempctr]);
+                            }
                         }
-                        memcpy(wFormat.raw, chunkData, 2);
-                        memcpy(nChannels.raw, &(chunkData[2]), 2);
-                        memcpy(nSPS.raw, &(chunkData[4]), 4);
-                        memcpy(nBPS.raw, &(chunkData[8]), 4);
-                        nBytesPerSample = nBPS.data /  nSPS.data;
-                        
-                        switch (wFormat.data) {
+                        memcpy(subfmt.raw, guid, 4);
+                        printf("\n");
+                    }
+                    if (subfmt.data == 3) {
+                        wfmt = FLOAT_32;
+                    }
+                    nSingleSampleSize = nBytesPerSample / nChannels.data;
+                    if (wfmt != FLOAT_32) {
+                        if (verbose) {
+                            printf("Data type: ");
+                        }
+                        switch (nSingleSampleSize) {
                             case 1:
+                                wfmt = SIGNED_8;
                                 if (verbose) {
-                                    printf("Format: %d - Signed int (WAVE_FORMAT_PCM)\n", wFormat.data);
+                                    printf("Signed 8bit\n");
                                 }
-                                isUnsupported = false;
                                 break;
-                            case 3:
+                            case 2:
+                                wfmt = SIGNED_16;
                                 if (verbose) {
-                                    printf("Format: %d - Float (WAVE_FORMAT_IEEE_FLOAT)\n", wFormat.data);
+                                    printf("Signed 16bit\n");
                                 }
-                                isUnsupported = false;
-                                wfmt = FLOAT_32;
                                 break;
-                            case 7:
+                            case 3:
+                                wfmt = SIGNED_24;
                                 if (verbose) {
-                                    printf("Format: %d - μ-law (WAVE_FORMAT_MULAW)\n", wFormat.data);
+                                    printf("Signed 24bit\n");
                                 }
                                 break;
-                            case 65534:
+                            case 4:
+                                wfmt = SIGNED_32;
                                 if (verbose) {
-                                    printf("Format: %d - WAVEFORMATEXTENSIBLE\n", wFormat.data);
+                                    printf("Signed 32bit\n");
                                 }
-                                isUnsupported = false;
                                 break;
                             default:
+                                isUnsupported = true;
                                 if (verbose) {
-                                    printf("Format: %d - Unknown\n", wFormat.data);
+                                    printf("Unsupported\n");
                                 }
                                 break;
-                        }
-                        if (isUnsupported) {
-                            printf("Loader Warning: Unsupported data type\n");
-                        }
+                        };
                         if (verbose) {
-                            printf("Channels: %d\n", nChannels.data);
-                            printf("fs: %d\n", nSPS.data);
-                            printf("Bitrate: %dBytes/sec, %9.3fkbits/s\n", nBPS.data, (float)(nBPS.data*8)/1000.0);
-                            printf("         %dBytes/(sample*ch)\n", nBytesPerSample);
-                        }
-                        if (chunkSize.data >= 16) {
-                            memcpy(nBlockAlign.raw, &(chunkData[12]), 2);
-                            memcpy(nBitsPerSample.raw, &(chunkData[14]), 2);
-                            if (verbose) {
-                                printf("         %dbits/sample\n", nBitsPerSample.data);
-                                printf("Block Align: %d\n", nBlockAlign.data);
-                            }
-                        }
-                        if (chunkSize.data >= 18) {
-                            memcpy(cbSize.raw, &(chunkData[16]), 2);
-                            if (verbose) {
-                                printf("cbSize: %d\n", cbSize.data);
-                            }
-                        }
-                        if (chunkSize.data >= 20) {
-                            memcpy(Samples.raw, &(chunkData[18]), 2);
-                            if (verbose) {
-                                printf("Samples: %d\n", Samples.data);
-                            }
-                        }
-                        if (chunkSize.data >= 24) {
-                            memcpy(dwChannelMask.raw, &(chunkData[20]), 4);
-                            if (verbose) {
-                                printf("dwChannelMask: 0x%08X\n", dwChannelMask.data);
-                            }
-                        }
-                        if (chunkSize.data >= 40) {
-                            memcpy(guid, &(chunkData[24]), 16);
-                            if (verbose) {
-                                printf("Rest data (possibly subformat GUID):\n");
-                                for (int tempctr=0; tempctr<16; tempctr++) {
-                                    printf("%02X ", guid[tempctr]);
-                                }
-                            }
-                            memcpy(subfmt.raw, guid, 4);
                             printf("\n");
                         }
-                        if (subfmt.data == 3) {
-                            wfmt = FLOAT_32;
-                        }
-                        nSingleSampleSize = nBytesPerSample / nChannels.data;
-                        if (wfmt != FLOAT_32) {
-                            if (verbose) {
-                                printf("Data type: ");
-                            }
-                            switch (nSingleSampleSize) {
-                                case 1:
-                                    wfmt = SIGNED_8;
-                                    if (verbose) {
-                                        printf("Signed 8bit\n");
-                                    }
-                                    break;
-                                case 2:
-                                    wfmt = SIGNED_16;
-                                    if (verbose) {
-                                        printf("Signed 16bit\n");
-                                    }
-                                    break;
-                                case 3:
-                                    wfmt = SIGNED_24;
-                                    if (verbose) {
-                                        printf("Signed 24bit\n");
-                                    }
-                                    break;
-                                case 4:
-                                    wfmt = SIGNED_32;
-                                    if (verbose) {
-                                        printf("Signed 32bit\n");
-                                    }
-                                    break;
-                                default:
-                                    isUnsupported = true;
-                                    if (verbose) {
-                                        printf("Unsupported\n");
-                                    }
-                                    break;
-                            };
-                            if (verbose) {
-                                printf("\n");
-                            }
-                        } else {
-                            if (verbose) {
-                                printf("Data type: Float 32bit\n");
-                            }
+                    } else {
+                        if (verbose) {
+                            printf("Data type: Float 32bit\n");
                         }
-                        delete[] chunkData;
-                        continue;
                     }
-                    if (chunkID.find("data") != std::string::npos) {
-                        dataChunkPos = ftell(wFile);
-                        fseek(wFile, chunkSize.data, SEEK_CUR);
-                        dataChunkSize  = chunkSize.data;
+                    continue;
+                }
+                if (chunkID.find("smpl") != std::string::npos) {
+                    chunkBuffer.resize(chunkSize.data);
+                    char* chunkData = chunkBuffer.data();
+                    fread(chunkData, 1, chunkSize.data, wFile);
+                    // 36 bytes of sampler header, then 24 bytes per loop (first loop only)
+                    uint32_t loopCount = 0;
+                    if (chunkSize.data >= 36) {
+                        memcpy(&loopCount, &(chunkData[28]), 4);
+                    }
+                    if ((loopCount > 0) && (chunkSize.data >= 36+24)) {
+                        uint32_t smplStart = 0;
+                        uint32_t smplEnd = 0;
+                        memcpy(&smplStart, &(chunkData[36+8]), 4);
+                        memcpy(&smplEnd, &(chunkData[36+12]), 4);
+                        // the end point is inclusive
+                        loopStart = smplStart;
+                        loopEnd = smplEnd + 1;
+                        hasLoop = true;
                         if (verbose) {
-                            printf("Data chunk found - ");
-                            printf("Position: %ld\n", dataChunkPos);
+                            printf("Sampler chunk found - Loop: %u - %u\n", smplStart, smplEnd);
                         }
-                        continue;
                     }
-                    fseek(wFile, chunkSize.data, SEEK_CUR);
+                    continue;
+                }
+                if (chunkID.find("data") != std::string::npos) {
+                    dataChunkPos = waveTell64(wFile);
+                    dataChunkSize  = chunkSize.data;
+                    if (isRF64 && (chunkSize.data == 0xFFFFFFFF)) {
+                        dataChunkSize = ds64DataSize;
+                    }
+                    waveSeek64(wFile, dataChunkSize + (dataChunkSize & 1), SEEK_CUR);
+                    if (verbose) {
+                        printf("Data chunk found - ");
+                        printf("Position: %lld, Size: %llu\n", (long long)dataChunkPos, (unsigned long long)dataChunkSize);
+                    }
+                    continue;
+                }
+                // chunks are padded to an even size
+                waveSeek64(wFile, chunkSize.data + (chunkSize.data & 1), SEEK_CUR);
+            }
+            waveSeek64(wFile, dataChunkPos, SEEK_SET);
+            if (hasLoop && ((nBytesPerSample == 0) || (loopEnd > getFrameCount()) || (loopStart >= loopEnd))) {
+                if (verbose) {
+                    printf("Loop region %llu - %llu is out of the data, ignored.\n",
+                           (unsigned long long)loopStart, (unsigned long long)loopEnd);
                 }
-                fseek(wFile, dataChunkPos, SEEK_SET);
-                tempRawData = new char[nBytesPerSample];
-                //printf("DEBUG:\n  tempRawData: %p\n", tempRawData);
+                hasLoop = false;
+            }
+            return true;
+        }
+
+    public:
+        WaveFile(){}
+        // serve a complete decoded buffer without opening the file
+        WaveFile(const std::shared_ptr<DecodedPcm>& cached) {
+            reopen(cached);
+        }
+        // open for reading with the chunk walk already done (header from WaveIndex)
+        WaveFile(std::string fileName, const WaveHeader& header) {
+            reopen(fileName, header);
+        }
+        WaveFile(std::string fileName, std::string mode, bool verbose=false) {
+            if ((mode.find('r') == std::string::npos) && (mode.find('w') != std::string::npos)) {
+                wFile = fopen(fileName.c_str(), "wb");
+                isClosed = !wFile;
+                return;
             }
+            reopen(fileName, verbose);
         }
         virtual ~WaveFile() {
-            if (!isClosed && wFile) {
-                //printf("DEBUG (to close):\n  wFile: %p\n", wFile);
+            if (wFile) {
                 fclose(wFile);
+            }
+            if (spareFile) {
+                fclose(spareFile);
+            }
+            delete[] tempRawData;
+            delete[] ioBuffer;
+        }
+
+        // read another file with this object. the FILE object (freopen), the stdio buffer
+        // and the sample / chunk buffers are reused, so once they are sized a file change
+        // does not allocate (see ReaderPool).
+        bool reopen(const std::string& fileName, bool verbose=false) {
+            resetState();
+            if (!openStream(fileName)) {
                 isClosed = true;
+                return false;
             }
-            if (tempRawData) {
-                //printf("DEBUG (to free):\n  tempRawData: %p\n", tempRawData);
-                delete[] tempRawData;
+            bool parsed = parseChunks(verbose);
+            reserveRawBuffer();
+            return parsed;
+        }
+        bool reopen(const std::string& fileName, const WaveHeader& header) {
+            resetState();
+            if (!header.valid || (header.channels == 0) || !openStream(fileName)) {
+                isClosed = true;
+                return false;
+            }
+            if (waveSeek64(wFile, header.dataOffset, SEEK_SET) != 0) {
+                closeStream();
+                isClosed = true;
+                errorStatus = true;
+                return false;
             }
+            dataChunkPos = header.dataOffset;
+            dataChunkSize = header.dataSize;
+            isRF64 = header.isRF64;
+            nChannels.data = header.channels;
+            nSPS.data = header.fs;
+            nBytesPerSample = header.bytesPerFrame;
+            nSingleSampleSize = nBytesPerSample / header.channels;
+            wfmt = header.format;
+            hasLoop = header.hasLoop;
+            loopStart = header.loopStart;
+            loopEnd = header.loopEnd;
+            isWAVE = true;
+            isUnsupported = false;
+            reserveRawBuffer();
+            return true;
+        }
+        bool reopen(const std::shared_ptr<DecodedPcm>& cached) {
+            resetState();
+            // the FILE object is kept for the next reopen from a file
+            if (wFile) {
+                if (spareFile) {
+                    fclose(spareFile);
+                }
+                spareFile = wFile;
+                wFile = nullptr;
+            }
+            if (!cached || !cached->isComplete()) {
+                isClosed = true;
+                return false;
+            }
+            pcm = cached;
+            nChannels.data = pcm->channels;
+            nSPS.data = pcm->fs;
+            nBytesPerSample = pcm->bytesPerFrame;
+            nSingleSampleSize = nBytesPerSample / pcm->channels;
+            wfmt = pcm->format;
+            dataChunkSize = pcm->frames*nBytesPerSample;
+            hasLoop = pcm->hasLoop;
+            loopStart = pcm->loopStart;
+            loopEnd = pcm->loopEnd;
+            isWAVE = true;
+            isUnsupported = false;
+            return true;
+        }
+        // drop the decoded buffer (an idle reader must not keep it alive)
+        void detachDecodedPcm() {
+            pcm.reset();
         }
         void abortRequest() {
             abortreq = true;
@@ -350,53 +704,26 @@ class WaveFile {
             return (int)nChannels.data;
         }
         uint32_t read(float* dest, uint32_t length) {
-            if (!wFile) {
-                return 0;
-            }
-            WaveData wData;
-            size_t readCount = 0;
-            size_t readSize = 0;
-            float tempData = 0;
-            if (!tempRawData) {
-                return 0;
-            }
-            for (uint32_t ctr=0; (ctr<length) && !isEndOfFile(); ctr++) {
-                if (readSizeCount >= dataChunkSize) {
-                    isWaveDataEnd = true;
-                    break;
+            uint32_t readCount = 0;
+            uint64_t frame = getPositionFrames();
+            if (pcm && (frame < pcm->validFrames)) {
+                uint64_t available = pcm->validFrames - frame;
+                readCount = (length < available) ? length : (uint32_t)available;
+                memcpy(dest, &(pcm->data[frame*pcm->channels]), sizeof(float)*readCount*pcm->channels);
+                readSizeCount += (uint64_t)readCount*nBytesPerSample;
+                fileSynced = false;
+                if (readCount == length) {
+                    return readCount;
                 }
-                readSize = fread(tempRawData, 1, nBytesPerSample, wFile);
-                if (readSize == 0) {
-                    break;
-                }
-                readSizeCount += readSize;
-                for (int chCount=0; chCount<nChannels.data; chCount++) {
-                    memcpy(wData.s8, &(tempRawData[chCount*nSingleSampleSize]), nSingleSampleSize);
-                    switch (wfmt) {
-                        case SIGNED_8:
-                        tempData = (float)wData.s8[0] / 128.0;
-                            break;
-                        case SIGNED_16:
-                            tempData = (float)wData.s16[0] / 32768.0;
-                            break;
-                        case SIGNED_24:
-                            tempData = (float)(wData.s32 << 8) / 2147483648.0;
-                            break;
-                        case SIGNED_32:
-                            tempData = (float)(wData.s32) / 2147483648.0;
-                            break;
-                        case FLOAT_32:
-                            tempData = wData.f32;
-                            break;
-                        default:
-                            tempData = 0.0;
-                            break;
-                    }
-                    dest[(ctr*nChannels.data)+chCount] = tempData;
-                }
-                readCount++;
+                frame += readCount;
             }
-            return readCount;
+            uint32_t fileCount = readFromFile(&(dest[readCount*nChannels.data]), length-readCount);
+            if (pcm && (frame == pcm->validFrames) && (frame + fileCount <= pcm->frames)) {
+                memcpy(&(pcm->data[frame*pcm->channels]), &(dest[readCount*nChannels.data]),
+                       sizeof(float)*fileCount*pcm->channels);
+                pcm->validFrames += fileCount;
+            }
+            return readCount + fileCount;
         }
         uint32_t write(float* src, uint32_t length) {
             if (!wFile) {
@@ -404,17 +731,27 @@ class WaveFile {
             }
             return fwrite(src, nBytesPerSample, length, wFile);
         }
-        uint32_t getDataSize() {
+        uint64_t getDataSize() {
             return dataChunkSize; 
         }
-        uint32_t getPosition() {
+        uint64_t getPosition() {
             return readSizeCount;
         }
+        uint64_t getFrameCount() {
+            return (nBytesPerSample > 0) ? dataChunkSize / nBytesPerSample : 0;
+        }
+        // decode (read) position in frames
+        uint64_t getPositionFrames() {
+            return readSizeCount / nBytesPerSample;
+        }
         float getPositionInSeconds(){
-            return (float)(readSizeCount / (nBytesPerSample)) / nSPS.data;
+            return (float)((double)(readSizeCount / (nBytesPerSample)) / nSPS.data);
         }
         float getLengthInSeconds() {
-            return (float)(dataChunkSize / (nBytesPerSample)) / nSPS.data;
+            return (float)((double)(dataChunkSize / (nBytesPerSample)) / nSPS.data);
+        }
+        bool isRF64File() {
+            return isRF64;
         }
         bool isFileOpened() {
             return isClosed ? false : true;
@@ -426,6 +763,9 @@ class WaveFile {
             return isWAVE;
         }
         bool isEndOfFile() {
+            if (!wFile) {
+                return getPositionFrames() >= getFrameCount();
+            }
             if (feof(wFile) != 0) {
                 return true;
             }
@@ -435,10 +775,95 @@ class WaveFile {
             return isWaveDataEnd;
         }
         void rewind() {
-            fseek(wFile, dataChunkPos, SEEK_SET);
+            if (wFile) {
+                waveSeek64(wFile, dataChunkPos, SEEK_SET);
+                fileSynced = true;
+            }
             readSizeCount = 0;
             isWaveDataEnd = false;
         }
+        // move the decode position to frame (clamped to the end of data)
+        bool seekFrame(uint64_t frame) {
+            if (nBytesPerSample == 0) {
+                return false;
+            }
+            if (frame > getFrameCount()) {
+                frame = getFrameCount();
+            }
+            if (pcm && (frame < pcm->validFrames)) {
+                // served from memory: the file is repositioned when it is read next
+                fileSynced = false;
+            } else if (wFile) {
+                if (waveSeek64(wFile, dataChunkPos + (int64_t)(frame*nBytesPerSample), SEEK_SET) != 0) {
+                    return false;
+                }
+                fileSynced = true;
+            } else {
+                return false;
+            }
+            readSizeCount = frame*nBytesPerSample;
+            isWaveDataEnd = false;
+            return true;
+        }
+
+        // loop region [start, end) in frames; replaces the one from the smpl chunk
+        bool setLoopRegion(uint64_t start, uint64_t end) {
+            if ((start >= end) || (end > getFrameCount())) {
+                return false;
+            }
+            loopStart = start;
+            loopEnd = end;
+            hasLoop = true;
+            return true;
+        }
+        void clearLoopRegion() {
+            hasLoop = false;
+        }
+        // keep the decoded samples in buffer (sized getFrameCount() x getChannels()) while
+        // the file is read from the top; the format is stored with them
+        bool recordTo(const std::shared_ptr<DecodedPcm>& buffer) {
+            if (!buffer || (buffer->frames != getFrameCount()) || (buffer->channels != (uint32_t)getChannels())
+                || (readSizeCount != 0) || isUnsupported) {
+                return false;
+            }
+            buffer->validFrames = 0;
+            buffer->fs = nSPS.data;
+            buffer->bytesPerFrame = nBytesPerSample;
+            buffer->format = wfmt;
+            buffer->hasLoop = hasLoop;
+            buffer->loopStart = loopStart;
+            buffer->loopEnd = loopEnd;
+            pcm = buffer;
+            return true;
+        }
+        std::shared_ptr<DecodedPcm> getDecodedPcm() {
+            return pcm;
+        }
+        // format and data location found when the file was opened (mtime is left as is)
+        void getHeader(WaveHeader& header) {
+            header.valid = isWAVE && !isUnsupported && !errorStatus && (nBytesPerSample > 0)
+                           && (nChannels.data > 0) && (dataChunkPos > 0);
+            header.format = wfmt;
+            header.channels = nChannels.data;
+            header.fs = nSPS.data;
+            header.bytesPerFrame = nBytesPerSample;
+            header.dataOffset = dataChunkPos;
+            header.dataSize = dataChunkSize;
+            header.isRF64 = isRF64;
+            header.hasLoop = hasLoop;
+            header.loopStart = loopStart;
+            header.loopEnd = loopEnd;
+        }
+
+        bool hasLoopRegion() {
+            return hasLoop;
+        }
+        uint64_t getLoopStart() {
+            return loopStart;
+        }
+        uint64_t getLoopEnd() {
+            return loopEnd;
+        }
 };
 
 #endif
@@ -0,0 +1,291 @@
+#ifndef WAVE_WRITER_H_INCLUDED
+#define WAVE_WRITER_H_INCLUDED
+
+#include "stdint.h"
+#include "stdlib.h"
+#include "stdio.h"
+#include "string.h"
+#include "math.h"
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+#include "WaveLoader.hpp"
+
+// Streaming WAVE writer.
+// The header is written with placeholder sizes and a 28-byte JUNK chunk reserved
+// for "ds64"; updateHeader() patches the sizes (call it periodically so that a
+// crash leaves a readable file) and switches the file to RF64 once the data
+// chunk exceeds the 32-bit limit. Samples are converted into an internal batch
+// buffer which is written with one fwrite() when full.
+// Use from one thread; only getWrittenBytes() / getWrittenSeconds() / isRF64Written()
+// may be called from others (e.g. a display) while it writes.
+class WaveWriter {
+    private:
+        FILE* wFile = nullptr;
+        uint32_t fs = 48000;
+        uint16_t nChannels = 2;
+        WF_Format wfmt = FLOAT_32;
+        uint32_t sampleBytes = 4;
+        uint64_t dataSize = 0;
+        long dataSizePos = 0;
+        long junkPos = 0;
+        long dataStartPos = 0;
+        bool isRF64 = false;
+        bool writeError = false;
+        std::vector<uint8_t> batch;
+        size_t batchFill = 0;
+        // published for other threads
+        std::atomic<uint64_t> writtenBytes{0};
+        std::atomic<bool> writtenRF64{false};
+
+        static constexpr uint64_t riffLimit = 0xFFFFFFFFULL;
+        static constexpr uint32_t ds64Size = 28;
+
+        static void putU16(uint8_t* dest, uint16_t value) {
+            dest[0] = value & 0xFF;
+            dest[1] = (value >> 8) & 0xFF;
+        }
+        static void putU32(uint8_t* dest, uint32_t value) {
+            for (int ctr=0; ctr<4; ctr++) {
+                dest[ctr] = (value >> (8*ctr)) & 0xFF;
+            }
+        }
+        static void putU64(uint8_t* dest, uint64_t value) {
+            for (int ctr=0; ctr<8; ctr++) {
+                dest[ctr] = (value >> (8*ctr)) & 0xFF;
+            }
+        }
+
+        bool writeHeader() {
+            // RIFF (12) + JUNK (36) + fmt (26 for float) + data (8)
+            uint8_t header[96] = {};
+            size_t pos = 0;
+            uint16_t formatTag = (wfmt == FLOAT_32) ? 3 : 1;
+            uint32_t fmtSize = (wfmt == FLOAT_32) ? 18 : 16;
+            memcpy(&(header[pos]), "RIFF", 4);
+            pos += 8; // size: patched later
+            memcpy(&(header[pos]), "WAVE", 4);
+            pos += 4;
+            junkPos = pos;
+            memcpy(&(header[pos]), "JUNK", 4);
+            putU32(&(header[pos+4]), ds64Size);
+            pos += 8 + ds64Size;
+            memcpy(&(header[pos]), "fmt ", 4);
+            putU32(&(header[pos+4]), fmtSize);
+            putU16(&(header[pos+8]), formatTag);
+            putU16(&(header[pos+10]), nChannels);
+            putU32(&(header[pos+12]), fs);
+            putU32(&(header[pos+16]), fs*nChannels*sampleBytes);
+            putU16(&(header[pos+20]), nChannels*sampleBytes);
+            putU16(&(header[pos+22]), sampleBytes*8);
+            pos += 8 + fmtSize; // cbSize (float) stays 0
+            memcpy(&(header[pos]), "data", 4);
+            dataSizePos = pos + 4;
+            pos += 8;
+            dataStartPos = pos;
+            return fwrite(header, 1, pos, wFile) == pos;
+        }
+
+        void convert(const float* src, uint8_t* dest, size_t samples) {
+            for (size_t ctr=0; ctr<samples; ctr++) {
+                float value = src[ctr];
+                if (wfmt == FLOAT_32) {
+                    memcpy(&(dest[ctr*4]), &value, 4);
+                    continue;
+                }
+                if (value > 1.0f) {
+                    value = 1.0f;
+                } else if (value < -1.0f) {
+                    value = -1.0f;
+                }
+                switch (wfmt) {
+                    case SIGNED_16: {
+                        int32_t sample = (int32_t)lrintf(value*32767.0f);
+                        putU16(&(dest[ctr*2]), (uint16_t)(int16_t)sample);
+                        break;
+                    }
+                    case SIGNED_24: {
+                        int32_t sample = (int32_t)lrint((double)value*8388607.0);
+                        dest[ctr*3] = sample & 0xFF;
+                        dest[ctr*3+1] = (sample >> 8) & 0xFF;
+                        dest[ctr*3+2] = (sample >> 16) & 0xFF;
+                        break;
+                    }
+                    case SIGNED_32: {
+                        int32_t sample = (int32_t)llrint((double)value*2147483647.0);
+                        putU32(&(dest[ctr*4]), (uint32_t)sample);
+                        break;
+                    }
+                    default:
+                        break;
+                }
+            }
+        }
+
+        bool flushBatch() {
+            if (batchFill == 0) {
+                return true;
+            }
+            if (fwrite(batch.data(), 1, batchFill, wFile) != batchFill) {
+                writeError = true;
+            }
+            dataSize += batchFill;
+            batchFill = 0;
+            return !writeError;
+        }
+
+    public:
+        // format: SIGNED_16, SIGNED_24, SIGNED_32 or FLOAT_32
+        WaveWriter(std::string fileName, uint32_t fSample, uint16_t channels,
+                   WF_Format format=FLOAT_32, size_t batchBytes=1024*1024) {
+            fs = fSample;
+            nChannels = channels;
+            wfmt = format;
+            switch (wfmt) {
+                case SIGNED_16:
+                    sampleBytes = 2;
+                    break;
+                case SIGNED_24:
+                    sampleBytes = 3;
+                    break;
+                case SIGNED_32:
+                    sampleBytes = 4;
+                    break;
+                default:
+                    wfmt = FLOAT_32;
+                    sampleBytes = 4;
+                    break;
+            }
+            wFile = fopen(fileName.c_str(), "wb");
+            if (!wFile) {
+                return;
+            }
+            // keep batches frame aligned
+            size_t frameBytes = (size_t)nChannels*sampleBytes;
+            batch.resize(((batchBytes / frameBytes) + 1)*frameBytes);
+            if (!writeHeader()) {
+                writeError = true;
+            }
+        }
+        virtual ~WaveWriter() {
+            close();
+        }
+
+        bool isFileOpened() {
+            return wFile != nullptr;
+        }
+        bool isError() {
+            return writeError;
+        }
+        bool isRF64File() {
+            return isRF64;
+        }
+
+        // src: interleaved float samples, returns frames accepted
+        uint32_t write(const float* src, uint32_t frames) {
+            if (!wFile) {
+                return 0;
+            }
+            size_t frameBytes = (size_t)nChannels*sampleBytes;
+            uint32_t done = 0;
+            while (done < frames) {
+                size_t room = (batch.size() - batchFill) / frameBytes;
+                if (room == 0) {
+                    flushBatch();
+                    continue;
+                }
+                uint32_t count = frames - done;
+                if (count > room) {
+                    count = room;
+                }
+                convert(&(src[(size_t)done*nChannels]), &(batch[batchFill]), (size_t)count*nChannels);
+                batchFill += (size_t)count*frameBytes;
+                done += count;
+            }
+            writtenBytes.store(dataSize + batchFill, std::memory_order_relaxed);
+            return done;
+        }
+
+        // write out buffered samples and patch the RIFF / data (or ds64) sizes
+        bool updateHeader() {
+            if (!wFile) {
+                return false;
+            }
+            flushBatch();
+            uint64_t riffSize = (uint64_t)dataStartPos - 8 + dataSize + (dataSize & 1);
+            int64_t endPos = waveTell64(wFile);
+            uint8_t value[ds64Size] = {};
+            if (!isRF64 && (riffSize > riffLimit)) {
+                // switch to RF64: RIFF -> RF64, JUNK -> ds64
+                isRF64 = true;
+                writtenRF64.store(true, std::memory_order_relaxed);
+                fseek(wFile, 0, SEEK_SET);
+                fwrite("RF64", 1, 4, wFile);
+                fseek(wFile, junkPos, SEEK_SET);
+                fwrite("ds64", 1, 4, wFile);
+            }
+            if (isRF64) {
+                putU32(value, 0xFFFFFFFF);
+                fseek(wFile, 4, SEEK_SET);
+                fwrite(value, 1, 4, wFile);
+                fseek(wFile, dataSizePos, SEEK_SET);
+                fwrite(value, 1, 4, wFile);
+                putU64(value, riffSize);
+                putU64(&(value[8]), dataSize);
+                putU64(&(value[16]), dataSize / ((uint64_t)nChannels*sampleBytes));
+                putU32(&(value[24]), 0);
+                fseek(wFile, junkPos+8, SEEK_SET);
+                fwrite(value, 1, ds64Size, wFile);
+            } else {
+                putU32(value, (uint32_t)riffSize);
+                fseek(wFile, 4, SEEK_SET);
+                fwrite(value, 1, 4, wFile);
+                putU32(value, (uint32_t)dataSize);
+                fseek(wFile, dataSizePos, SEEK_SET);
+                fwrite(value, 1, 4, wFile);
+            }
+            waveSeek64(wFile, endPos, SEEK_SET);
+            if (fflush(wFile) != 0) {
+                writeError = true;
+            }
+            return !writeError;
+        }
+
+        void close() {
+            if (!wFile) {
+                return;
+            }
+            flushBatch();
+            if (dataSize & 1) {
+                fputc(0, wFile); // pad byte
+            }
+            updateHeader();
+            fclose(wFile);
+            wFile = nullptr;
+        }
+
+        uint64_t getDataSize() {
+            return dataSize + batchFill;
+        }
+        uint64_t getFrameCount() {
+            return getDataSize() / ((uint64_t)nChannels*sampleBytes);
+        }
+        double getLengthInSeconds() {
+            return (double)getFrameCount() / (double)fs;
+        }
+
+        // from any thread: bytes accepted by write() so far / their length / RF64 switch
+        uint64_t getWrittenBytes() {
+            return writtenBytes.load(std::memory_order_relaxed);
+        }
+        double getWrittenSeconds() {
+            return (double)(getWrittenBytes() / ((uint64_t)nChannels*sampleBytes)) / (double)fs;
+        }
+        bool isRF64Written() {
+            return writtenRF64.load(std::memory_order_relaxed);
+        }
+};
+
+#endif
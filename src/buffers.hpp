@@ -2,6 +2,7 @@
 #define BUFFERS_H_INCLUDED
 #include "stdint.h"
 #include <cstring>
+#include <atomic>
 #include <mutex>
 #include <thread>
 #include <vector>
@@ -19,7 +20,7 @@ template <typename DTYPE> class ring_buffer {
         uint32_t read_start_idx = 0;
         std::mutex mx_buf_guard;
         uint32_t nl_sz_cur = 0;
-        uint32_t stored_length = 0;
+        std::atomic<uint32_t> stored_length{0};
         bool nl_allocated = false;
         void put_data_nolock(DTYPE data){
             buffer_arr[h_idx] = data;
@@ -59,7 +60,16 @@ template <typename DTYPE> class ring_buffer {
             return read_start_idx;
         }
         uint32_t get_stored_length(){
-            return stored_length;
+            return stored_length.load(std::memory_order_acquire);
+        }
+        void prefault(){
+            // write every page of the storage so that it is resident before streaming
+            if (buffer_arr) {
+                std::memset(buffer_arr, 0, blength*sizeof(DTYPE));
+            }
+            if (buf_ret_dest) {
+                std::memset(buf_ret_dest, 0, blength*sizeof(DTYPE));
+            }
         }
         void init_buffer(){
             if (!buffer_arr) {
@@ -94,17 +104,20 @@ template <typename DTYPE> class ring_buffer {
                 put_data_queue(data_arr[tempctr]);
             }
         }
-        void put_data_memcpy(DTYPE* data_arr, uint32_t length) {
-            std::lock_guard<std::mutex> buf_aput_lock(mx_buf_guard);
+        // put_data_memcpy() and get_data_memcpy(dest, length) form a lock-free
+        // single-producer / single-consumer pair: no lock, no allocation.
+        uint32_t put_data_memcpy(DTYPE* data_arr, uint32_t length) {
             if (!buffer_arr) {
-                return;
+                return 0;
             }
-            uint32_t ac_length = length;
+            uint32_t space = blength - stored_length.load(std::memory_order_acquire);
             uint32_t length_capped = length;
+            uint32_t ac_length = 0;
             uint32_t remains = 0;
-            if (length > blength) {
-                length_capped = blength;
+            if (length_capped > space) {
+                length_capped = space;
             }
+            ac_length = length_capped;
             if ((h_idx+length_capped) >= blength) {
                 ac_length = blength - h_idx;
                 remains = length_capped - ac_length;
@@ -115,11 +128,8 @@ template <typename DTYPE> class ring_buffer {
                 memcpy(&(buffer_arr[h_idx]), &(data_arr[ac_length]), remains*sizeof(DTYPE));
                 h_idx = remains;
             }
-            if (stored_length+length_capped > blength) {
-                stored_length = blength;
-            } else {
-                stored_length += length_capped;
-            }
+            stored_length.fetch_add(length_capped, std::memory_order_release);
+            return length_capped;
         }
         DTYPE get_data_single(){
             std::lock_guard<std::mutex> buf_sget_lock(mx_buf_guard);
@@ -180,40 +190,46 @@ template <typename DTYPE> class ring_buffer {
             read_start_idx = temp_idx;
             return ret_nl_dest;
         }
-        DTYPE* get_data_memcpy(uint32_t length) {
-            std::lock_guard<std::mutex> buf_nget_lock(mx_buf_guard);
+        uint32_t get_data_memcpy(DTYPE* dest, uint32_t length) {
             if (!buffer_arr) {
-                return nullptr;
-            }
-            if (nl_sz_cur != length) {
-                if (nl_allocated) {
-                    delete[] ret_nl_dest;
-                }
-                ret_nl_dest = new DTYPE[length];
-                nl_allocated = true;
-                nl_sz_cur = length;
+                return 0;
             }
-            uint32_t ac_length = length;
+            uint32_t avail = stored_length.load(std::memory_order_acquire);
             uint32_t length_capped = length;
+            uint32_t ac_length = 0;
             uint32_t remains = 0;
-            if (length > blength) {
-                length_capped = blength;
+            if (length_capped > avail) {
+                length_capped = avail;
             }
+            ac_length = length_capped;
             if ((read_start_idx+length_capped) >= blength) {
                 ac_length = blength - read_start_idx;
                 remains = length_capped - ac_length;
             }
-            memcpy(ret_nl_dest, &(buffer_arr[read_start_idx]), ac_length*sizeof(DTYPE));
+            memcpy(dest, &(buffer_arr[read_start_idx]), ac_length*sizeof(DTYPE));
             read_start_idx = (read_start_idx+ac_length) % blength;
             if (remains != 0) {
-                memcpy(&(ret_nl_dest[ac_length]), &(buffer_arr[read_start_idx]), remains*sizeof(DTYPE));
+                memcpy(&(dest[ac_length]), &(buffer_arr[read_start_idx]), remains*sizeof(DTYPE));
                 read_start_idx = remains;
             }
-            if (stored_length >= length_capped) {
-                stored_length -= length_capped;
-            } else {
-                stored_length = 0;
+            stored_length.fetch_sub(length_capped, std::memory_order_release);
+            return length_capped;
+        }
+        // returns an internal buffer which is (re)allocated when length changes: not for RT use
+        DTYPE* get_data_memcpy(uint32_t length) {
+            std::lock_guard<std::mutex> buf_nget_lock(mx_buf_guard);
+            if (!buffer_arr) {
+                return nullptr;
+            }
+            if (nl_sz_cur != length) {
+                if (nl_allocated) {
+                    delete[] ret_nl_dest;
+                }
+                ret_nl_dest = new DTYPE[length];
+                nl_allocated = true;
+                nl_sz_cur = length;
             }
+            get_data_memcpy(ret_nl_dest, length);
             return ret_nl_dest;
         }
         DTYPE* get_data_array(uint32_t& hidx_dest){
@@ -11,32 +11,35 @@
 #include <vector>
 #include <filesystem>
 #include <algorithm>
+#include <thread>
+#include <chrono>
 
 //#include "nlohmann/json.hpp"
 
 #include "AudioManipulator.hpp"
 #include "WaveLoader.hpp"
 #include "MatrixFader.hpp"
-
-class GaplessLooper : public WaveFile {
-    public:
-        GaplessLooper(std::string fileName, bool verbose=false): WaveFile(fileName, "r", verbose) {}
-        uint32_t prepareFrame(float* dest, uint32_t chunkLength, bool noloop=false) {
-            if (!isFileOpened()) {
-                return 0;
-            }
-            uint32_t readLength = 0;
-            readLength = read(dest, chunkLength);
-            if (noloop) {
-                return readLength;
-            }
-            if (readLength < chunkLength) {
-                rewind();
-                readLength = read(&(dest[readLength*getChannels()]), chunkLength-readLength);
-            }
-            return chunkLength;
-        }
-};
+#include "LevelMeter.hpp"
+#include "RealtimeThread.hpp"
+#include "DenormalGuard.hpp"
+#include "Benchmark.hpp"
+#include "LatencyCalibrator.hpp"
+#include "WaveWriter.hpp"
+#include "LatencyProbe.hpp"
+#include "MultiOutput.hpp"
+#include "GaplessLooper.hpp"
+#include "MixEngine.hpp"
+#include "CueScheduler.hpp"
+#include "PcmCache.hpp"
+#include "LibraryScan.hpp"
+#include "Playlist.hpp"
+#include "ReaderPool.hpp"
+#include "FilePrefetcher.hpp"
+#include "Crossfade.hpp"
+#include "LoudnessAnalyzer.hpp"
+#include "DspChain.hpp"
+#include "BiquadBank.hpp"
+#include "Limiter.hpp"
 
 std::atomic<bool> KeyboardInterrupt;
 GaplessLooper* curWF = nullptr;
@@ -151,13 +154,23 @@ void printRatBar(double fillLength, double maxLength,
 }
 
 void showHelp() {
-    printf("args:\n--help, --list-devices, --loadonly, --verbose, --noloop,\n"
-           "--output-device, --chunklength, --rblength, --file, --directory\n\n");
+    printf("args:\n--help, --list-devices, --loadonly, --verbose, --noloop, --truepeak,\n"
+           "--output-device, --chunklength, --rblength, --file, --directory,\n"
+           "--rt-priority, --rt-policy, --cpu-affinity, --mlock, --benchmark,\n"
+           "--frames-per-buffer, --latency, --calibrate-latency, --soak, --latency-profile,\n"
+           "--rb-auto, --rb-max, --rb-quiet,\n"
+           "--record, --input-device, --record-channels, --record-rate, --record-format,\n"
+           "--measure-latency, --measure-count, --probe-signal, --loopback-delay, --sync-devices,\n"
+           "--mix, --mix-threads, --cue, --cache-size, --index, --no-index,\n"
+           "--scan-threads, --playlist, --shuffle, --repeat, --crossfade, --trim-silence,\n"
+           "--trim-threshold, --normalize, --target-loudness, --eq, --limit, --limit-ceiling,\n"
+           "--limit-lookahead, --limit-release\n\n");
     printf("--help                        : Show this help\n"
            "--list-devices                : Show sound devices and exit.\n"
            "--loadonly                    : Only load wave file (and exit without playing).\n"
            "--noloop                      : Don't loop file if set.\n"
            "--verbose                     : Show additional information.\n"
+           "--truepeak                    : Show 4x oversampled true-peak level.\n"
            "--output-device <index: int>  : Set sound output device to device No.<index>.\n"
            "                                index can be retrieved with function --list-devices.\n"
            "--chunklength <length: int>   : Set chunk length to <length>.\n"
@@ -165,34 +178,529 @@ void showHelp() {
            "                                detail: chunklength = (the number of sample) * (the number of audio channel)\n"
            "--rblength <length: int>      : Set ring buffer length to <length>.\n"
            "                                at least (chunklength * 2) shuld be set.\n"
+           "--rb-auto                     : Grow the ring buffer while playing when underruns occur,\n"
+           "                                and shrink it back to --rblength after a quiet period.\n"
+           "--rb-max <length: int>        : Upper limit for --rb-auto. (default: rblength * 16)\n"
+           "--rb-quiet <sec: float>       : Quiet period before --rb-auto shrinks the buffer. (default: 30)\n"
            "--file <filename: str>        : Set file name to load.\n"
-           "--directory <directory: str>  : Set directory to load.\n"
+           "--directory <directory: str>  : Set directory to load. (subdirectories included)\n"
+           "--cache-size <MB: int>        : Memory budget for decoded files kept for loops and playlist passes.\n"
+           "                                0 disables the cache. (default: 256)\n"
+           "--index <file: str>           : Header index file for --directory. (default: <directory>/.wpindex)\n"
+           "--no-index                    : Parse every file of --directory without reading / writing the index.\n"
+           "--scan-threads <n: int>       : Threads to scan --directory. (default: CPU count * 2)\n"
+           "--playlist <file: str>        : Play the files listed in <file>. (M3U / M3U8 / one path per line)\n"
+           "--shuffle                     : Play --directory / --playlist in random order.\n"
+           "--repeat <off|one|all>        : Repeat mode of --directory / --playlist. (default: all, off with --noloop)\n"
+           "--crossfade <sec: float>      : Equal-power crossfade between the files of --directory / --playlist.\n"
+           "                                (default: 0, gapless)\n"
+           "--trim-silence                : Skip the silence at the head and tail of the files of --directory.\n"
+           "                                (found once and kept in the index)\n"
+           "--trim-threshold <dBFS: float>: Level below which --trim-silence treats samples as silence. (default: -80)\n"
+           "--normalize                   : Play the files of --directory at the same loudness (BS.1770 / EBU R128).\n"
+           "                                analysed on all cores after the scan and kept in the index.\n"
+           "                                files not analysed yet are played as they are.\n"
+           "--target-loudness <LUFS: float>: Loudness for --normalize. (default: -18)\n"
+           "--eq <ch:type:freq[:gain[:q]]>: Add an EQ band to channel <ch> (1-, or all) of the output.\n"
+           "                                type: peak, lowshelf, highshelf, lowpass, highpass. (gain in dB,\n"
+           "                                default q: 0.7071) up to 8 bands per channel, may be repeated.\n"
+           "--limit                       : Limit the output to --limit-ceiling (look-ahead true-peak limiter).\n"
+           "--limit-ceiling <dBTP: float> : Ceiling of --limit. (default: -1)\n"
+           "--limit-lookahead <msec: float>: Look-ahead (and delay) of --limit. (default: 5)\n"
+           "--limit-release <msec: float> : Release time of --limit. (default: 100)\n"
+           "--rt-priority <prio: int>     : Run the decode thread with real-time scheduling at <prio>.\n"
+           "--rt-policy <fifo|rr>         : Real-time scheduling policy. (default: fifo)\n"
+           "--cpu-affinity <cpus: str>    : Pin the decode thread to <cpus>. (e.g. 2,3 or 0-3)\n"
+           "--mlock                       : Lock memory (mlockall) and prefault audio buffers.\n"
+           "--benchmark <name: str>       : Run benchmark <name> and exit. (denormal, sync, streams, rf64,\n"
+           "                                transitions, dsp, biquad, limiter)\n"
+           "--frames-per-buffer <n: int>  : Set the device callback buffer size. (default: chosen by PortAudio)\n"
+           "--latency <msec: float>       : Set the suggested output latency. (default: chunklength / fs)\n"
+           "--calibrate-latency           : Search the lowest stable buffer size / latency and exit.\n"
+           "                                uses --file (looped) as the source, or silence if not set.\n"
+           "--soak <sec: float>           : Soak time for each calibration step. (default: 5)\n"
+           "--latency-profile <file: str> : Store calibration results to <file>,\n"
+           "                                and use the stored setting of the device for playback.\n"
+           "--record <filename: str>      : Record from the input device to <filename> until Ctrl+C.\n"
+           "                                switches to RF64 when the file exceeds 4 GB.\n"
+           "--input-device <index: int>   : Set sound input device for --record. (default: 0)\n"
+           "--record-channels <n: int>    : Number of channels to record. (default: 2)\n"
+           "--record-rate <fs: float>     : Sampling rate to record. (default: device default)\n"
+           "--record-format <16|24|32|f32>: Sample format of the recorded file. (default: 24)\n"
+           "--measure-latency             : Measure the round-trip latency from --output-device to --input-device\n"
+           "                                with a duplex stream and exit. (needs a loopback cable)\n"
+           "--measure-count <n: int>      : Number of measurements. (default: 10)\n"
+           "--probe-signal <mls|impulse>  : Test signal for --measure-latency. (default: mls)\n"
+           "--loopback-delay <n: int>     : Measure a software loopback of <n> frames instead of the hardware.\n"
+           "--sync-devices <list: str>    : Play on several output devices in sync. (e.g. 0,3)\n"
+           "                                the first device is the clock master, the others are resampled to follow it.\n"
+           "--mix <filename: str>         : Add <filename> to the mix. (repeat to play many files at once)\n"
+           "--mix-threads <n: int>        : Decode threads for --mix. (default: one per CPU)\n"
+           "--cue <spec: str>             : Play a file from a timeline frame (sample accurate). Repeatable.\n"
+           "                                spec: <file>@<start frame>[,<gain dB>[,<loop start>[,<loop end>]]]\n"
+           "                                loop points are file frames (loop end omitted: end of data).\n"
            );
 }
 
-void displayInformation(AudioManipulator& aOut, GaplessLooper& wf,
-                        int readLength, int barLength, float wPeak) {
-    float dbwPeak = 0.0;
-    float dbPos = 0.0;
+int displayLineCount(LevelMeter& meter) {
+    return 2 + (int)meter.getChannels();
+}
+
+void printFileHeader(const std::string& name, LevelMeter& meter, const char* note="") {
+    //ファイル名の表示: 下の '\033[nA'でn行分上書きされるため改行を追加
+    printf("File: %s%s\n", name.c_str(), note);
+    for (int ctr=0; ctr < displayLineCount(meter); ctr++) {
+        putchar('\n');
+    }
+}
+
+// --normalize: gain (dB) of a playlist entry, and a note for the file header
+double getEntryGain(const Playlist::Iterator& item, double targetLoudness, char* note, std::size_t noteLength) {
+    WaveHeader header;
+    if (!item.getHeader(header) || !header.hasLoudness) {
+        snprintf(note, noteLength, " (loudness not analysed yet)");
+        return 0.0;
+    }
+    double gain = LoudnessAnalyzer::getNormalizeGain(header, targetLoudness);
+    snprintf(note, noteLength, " (%.1f LUFS, %.1f dBTP, gain %+.1f dB)", header.loudness, header.truePeak, gain);
+    return gain;
+}
+
+// peak (held) / RMS / true peak of each channel (the last line without a newline)
+void printMeterLines(LevelMeter& meter, int barLength) {
     constexpr float dbMin = -24.0;
-    puts("\r\033[3A");
+    for (uint32_t ch=0; ch < meter.getChannels(); ch++) {
+        float dbPos = 0.0;
+        float dbHeld = LevelMeter::toDB(meter.getHeldPeak(ch));
+        if (meter.getHeldPeak(ch) > 0) {
+            dbPos = dbMin - dbHeld;
+            dbPos /= dbMin;
+        }
+        printRatBar(dbPos, 1.0f, barLength, false, '>', ' ', true, true);
+        printf("|%6.1f|%6.1f", dbHeld, LevelMeter::toDB(meter.getRms(ch)));
+        if (meter.isTruePeakEnabled()) {
+            printf("|TP%6.1f", LevelMeter::toDB(meter.getTruePeak(ch)));
+        }
+        if (ch+1 < meter.getChannels()) {
+            putchar('\n');
+        }
+    }
+}
+
+void displayInformation(AudioManipulator& aOut, GaplessLooper& wf,
+                        int readLength, int barLength, LevelMeter& meter,
+                        long denormalEvents=-1, double syncError=-1, Limiter* limiter=nullptr) {
+    printf("\r\033[%dA\n", displayLineCount(meter));
     printRatBar(aOut.getRbStoredChunkLength(), aOut.getRbChunkLength(), barLength, true, '*', ' ', true);
-    printf("|%6d|%6lu|%9lu|%9lu|\n", readLength, aOut.getTxCbFrameCount(), aOut.getRbStoredLength(), aOut.getRbLength());
+    printf("|%6d|%6lu|%9lu|%9lu|", readLength, aOut.getTxCbFrameCount(), aOut.getRbStoredLength(), aOut.getRbLength());
+    if (denormalEvents >= 0) {
+        printf("DN:%ld|", denormalEvents);
+    }
+    if (syncError >= 0) {
+        printf("SY:%.1f|", syncError);
+    }
+    if (limiter) {
+        printf("GR:%5.1f|", limiter->getReduction());
+    }
+    putchar('\n');
     // print read position
     printRatBar(wf.getPosition(), wf.getDataSize(), barLength, false, '-', ' ');
-    printf("|%6.1f / %6.1f\n", wf.getPositionInSeconds(), wf.getLengthInSeconds());
-    // print peak
-    dbwPeak = 20*log10(wPeak);
-    if (wPeak > 0) {
-        dbPos = dbMin - dbwPeak;
-        dbPos /= dbMin;
+    printf("|%6.1f / %6.1f", wf.getPositionInSeconds(), wf.getLengthInSeconds());
+    // position actually at the DAC
+    AudioManipulator::PlaybackPosition heard = aOut.getPlaybackPosition();
+    if (heard.valid) {
+        printf("|heard %8.3f +-%.2f msec", heard.seconds, heard.errorSeconds*1000);
     }
-
-    printRatBar(dbPos, 1.0f, barLength, false, '>', ' ', true, true);
-    printf("|%6.1f", dbwPeak);
+    printf("\033[K\n");
+    printMeterLines(meter, barLength);
     fflush(stdout);
 }
 
+void printMeterSummary(LevelMeter& meter) {
+    for (uint32_t ch=0; ch < meter.getChannels(); ch++) {
+        printf("CH%u: max peak %6.1f dBFS", ch, LevelMeter::toDB(meter.getMaxPeak(ch)));
+        if (meter.isTruePeakEnabled()) {
+            printf(", max true-peak %6.1f dBTP", LevelMeter::toDB(meter.getMaxTruePeak(ch)));
+        }
+        putchar('\n');
+    }
+}
+
+int runLatencyCalibration(uint32_t deviceIndex, const std::string& fileName, double soakTime,
+                          const std::string& profilePath, bool verbose) {
+    AudioManipulator initOnly;
+    GaplessLooper* source = nullptr;
+    double fs = AudioManipulator::getDefaultSampleRate(deviceIndex);
+    int channels = 2;
+    if (!fileName.empty()) {
+        source = new GaplessLooper(fileName, verbose);
+        if (!source->isFileOpened() || !source->isWaveFile()) {
+            printf("Cannot open file: %s\n", fileName.c_str());
+            delete source;
+            return -1;
+        }
+        fs = source->getSampleFreq();
+        channels = source->getChannels();
+    }
+    if (fs <= 0) {
+        printf("Device not available.\n");
+        return -1;
+    }
+    LatencyCalibrator calibrator(deviceIndex, fs, channels,
+        [source, channels](float* dest, uint32_t frames) {
+            if (source) {
+                source->prepareFrame(dest, frames);
+            } else {
+                memset(dest, 0, sizeof(float)*frames*channels);
+            }
+        });
+    calibrator.setSoakTime(soakTime);
+    calibrator.setAbortFlag(&KeyboardInterrupt);
+    LatencySetting best;
+    bool found = calibrator.run(best);
+    if (source) {
+        delete source;
+    }
+    if (!found) {
+        printf("No stable configuration found.\n");
+        return -1;
+    }
+    printf("\nLowest stable configuration (%s, %.0f Hz):\n", calibrator.getDeviceName().c_str(), fs);
+    printf("  --chunklength %u --rblength %u --frames-per-buffer %lu --latency %.3f\n",
+           best.chunkLength, best.rbLength, best.framesPerBuffer, best.suggestedLatency*1000);
+    if (!profilePath.empty()) {
+        LatencyProfile profile;
+        profile.load(profilePath);
+        profile.store(calibrator.getDeviceName(), fs, best);
+        if (profile.save(profilePath)) {
+            printf("Saved to %s\n", profilePath.c_str());
+        } else {
+            printf("Cannot write %s\n", profilePath.c_str());
+        }
+    }
+    return 0;
+}
+
+// Capture from an input device into a WAVE file.
+// The callback only copies into the lock-free ring buffer; a writer thread drains it
+// in large batches, converts and writes, and patches the header every few seconds.
+int runRecorder(uint32_t deviceIndex, const std::string& fileName, int channels, double fs,
+                WF_Format format, uint32_t chunkLength, bool truePeak, const RealtimeConfig& rtConfig) {
+    constexpr double headerInterval = 2.0;
+    constexpr double ringSeconds = 4.0;
+    AudioManipulator initOnly;
+    if (fs <= 0) {
+        fs = AudioManipulator::getDefaultSampleRate(deviceIndex);
+    }
+    if (fs <= 0) {
+        printf("Device not available.\n");
+        return -1;
+    }
+    uint32_t ringLength = (uint32_t)(fs*ringSeconds);
+    if (ringLength < chunkLength*8) {
+        ringLength = chunkLength*8;
+    }
+    AudioManipulator aIn(deviceIndex, "i", fs, "f32", channels, ringLength, chunkLength);
+    if (!aIn.isDeviceAvailable()) {
+        printf("Device not available.\n");
+        return -1;
+    }
+    channels = aIn.getChannelCount();
+    WaveWriter writer(fileName, (uint32_t)fs, channels, format);
+    if (!writer.isFileOpened()) {
+        printf("Cannot open file: %s\n", fileName.c_str());
+        return -1;
+    }
+    LevelMeter meter(channels, fs, truePeak);
+    std::atomic<bool> stopWriter{false};
+    std::atomic<bool> writeFailed{false};
+
+    if (rtConfig.lockMemory) {
+        aIn.prefault();
+    }
+    aIn.start();
+    std::thread writerThread([&]() {
+        // drain about half a second per batch
+        uint32_t batchFrames = (uint32_t)(fs/2);
+        std::vector<AudioData> batch((size_t)batchFrames*channels);
+        uint64_t sinceUpdate = 0;
+        bool draining = false;
+        while (true) {
+            uint32_t got = aIn.readAvailable(batch.data(), batchFrames);
+            if (got > 0) {
+                meter.process(&(batch[0].f32), got);
+                writer.write(&(batch[0].f32), got);
+                sinceUpdate += got;
+                if (sinceUpdate >= (uint64_t)(fs*headerInterval)) {
+                    writer.updateHeader();
+                    sinceUpdate = 0;
+                }
+                if (writer.isError()) {
+                    writeFailed.store(true);
+                    break;
+                }
+            }
+            if (got < batchFrames) {
+                if (draining) {
+                    break;
+                }
+                if (stopWriter.load()) {
+                    // the stream is stopped: one more pass empties the ring
+                    draining = true;
+                    continue;
+                }
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            }
+        }
+    });
+
+    RealtimeSetup::applyAffinity(rtConfig.cpus);
+    printf("Recording: %s (%d ch, %.0f Hz, %s) - Ctrl+C to stop\n",
+           fileName.c_str(), channels, fs, aIn.getDeviceName().c_str());
+    printFileHeader(fileName, meter);
+    int barLength = 50;
+    while (!KeyboardInterrupt.load() && !writeFailed.load()) {
+        printf("\r\033[%dA\n", displayLineCount(meter));
+        printRatBar(aIn.getRbStoredChunkLength(), aIn.getRbChunkLength(), barLength, true, '*', ' ', true, true);
+        printf("|%6lu|overrun:%lu|xrun:%lu|\n", aIn.getRxCbFrameCount(),
+               aIn.getRbOverrunCount(), aIn.getCbXrunCount());
+        // the writer thread owns writer: only its published counters are read here
+        printf("%10.1f sec | %8.1f MB%s\n", writer.getWrittenSeconds(),
+               writer.getWrittenBytes()/(1024.0*1024.0), writer.isRF64Written() ? " (RF64)" : "");
+        printMeterLines(meter, barLength);
+        fflush(stdout);
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    }
+    aIn.stop();
+    stopWriter.store(true);
+    writerThread.join();
+    writer.close();
+    printf("\n\nRecorded %.1f sec (%llu frames) to %s%s\n", writer.getLengthInSeconds(),
+           (unsigned long long)writer.getFrameCount(), fileName.c_str(),
+           writer.isRF64File() ? " (RF64)" : "");
+    printf("Overruns: %lu, device xruns: %lu\n", aIn.getRbOverrunCount(), aIn.getCbXrunCount());
+    printMeterSummary(meter);
+    if (writeFailed.load()) {
+        printf("Write error: %s\n", fileName.c_str());
+        return -1;
+    }
+    return 0;
+}
+
+// Measure the round-trip (output -> input) latency count times.
+// loopbackDelay >= 0 replaces the hardware with a software loopback of that many frames.
+int runLatencyMeasurement(uint32_t inDevice, uint32_t outDevice, int count, ProbeSignal signalType,
+                          long loopbackDelay, unsigned long framesPerBuffer, double latency) {
+    AudioManipulator initOnly;
+    double fs = 48000;
+    if (loopbackDelay < 0) {
+        fs = AudioManipulator::getDefaultSampleRate(outDevice);
+        if (fs <= 0) {
+            printf("Device not available.\n");
+            return -1;
+        }
+    }
+    LatencyProbe probe(fs, 1, 2, signalType);
+    LatencyProbeStream* stream = nullptr;
+    LoopbackSink* loopback = nullptr;
+    if (loopbackDelay >= 0) {
+        unsigned long blockFrames = (framesPerBuffer > 0) ? framesPerBuffer : 256;
+        if ((unsigned long)loopbackDelay < blockFrames) {
+            loopbackDelay = blockFrames;
+        }
+        printf("Software loopback: %ld frames (block: %lu frames)\n", loopbackDelay, blockFrames);
+        loopback = new LoopbackSink(loopbackDelay);
+    } else {
+        stream = new LatencyProbeStream(inDevice, outDevice, probe, framesPerBuffer, latency);
+        if (!stream->isOpened() || !stream->start()) {
+            printf("Device not available.\n");
+            delete stream;
+            return -1;
+        }
+        printf("Input: %s, Output: %s, %.0f Hz\n", AudioManipulator::getDeviceName(inDevice).c_str(),
+               AudioManipulator::getDeviceName(outDevice).c_str(), fs);
+    }
+    std::vector<long> delays;
+    for (int run=0; (run < count) && !KeyboardInterrupt.load(); run++) {
+        if (loopback) {
+            loopback->run(probe, (framesPerBuffer > 0) ? framesPerBuffer : 256);
+        } else {
+            probe.arm();
+            while (!probe.isFinished() && !KeyboardInterrupt.load()) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            }
+            if (!probe.isFinished()) {
+                break;
+            }
+        }
+        long delay = 0;
+        double quality = 0;
+        if (probe.analyze(delay, quality)) {
+            printf("Run %3d: %7ld frames (%8.3f msec), peak/sidelobe %5.1f dB\n",
+                   run+1, delay, delay*1000.0/fs, quality);
+            delays.push_back(delay);
+        } else {
+            printf("Run %3d: no reliable peak (peak/sidelobe %5.1f dB)\n", run+1, quality);
+        }
+    }
+    double reported = -1;
+    if (stream) {
+        reported = stream->getReportedLatency();
+        stream->stop();
+        delete stream;
+    }
+    if (loopback) {
+        delete loopback;
+    }
+    if (delays.empty()) {
+        printf("No valid measurement. Check the loopback connection and levels.\n");
+        return -1;
+    }
+    double mean = 0;
+    long minDelay = delays.at(0);
+    long maxDelay = delays.at(0);
+    for (std::vector<long>::size_type ctr=0; ctr<delays.size(); ctr++) {
+        mean += delays.at(ctr);
+        minDelay = std::min(minDelay, delays.at(ctr));
+        maxDelay = std::max(maxDelay, delays.at(ctr));
+    }
+    mean /= delays.size();
+    double variance = 0;
+    for (std::vector<long>::size_type ctr=0; ctr<delays.size(); ctr++) {
+        variance += (delays.at(ctr)-mean)*(delays.at(ctr)-mean);
+    }
+    double jitter = sqrt(variance/delays.size());
+    printf("\nRound trip (%zu/%d valid): mean %.1f frames (%.3f msec), jitter %.2f frames (%.3f msec)\n",
+           delays.size(), count, mean, mean*1000.0/fs, jitter, jitter*1000.0/fs);
+    printf("  min %ld / max %ld frames\n", minDelay, maxDelay);
+    if (reported >= 0) {
+        printf("  PortAudio reported (input + output): %.3f msec\n", reported*1000.0);
+    }
+    return 0;
+}
+
+// Play every file of mixPaths at once through MixEngine (all streams start together),
+// and the cues at their timeline frames.
+int runMixer(uint32_t deviceIndex, const std::vector<std::string>& mixPaths,
+             const std::vector<CueScheduler::CueSpec>& cues, uint32_t threads,
+             bool noLoop, uint32_t chunkLength, uint32_t rbLength, const LatencySetting& latencySetting,
+             bool truePeak, const RealtimeConfig& rtConfig, BiquadBank* eq, Limiter* limiter) {
+    constexpr uint32_t nCH = 2;
+    uint32_t fs = 0;
+    {
+        std::string firstPath = mixPaths.empty() ? cues.at(0).fileName : mixPaths.at(0);
+        WaveFile first(firstPath, "r");
+        if (!first.isFileOpened() || !first.isWaveFile()) {
+            printf("Cannot open file: %s\n", firstPath.c_str());
+            return -1;
+        }
+        fs = first.getSampleFreq();
+    }
+    MixEngine engine(mixPaths.size(), nCH, fs, chunkLength, mixPaths.empty() ? 1 : threads);
+    for (std::vector<std::string>::size_type ctr=0; ctr<mixPaths.size(); ctr++) {
+        int id = engine.addStream(mixPaths.at(ctr), !noLoop);
+        if (id < 0) {
+            return -1;
+        }
+        engine.start(id);
+    }
+    CueScheduler timeline(nCH, fs, chunkLength);
+    for (std::vector<CueScheduler::CueSpec>::size_type ctr=0; ctr<cues.size(); ctr++) {
+        if (timeline.addCue(cues.at(ctr)) < 0) {
+            return -1;
+        }
+    }
+    AudioManipulator aOut(deviceIndex, "o", (double)fs, "f32", nCH, rbLength, chunkLength,
+                          latencySetting.framesPerBuffer, latencySetting.suggestedLatency);
+    if (!aOut.isDeviceAvailable()) {
+        printf("Device not available.\n");
+        return -1;
+    }
+    std::vector<AudioData> aData(chunkLength*nCH);
+    LevelMeter meter(nCH, fs, truePeak);
+    // the sum of the fader may exceed 0 dBFS: --eq, then --limit before the meter
+    DspChain outputChain;
+    MeterStage meterStage(meter);
+    if (eq) {
+        eq->commit();
+        outputChain.add(eq);
+    }
+    if (limiter) {
+        outputChain.add(limiter);
+    }
+    outputChain.add(&meterStage);
+    outputChain.prepare(chunkLength, nCH, fs);
+    if (rtConfig.lockMemory) {
+        aOut.prefault();
+        RealtimeSetup::prefaultStack();
+    }
+    printf("Mixing %u streams on %u threads and %u cues (%u Hz, %s)\n", engine.getStreamCount(),
+           engine.getThreadCount(), timeline.getPendingCount(), fs, aOut.getDeviceName().c_str());
+    printFileHeader(mixPaths.empty() ? std::string("(timeline)") :
+                    mixPaths.at(0) + (mixPaths.size() > 1 ? " + ..." : ""), meter);
+    aOut.start();
+    RealtimeSetup::applyAffinity(rtConfig.cpus);
+    RealtimeSetup::applyScheduling(rtConfig.priority, rtConfig.roundRobin);
+    // render() waits for the pool workers: they run at the same priority on the same CPUs
+    engine.runOnWorkers([&]() {
+        RealtimeSetup::applyAffinity(rtConfig.cpus, false);
+        RealtimeSetup::applyScheduling(rtConfig.priority, rtConfig.roundRobin, false);
+    });
+    ScopedFlushDenormals ftz;
+    int barLength = 50;
+    double renderTime = 0;
+    double renderLoad = 0;
+    uint32_t blockCount = 0;
+    while (!KeyboardInterrupt.load() && ((engine.getPlayingCount() > 0) || !timeline.isIdle())) {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        uint32_t rendered = engine.render(&(aData[0].f32), chunkLength);
+        timeline.render(&(aData[0].f32), rendered);
+        renderTime += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        outputChain.process(&(aData[0].f32), rendered);
+        aOut.blockingWrite(aData.data(), rendered, 1000);
+        // the cues render() has finished are closed here, after the block is queued
+        timeline.collect();
+        if (++blockCount == 16) {
+            // decode + mix time relative to real time
+            renderLoad = renderTime / (16.0*chunkLength/fs);
+            renderTime = 0;
+            blockCount = 0;
+        }
+        printf("\r\033[%dA\n", displayLineCount(meter));
+        printRatBar(aOut.getRbStoredChunkLength(), aOut.getRbChunkLength(), barLength, true, '*', ' ', true);
+        printf("|%6lu|%9lu|%9lu|\n", aOut.getTxCbFrameCount(), aOut.getRbStoredLength(), aOut.getRbLength());
+        printf("playing %u / %u streams | cues %u / %u pending | %10.3f sec | load %5.1f%%",
+               engine.getPlayingCount(), engine.getStreamCount(), timeline.getActiveCount(),
+               timeline.getPendingCount(), (double)timeline.getTimelineFrame()/fs, renderLoad*100.0);
+        if (limiter) {
+            printf(" | GR %5.1f dB", limiter->getReduction());
+        }
+        printf("\033[K\n");
+        printMeterLines(meter, barLength);
+        fflush(stdout);
+    }
+    // the look-ahead of the limiter still holds the end of the mix
+    for (uint32_t left=outputChain.getLatency(); (left > 0) && !KeyboardInterrupt.load(); ) {
+        uint32_t frames = std::min(left, chunkLength);
+        memset(&(aData[0].f32), 0, sizeof(float)*frames*nCH);
+        outputChain.process(&(aData[0].f32), frames);
+        aOut.blockingWrite(aData.data(), frames, 1000);
+        left -= frames;
+    }
+    while (!KeyboardInterrupt.load() && (aOut.wait(50) != 0)) {
+    }
+    puts("\n");
+    printMeterSummary(meter);
+    if (limiter) {
+        limiter->printStats();
+    }
+    if (KeyboardInterrupt.load()) {
+        printf("\nKeyboardInterrupt.\n");
+    }
+    aOut.stop();
+    return 0;
+}
+
 int main(int argc, char* argv[]) {
 #if defined(__linux__) || defined(__APPLE__)
     struct sigaction sa = {};
@@ -207,11 +715,55 @@ int main(int argc, char* argv[]) {
         {"list-devices", no_argument, 0, 1000},
         {"loadonly", no_argument, 0, 1001},
         {"noloop", no_argument, 0, 1002},
+        {"truepeak", no_argument, 0, 1003},
+        {"calibrate-latency", no_argument, 0, 1004},
+        {"rb-auto", no_argument, 0, 1005},
+        {"measure-latency", no_argument, 0, 1006},
+        {"no-index", no_argument, 0, 1007},
+        {"shuffle", no_argument, 0, 1008},
+        {"trim-silence", no_argument, 0, 1009},
+        {"normalize", no_argument, 0, 1010},
+        {"limit", no_argument, 0, 1011},
         {"output-device", required_argument, 0, 2000},
         {"chunklength", required_argument, 0, 2001},
         {"file", required_argument, 0, 2002},
         {"rblength", required_argument, 0, 2003},
+        {"soak", required_argument, 0, 2004},
+        {"latency-profile", required_argument, 0, 2005},
+        {"frames-per-buffer", required_argument, 0, 2006},
+        {"latency", required_argument, 0, 2007},
+        {"rb-max", required_argument, 0, 2008},
+        {"rb-quiet", required_argument, 0, 2009},
+        {"record", required_argument, 0, 2010},
+        {"input-device", required_argument, 0, 2011},
+        {"record-channels", required_argument, 0, 2012},
+        {"record-rate", required_argument, 0, 2013},
+        {"record-format", required_argument, 0, 2014},
+        {"measure-count", required_argument, 0, 2015},
+        {"probe-signal", required_argument, 0, 2016},
+        {"loopback-delay", required_argument, 0, 2017},
+        {"sync-devices", required_argument, 0, 2018},
+        {"mix", required_argument, 0, 2019},
+        {"mix-threads", required_argument, 0, 2020},
+        {"cue", required_argument, 0, 2021},
+        {"cache-size", required_argument, 0, 2022},
+        {"index", required_argument, 0, 2023},
+        {"scan-threads", required_argument, 0, 2024},
+        {"playlist", required_argument, 0, 2025},
+        {"repeat", required_argument, 0, 2026},
+        {"crossfade", required_argument, 0, 2027},
+        {"trim-threshold", required_argument, 0, 2028},
+        {"target-loudness", required_argument, 0, 2029},
+        {"eq", required_argument, 0, 2030},
+        {"limit-ceiling", required_argument, 0, 2031},
+        {"limit-lookahead", required_argument, 0, 2032},
+        {"limit-release", required_argument, 0, 2033},
+        {"rt-priority", required_argument, 0, 3000},
+        {"rt-policy", required_argument, 0, 3001},
+        {"cpu-affinity", required_argument, 0, 3002},
+        {"mlock", no_argument, 0, 3003},
         {"verbose", no_argument, 0, 8001},
+        {"benchmark", required_argument, 0, 8100},
         {"directory", required_argument, 0, 9001},
         {0, 0, 0, 0}
     };
@@ -221,11 +773,54 @@ int main(int argc, char* argv[]) {
     bool noLoop = false;
     bool dirMode = false;
     bool verbose = false;
+    bool truePeak = false;
     std::string fileName;
     std::string dirName;
     uint32_t oDeviceIndex = 0;
     uint32_t ioChunkLength = 1024;
     uint32_t ioRBLength = ioChunkLength*8;
+    RealtimeConfig rtConfig;
+    std::string benchmarkName;
+    bool calibrateLatency = false;
+    double soakTime = 5.0;
+    std::string latencyProfilePath;
+    LatencySetting latencySetting;
+    bool chunkLengthSet = false;
+    bool rbLengthSet = false;
+    bool framesPerBufferSet = false;
+    bool latencySet = false;
+    bool rbAuto = false;
+    uint32_t rbMaxLength = 0;
+    double rbQuietTime = 30.0;
+    std::string recordFileName;
+    uint32_t iDeviceIndex = 0;
+    int recordChannels = 2;
+    double recordRate = 0;
+    WF_Format recordFormat = SIGNED_24;
+    bool measureLatency = false;
+    int measureCount = 10;
+    ProbeSignal probeSignal = PROBE_MLS;
+    long loopbackDelay = -1;
+    std::vector<int> syncDevices;
+    std::vector<std::string> mixPaths;
+    uint32_t mixThreads = 0;
+    std::vector<CueScheduler::CueSpec> cues;
+    uint64_t cacheBudget = 256ULL << 20;
+    bool useIndex = true;
+    std::string indexPath;
+    uint32_t scanThreads = 0;
+    std::string listName;
+    bool shuffle = false;
+    bool repeatSet = false;
+    Playlist::Repeat repeat = Playlist::REPEAT_ALL;
+    double crossfadeTime = 0;
+    bool trimSilence = false;
+    double trimThreshold = -80.0;
+    bool normalize = false;
+    double targetLoudness = -18.0;
+    BiquadBank eq;
+    bool limit = false;
+    Limiter limiter;
     do {
         getoptStatus = getopt_long(argc, argv, "", long_options, &optionIndex);
         switch (getoptStatus) {
@@ -245,6 +840,33 @@ int main(int argc, char* argv[]) {
             case 1002:
                 noLoop = true;
                 break;
+            case 1003:
+                truePeak = true;
+                break;
+            case 1004:
+                calibrateLatency = true;
+                break;
+            case 1005:
+                rbAuto = true;
+                break;
+            case 1006:
+                measureLatency = true;
+                break;
+            case 1007:
+                useIndex = false;
+                break;
+            case 1008:
+                shuffle = true;
+                break;
+            case 1009:
+                trimSilence = true;
+                break;
+            case 1010:
+                normalize = true;
+                break;
+            case 1011:
+                limit = true;
+                break;
             case 2000:
                 try {
                     oDeviceIndex = std::stoi(std::string(optarg));
@@ -260,6 +882,7 @@ int main(int argc, char* argv[]) {
                     printf("Invalid length ( %s )\n", optarg);
                     return -1;
                 }
+                chunkLengthSet = true;
                 break;
             case 2002:
                 fileName.assign(optarg);
@@ -271,10 +894,282 @@ int main(int argc, char* argv[]) {
                     printf("Invalid length ( %s )\n", optarg);
                     return -1;
                 }
+                rbLengthSet = true;
+                break;
+            case 2004:
+                try {
+                    soakTime = std::stod(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid time ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2005:
+                latencyProfilePath.assign(optarg);
+                break;
+            case 2006:
+                try {
+                    latencySetting.framesPerBuffer = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid length ( %s )\n", optarg);
+                    return -1;
+                }
+                framesPerBufferSet = true;
+                break;
+            case 2007:
+                try {
+                    latencySetting.suggestedLatency = std::stod(std::string(optarg)) / 1000.0;
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid latency ( %s )\n", optarg);
+                    return -1;
+                }
+                latencySet = true;
+                break;
+            case 2008:
+                try {
+                    rbMaxLength = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid length ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2009:
+                try {
+                    rbQuietTime = std::stod(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid time ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2010:
+                recordFileName.assign(optarg);
+                break;
+            case 2011:
+                try {
+                    iDeviceIndex = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Input: Invalid index ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2012:
+                try {
+                    recordChannels = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid channels ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2013:
+                try {
+                    recordRate = std::stod(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid rate ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2014:
+                if (std::string(optarg) == "16") {
+                    recordFormat = SIGNED_16;
+                } else if (std::string(optarg) == "24") {
+                    recordFormat = SIGNED_24;
+                } else if (std::string(optarg) == "32") {
+                    recordFormat = SIGNED_32;
+                } else if (std::string(optarg) == "f32") {
+                    recordFormat = FLOAT_32;
+                } else {
+                    printf("Invalid format ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2015:
+                try {
+                    measureCount = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid count ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2016:
+                if (std::string(optarg) == "mls") {
+                    probeSignal = PROBE_MLS;
+                } else if (std::string(optarg) == "impulse") {
+                    probeSignal = PROBE_IMPULSE;
+                } else {
+                    printf("Invalid signal ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2017:
+                try {
+                    loopbackDelay = std::stol(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid length ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2018:
+                // same list syntax as --cpu-affinity
+                if (!RealtimeSetup::parseCpuList(std::string(optarg), syncDevices)) {
+                    printf("Invalid device list ( %s )\n", optarg);
+                    return -1;
+                }
+                oDeviceIndex = syncDevices.at(0);
+                break;
+            case 2019:
+                mixPaths.push_back(std::string(optarg));
+                break;
+            case 2020:
+                try {
+                    mixThreads = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid thread count ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2021:
+                {
+                    CueScheduler::CueSpec spec;
+                    if (!CueScheduler::parseCueSpec(std::string(optarg), spec)) {
+                        printf("Invalid cue ( %s )\n", optarg);
+                        return -1;
+                    }
+                    cues.push_back(spec);
+                }
+                break;
+            case 2022:
+                try {
+                    cacheBudget = (uint64_t)std::stoul(std::string(optarg)) << 20;
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid size ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2023:
+                indexPath.assign(optarg);
+                break;
+            case 2024:
+                try {
+                    scanThreads = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid thread count ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2025:
+                listName.assign(optarg);
+                break;
+            case 2026: {
+                std::string mode(optarg);
+                if (mode == "off") {
+                    repeat = Playlist::REPEAT_OFF;
+                } else if (mode == "one") {
+                    repeat = Playlist::REPEAT_ONE;
+                } else if (mode == "all") {
+                    repeat = Playlist::REPEAT_ALL;
+                } else {
+                    printf("Invalid repeat mode ( %s )\n", optarg);
+                    return -1;
+                }
+                repeatSet = true;
+                break;
+            }
+            case 2027:
+                try {
+                    crossfadeTime = std::stod(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid time ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2028:
+                try {
+                    trimThreshold = std::stod(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid level ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2029:
+                try {
+                    targetLoudness = std::stod(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid loudness ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2030: {
+                uint32_t channel = 0;
+                EqBand band;
+                bool added = BiquadBank::parseBand(std::string(optarg), channel, band) && (channel <= eq.getMaxChannels());
+                for (uint32_t ch=0; added && (ch<eq.getMaxChannels()); ch++) {
+                    if ((channel == 0) || (channel == ch+1)) {
+                        added = eq.addBand(ch, band);
+                    }
+                }
+                if (!added) {
+                    printf("Invalid EQ band ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+            case 2031:
+                try {
+                    limiter.setCeiling(std::stod(std::string(optarg)));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid level ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2032:
+                try {
+                    limiter.setLookahead(std::stod(std::string(optarg)) / 1000.0);
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid time ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 2033:
+                try {
+                    limiter.setRelease(std::stod(std::string(optarg)) / 1000.0);
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid time ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 3000:
+                try {
+                    rtConfig.priority = std::stoi(std::string(optarg));
+                } catch (const std::invalid_argument& e) {
+                    printf("Invalid priority ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 3001:
+                if (std::string(optarg) == "rr") {
+                    rtConfig.roundRobin = true;
+                } else if (std::string(optarg) == "fifo") {
+                    rtConfig.roundRobin = false;
+                } else {
+                    printf("Invalid policy ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 3002:
+                if (!RealtimeSetup::parseCpuList(std::string(optarg), rtConfig.cpus)) {
+                    printf("Invalid CPU list ( %s )\n", optarg);
+                    return -1;
+                }
+                break;
+            case 3003:
+                rtConfig.lockMemory = true;
                 break;
             case 8001:
                 verbose = true;
                 break;
+            case 8100:
+                benchmarkName.assign(optarg);
+                break;
             case 9001:
                 dirName.assign(optarg);
                 dirMode = true;
@@ -284,30 +1179,86 @@ int main(int argc, char* argv[]) {
         }
     } while (getoptStatus != -1);
 
-    std::vector<std::string> paths;
-    if (dirMode) {
-        for (const std::filesystem::directory_entry& dirinfo : std::filesystem::directory_iterator(dirName)) {
-            std::string path(dirinfo.path().c_str());
-            std::string lcpath((std::string::size_type)path.length(), 0);
-            for (std::string::size_type sidx=0; sidx < path.length(); sidx++) {
-                lcpath.at(sidx) = std::tolower(path.at(sidx));
+    if (!benchmarkName.empty()) {
+        return Benchmark::run(benchmarkName, ioChunkLength) ? 0 : -1;
+    }
+    if (calibrateLatency) {
+        return runLatencyCalibration(oDeviceIndex, fileName, soakTime, latencyProfilePath, verbose);
+    }
+    if (measureLatency) {
+        return runLatencyMeasurement(iDeviceIndex, oDeviceIndex, measureCount, probeSignal, loopbackDelay,
+                                     latencySetting.framesPerBuffer, latencySetting.suggestedLatency);
+    }
+    if (!recordFileName.empty()) {
+        if (rtConfig.lockMemory) {
+            RealtimeSetup::lockMemory();
+        }
+        return runRecorder(iDeviceIndex, recordFileName, recordChannels, recordRate,
+                           recordFormat, ioChunkLength, truePeak, rtConfig);
+    }
+    if (!mixPaths.empty() || !cues.empty()) {
+        if (rtConfig.lockMemory) {
+            RealtimeSetup::lockMemory();
+        }
+        return runMixer(oDeviceIndex, mixPaths, cues, mixThreads, noLoop, ioChunkLength, ioRBLength,
+                        latencySetting, truePeak, rtConfig, eq.isEmpty() ? nullptr : &eq, limit ? &limiter : nullptr);
+    }
+
+    // decoded files stay in memory for the next loop / playlist pass
+    PcmCache pcmCache(cacheBudget);
+    // --directory (sorted, recursive; streamed in while it is checked) or --playlist
+    bool playlistMode = dirMode || !listName.empty();
+    Playlist playlist;
+    LibraryScan scan(playlist, dirName, indexPath, useIndex, scanThreads, verbose);
+    // file changes reuse these readers (no allocation once they are warmed up)
+    ReaderPool readers(4);
+    // the next entry is opened (and its head decoded) while the current one plays
+    FilePrefetcher prefetcher(playlist, pcmCache, readers, verbose);
+    PrefetchedFile playing;
+    PrefetchedFile upcoming;
+    if (playlistMode) {
+        playlist.setOrder(shuffle ? Playlist::ORDER_SHUFFLE : Playlist::ORDER_SEQUENTIAL);
+        if (!repeatSet && noLoop) {
+            repeat = Playlist::REPEAT_OFF;
+        }
+        playlist.setRepeat(repeat);
+        if (dirMode) {
+            if (trimSilence) {
+                scan.setSilenceTrim(trimThreshold);
             }
-            if (lcpath.find(".wav") != std::string::npos) {
-                paths.push_back(path.c_str());
+            scan.setLoudnessAnalysis(normalize);
+            scan.start();
+        } else {
+            if (!playlist.loadList(listName)) {
+                printf("Cannot open file: %s\n", listName.c_str());
+                return -1;
             }
+            playlist.close();
+        }
+        prefetcher.start();
+        prefetcher.request(playlist.begin(), nullptr, 0, false);
+        if (prefetcher.take(playing)) {
+            curWF = playing.reader;
+            // aData, the meter and the output device are opened for the first file
+            prefetcher.setChannels(curWF->getChannels());
+        }
+        if (!curWF) {
+            printf("No playable files in %s\n", dirMode ? dirName.c_str() : listName.c_str());
+            if (dirMode) {
+                scan.printStats();
+            }
+            return -1;
+        }
+        if (verbose) {
+            printf("Playlist: %lu entries (%s), %.1f MB\n", (unsigned long)playlist.size(),
+                   playlist.isClosed() ? "complete" : "scanning", playlist.getMemoryUsage()/1048576.0);
         }
-        std::sort(paths.begin(), paths.end());
-        curWF = new GaplessLooper(paths.at(0), verbose);
     } else {
-        curWF = new GaplessLooper(fileName, verbose);
+        curWF = pcmCache.open(fileName, verbose);
     }
 
     if (!curWF->isFileOpened()) {
-        if (dirMode){
-            printf("Cannot open file: %s\n", paths.at(0).c_str());
-        } else {
-            printf("Cannot open file: %s\n", fileName.c_str());
-        }
+        printf("Cannot open file: %s\n", fileName.c_str());
         return -1;
     }
     if (!(curWF->isWaveFile())) {
@@ -315,18 +1266,80 @@ int main(int argc, char* argv[]) {
         return -1;
     }
     if (loadonly) {
+        if (dirMode) {
+            scan.wait();
+            scan.printStats();
+        }
         return 0;
     }
+    if (rtConfig.lockMemory) {
+        RealtimeSetup::lockMemory();
+    }
 
+    if (!latencyProfilePath.empty()) {
+        AudioManipulator initOnly;
+        LatencyProfile profile;
+        LatencySetting stored;
+        if (profile.load(latencyProfilePath)
+            && profile.find(AudioManipulator::getDeviceName(oDeviceIndex), curWF->getSampleFreq(), stored)) {
+            // explicit options take precedence over the stored setting
+            if (!chunkLengthSet) {
+                ioChunkLength = stored.chunkLength;
+            }
+            if (!rbLengthSet) {
+                ioRBLength = stored.rbLength;
+            }
+            if (!framesPerBufferSet) {
+                latencySetting.framesPerBuffer = stored.framesPerBuffer;
+            }
+            if (!latencySet) {
+                latencySetting.suggestedLatency = stored.suggestedLatency;
+            }
+            printf("Latency profile: chunklength %u, rblength %u, frames/buffer %lu, latency %.2f msec\n",
+                   ioChunkLength, ioRBLength, latencySetting.framesPerBuffer,
+                   latencySetting.suggestedLatency*1000);
+        }
+    }
+
+    // opened with the channels of the (first) file: the chunks are written as they are read
     AudioManipulator aOut(oDeviceIndex, "o",
-                          (double)curWF->getSampleFreq(), "f32", 2,
-                          ioRBLength, ioChunkLength);
+                          (double)curWF->getSampleFreq(), "f32", curWF->getChannels(),
+                          ioRBLength, ioChunkLength,
+                          latencySetting.framesPerBuffer, latencySetting.suggestedLatency);
 
     if (!aOut.isDeviceAvailable()) {
         printf("Device not available.\n");
         return -1;
     }
 
+    // --sync-devices: the first device (aOut) is the master, the others follow its clock
+    std::vector<AudioManipulator*> syncOuts;
+    std::vector<DeviceOutputSink*> syncSinks;
+    MultiOutputSync* syncGroup = nullptr;
+    if (syncDevices.size() > 1) {
+        syncGroup = new MultiOutputSync(aOut.getChannelCount(), (double)curWF->getSampleFreq());
+        syncSinks.push_back(new DeviceOutputSink(&aOut));
+        syncGroup->addOutput(syncSinks.back());
+        for (std::vector<int>::size_type ctr=1; ctr<syncDevices.size(); ctr++) {
+            AudioManipulator* aSync = new AudioManipulator(syncDevices.at(ctr), "o",
+                                      (double)curWF->getSampleFreq(), "f32", aOut.getChannelCount(),
+                                      ioRBLength, ioChunkLength,
+                                      latencySetting.framesPerBuffer, latencySetting.suggestedLatency);
+            if (!aSync->isDeviceAvailable() || (aSync->getChannelCount() != aOut.getChannelCount())) {
+                printf("Device not available: %d\n", syncDevices.at(ctr));
+                return -1;
+            }
+            syncOuts.push_back(aSync);
+            syncSinks.push_back(new DeviceOutputSink(aSync));
+            syncGroup->addOutput(syncSinks.back());
+        }
+        printf("Synchronized output: master %d (%s)", syncDevices.at(0), aOut.getDeviceName().c_str());
+        for (std::vector<AudioManipulator*>::size_type ctr=0; ctr<syncOuts.size(); ctr++) {
+            printf(", %d (%s)", syncDevices.at(ctr+1), syncOuts.at(ctr)->getDeviceName().c_str());
+        }
+        putchar('\n');
+    }
+
     AudioData* aData = nullptr;
     aData = new AudioData[ioChunkLength*curWF->getChannels()];
     if (!aData) {
@@ -337,124 +1350,251 @@ int main(int argc, char* argv[]) {
         aData[ctr].f32 = 0.0;
     }
 
+    RtCheck::init();
+    if (rtConfig.lockMemory) {
+        aOut.prefault();
+        for (std::vector<AudioManipulator*>::size_type ctr=0; ctr<syncOuts.size(); ctr++) {
+            syncOuts.at(ctr)->prefault();
+        }
+        RealtimeSetup::prefaultStack();
+    }
+
     putc('\n', stdout);
     uint32_t readLength = 0;
     aOut.start();
-    aOut.blockingWrite(aData, ioChunkLength, 1000);
+    for (std::vector<AudioManipulator*>::size_type ctr=0; ctr<syncOuts.size(); ctr++) {
+        syncOuts.at(ctr)->start();
+    }
+    if (syncGroup) {
+        syncGroup->write(&(aData[0].f32), ioChunkLength);
+    } else {
+        aOut.blockingWrite(aData, ioChunkLength, 1000);
+    }
+    if (rbAuto) {
+        aOut.setAutoResize(ioRBLength, (rbMaxLength > ioRBLength) ? rbMaxLength : ioRBLength*16, rbQuietTime);
+    }
     int barLength = 50;
-    uint32_t mfInputs = 16;
-    uint32_t mfOutputs = 16;
-    MatrixFader mf1(mfInputs, mfOutputs);
-    if (curWF->getChannels() < 2) {
-        mf1.setCrossPointGain(0, 0, 0.0);
-        mf1.setCrossPointGain(0, 1, 0.0);
-    }
-
-    int interleaveCH = 2;
-    AudioData** deint = nullptr;
-    deint = (AudioData**)calloc(interleaveCH, sizeof(AudioData*));
-    for (int ctr=0; ctr < interleaveCH; ctr++) {
-        deint[ctr] = new AudioData[ioChunkLength];
-    }
-
-    float wPeak = 0;
-    float wABS = 0;
-    std::size_t playedFileCount = 0;
-    if (dirMode) { //ファイル名の表示: 下の '\033[3A'で3行分上書きされるため改行を追加
-        printf("File: %s\n\n\n\n", paths.at(0).c_str());
+
+    // this thread is the decode (read-ahead) thread from here on
+    RealtimeSetup::applyAffinity(rtConfig.cpus);
+    RealtimeSetup::applyScheduling(rtConfig.priority, rtConfig.roundRobin);
+    ScopedFlushDenormals ftz;
+    ScopedFlushDenormals::pollEvents();
+    long denormalEvents = verbose ? 0 : -1;
+
+    LevelMeter meter(curWF->getChannels(), curWF->getSampleFreq(), truePeak);
+    // processing of what is read, on planar buffers (allocated in prepare(); every file
+    // has the channel count of the first one):
+    //   sourceChain: per file, before the files are joined (--normalize)
+    //   outputChain: the chunk as it is written (--eq, --limit, level meter last)
+    DspChain sourceChain;
+    DspChain outputChain;
+    FaderStage normalizer;
+    MeterStage meterStage(meter);
+    char gainNote[96] = "";
+    double upcomingGain = 0.0;
+    if (normalize && playlistMode) {
+        normalizer.setGain(getEntryGain(playing.item, targetLoudness, gainNote, sizeof(gainNote)));
+        sourceChain.add(&normalizer);
+        sourceChain.prepare(ioChunkLength, curWF->getChannels(), curWF->getSampleFreq());
+    } else {
+        normalize = false;
+    }
+    if (!eq.isEmpty()) {
+        eq.commit();
+        outputChain.add(&eq);
+    }
+    if (limit) {
+        outputChain.add(&limiter);
+    }
+    outputChain.add(&meterStage);
+    outputChain.prepare(ioChunkLength, curWF->getChannels(), curWF->getSampleFreq());
+    // --crossfade: the tail of the current file is mixed with the prefetched head of the
+    // next one (same channel count; otherwise the files are spliced gaplessly)
+    uint32_t crossfadeFrames = (uint32_t)(std::max(crossfadeTime, 0.0)*curWF->getSampleFreq());
+    uint32_t headFrames = std::max(crossfadeFrames, ioChunkLength);
+    Crossfade crossfade(crossfadeFrames);
+    uint32_t fadeLength = 0;
+    uint32_t fadePos = 0;
+    bool upcomingTaken = false;
+    bool upcomingFound = false;
+    if (playlistMode) {
+        prefetcher.request(playing.item, nullptr, headFrames);
+        printFileHeader(playing.path, meter, gainNote);
     } else {
-        printf("File: %s\n\n\n\n", fileName.c_str());
+        printFileHeader(fileName, meter);
     }
     while (!KeyboardInterrupt.load()) {
-        wPeak = 0;
-        if (dirMode) {
-            readLength = curWF->prepareFrame(&(aData[0].f32), ioChunkLength, true);
-        } else {
+        // tell the output which file frames this chunk holds (frames still queued in the
+        // master's resampler are written first, and the limiter delays the chunk by its look-ahead)
+        uint32_t markerOffset = (syncGroup ? (uint32_t)syncGroup->getOutput(0)->getBacklog() : 0)
+                                + outputChain.getLatency();
+        if (!playlistMode) {
             readLength = curWF->prepareFrame(&(aData[0].f32), ioChunkLength, noLoop);
+            aOut.pushPositionMarker(0, curWF->chunkStartFrame, markerOffset);
+            if (curWF->chunkWrapped) {
+                aOut.pushPositionMarker(0, curWF->chunkWrapFrame, markerOffset + curWF->chunkWrapOffset);
+            }
+        } else {
+            aOut.pushPositionMarker(playing.item.getStep(), playing.getPosition(), markerOffset);
+            readLength = 0;
         }
-        if (readLength < ioChunkLength) {
-            if (dirMode) {
-                playedFileCount++;
-                if (playedFileCount < paths.size()) {
-                    GaplessLooper* prevWF = nullptr;
-                    prevWF = curWF;
-                    printf("\nFile: %s\n\n\n\n", paths.at(playedFileCount).c_str());
-                    curWF = new GaplessLooper(paths.at(playedFileCount), verbose);
-                    curWF->prepareFrame(&(aData[readLength*prevWF->getChannels()].f32), ioChunkLength-readLength, true);
-                    readLength = ioChunkLength;
-                    delete prevWF;
-                } else {
-                    memset((float*)&(aData[readLength*curWF->getChannels()].f32),
-                        0,
-                        sizeof(float)*(ioChunkLength-readLength)*curWF->getChannels());
-                    if (!noLoop) {
-                        readLength = ioChunkLength;
-                    }
+        // the chunk is filled from the next files at the end of each file (gapless / crossfade)
+        while (playlistMode && (readLength < ioChunkLength)) {
+            uint32_t channels = curWF->getChannels();
+            float* dest = &(aData[readLength*channels].f32);
+            uint32_t want = ioChunkLength - readLength;
+            if (!upcomingTaken && prefetcher.isReady()) {
+                upcomingFound = prefetcher.take(upcoming);
+                upcomingTaken = true;
+                if (upcomingFound && normalize) {
+                    upcomingGain = getEntryGain(upcoming.item, targetLoudness, gainNote, sizeof(gainNote));
                 }
-            } else {
-                memset((float*)&(aData[readLength*curWF->getChannels()].f32),
-                        0,
-                        sizeof(float)*(ioChunkLength-readLength)*curWF->getChannels());
             }
-        }
-        //AudioManipulator::deinterleave(aData, deint, ioChunkLength);
-        //AudioManipulator::interleave(deint, aData, ioChunkLength);
-        // get peak
-        for (uint32_t ctr=0; ctr<(ioChunkLength*aOut.getChannelCount()); ctr++) {
-            wABS = aData[ctr].f32;
-            if (wABS < 0) {
-                wABS *= -1;
+            if ((crossfadeFrames > 0) && (fadeLength == 0) && upcomingFound) {
+                // the fade ends with the current file (shorter for short files)
+                uint64_t remaining = playing.getRemaining();
+                uint32_t frames = std::min<uint64_t>(std::min(crossfadeFrames, upcoming.headFrames), remaining);
+                if (remaining > frames) {
+                    want = std::min<uint64_t>(want, remaining - frames);
+                } else if (frames > 0) {
+                    fadeLength = frames;
+                    fadePos = 0;
+                    crossfade.setLength(fadeLength);
+                }
+            }
+            if (fadeLength > 0) {
+                want = std::min(want, fadeLength - fadePos);
             }
-            if (wPeak < wABS) {
-                wPeak = wABS;
+            uint32_t got = playing.read(dest, want);
+            if (normalize) {
+                sourceChain.process(dest, got);
             }
+            if (fadeLength > 0) {
+                crossfade.mix(dest, &(upcoming.head[fadePos*channels]), channels, fadePos, got,
+                              normalize ? powf(10, upcomingGain/20.0) : 1.0f);
+                fadePos += got;
+            }
+            readLength += got;
+            if ((got == want) && ((fadeLength == 0) || (fadePos < fadeLength))) {
+                continue;
+            }
+            // end of the file: continue with the next one (waits only if it is not opened yet)
+            if (!upcomingTaken) {
+                upcomingFound = prefetcher.take(upcoming);
+                upcomingTaken = true;
+                if (upcomingFound && normalize) {
+                    upcomingGain = getEntryGain(upcoming.item, targetLoudness, gainNote, sizeof(gainNote));
+                }
+            }
+            if (!upcomingFound) {
+                break;
+            }
+            if (normalize) {
+                normalizer.setGain(upcomingGain);
+            }
+            GaplessLooper* finished = playing.reader;
+            std::swap(playing, upcoming);
+            // the part of the head mixed into the fade has been played
+            playing.headPos = fadePos;
+            fadeLength = 0;
+            fadePos = 0;
+            upcoming.reader = nullptr;
+            upcomingTaken = false;
+            upcomingFound = false;
+            prefetcher.request(playing.item, finished, headFrames);
+            curWF = playing.reader;
+            putchar('\n');
+            printFileHeader(playing.path, meter, gainNote);
+            aOut.pushPositionMarker(playing.item.getStep(), playing.getPosition(), markerOffset + readLength);
+        }
+        if (readLength < ioChunkLength) {
+            memset((float*)&(aData[readLength*curWF->getChannels()].f32),
+                    0,
+                    sizeof(float)*(ioChunkLength-readLength)*curWF->getChannels());
+        }
+        // DSP stages and the level meter (per channel of the file being played)
+        outputChain.process(&(aData[0].f32), readLength);
+        if (verbose && ScopedFlushDenormals::pollEvents()) {
+            denormalEvents++;
         }
 
         // print information
-        displayInformation(aOut, *curWF, readLength, barLength, wPeak);
+        displayInformation(aOut, *curWF, readLength, barLength, meter, denormalEvents,
+                           (syncGroup && verbose) ? syncGroup->getMaxError() : -1, limit ? &limiter : nullptr);
         // write audio data to audio output
-        aOut.blockingWrite(aData, readLength, 1000);
+        if (syncGroup) {
+            syncGroup->write(&(aData[0].f32), readLength);
+        } else {
+            aOut.blockingWrite(aData, readLength, 1000);
+        }
+        aOut.updateAutoResize();
 
         if (readLength < ioChunkLength) {
-            break;
-        }
-        if (dirMode && (playedFileCount >= paths.size())) {
-            if (noLoop) {
-                break;
-            } else {
-                delete curWF;
-                playedFileCount = 0;
-                curWF = new GaplessLooper(paths.at(playedFileCount), verbose);
-                printf("\nFile: %s\n\n\n\n", paths.at(playedFileCount).c_str());
+            // the look-ahead of the limiter still holds the end of the data
+            for (uint32_t left=outputChain.getLatency(); (left > 0) && !KeyboardInterrupt.load(); ) {
+                uint32_t frames = std::min(left, ioChunkLength);
+                memset(&(aData[0].f32), 0, sizeof(float)*frames*curWF->getChannels());
+                outputChain.process(&(aData[0].f32), frames);
+                if (syncGroup) {
+                    syncGroup->write(&(aData[0].f32), frames);
+                } else {
+                    aOut.blockingWrite(aData, frames, 1000);
+                }
+                left -= frames;
             }
+            break;
         }
     }
     KeyboardInterrupt.store(false);
     while (aOut.wait(50) != 0) {
-        displayInformation(aOut, *curWF, readLength, barLength, wPeak);
+        displayInformation(aOut, *curWF, readLength, barLength, meter, denormalEvents, -1, limit ? &limiter : nullptr);
         if (KeyboardInterrupt.load()) {
             break;
         }
     }
-    displayInformation(aOut, *curWF, readLength, barLength, wPeak);
+    displayInformation(aOut, *curWF, readLength, barLength, meter, denormalEvents, -1, limit ? &limiter : nullptr);
     puts("\n");
+    printMeterSummary(meter);
+    if (limit) {
+        limiter.printStats();
+    }
+    if (dirMode) {
+        scan.printStats();
+    }
+    // PcmCache / ReaderPool are used by the prefetch thread until here
+    prefetcher.stop();
+    if (playlistMode && pcmCache.isEnabled()) {
+        pcmCache.printStats();
+    }
     if (KeyboardInterrupt.load()) {
         printf("\nKeyboardInterrupt.\n");
     }
 
     printf("Stopping audio output...\n");
     aOut.stop();
+    for (std::vector<AudioManipulator*>::size_type ctr=0; ctr<syncOuts.size(); ctr++) {
+        syncOuts.at(ctr)->stop();
+    }
+    if (syncGroup) {
+        delete syncGroup;
+        for (std::vector<AudioManipulator*>::size_type ctr=0; ctr<syncOuts.size(); ctr++) {
+            delete syncOuts.at(ctr);
+        }
+        for (std::vector<DeviceOutputSink*>::size_type ctr=0; ctr<syncSinks.size(); ctr++) {
+            delete syncSinks.at(ctr);
+        }
+    }
     printf("Audio output stopped.\n");
 
-    // delete deinterleaved data
-    for (int ctr=0; ctr < interleaveCH; ctr++) {
-        delete[] deint[ctr];
-    }
-    free(deint);
     //if (aData) {
         delete[] aData;
     //}
-    if (curWF) {
+    if (playlistMode) {
+        // owned by readers
+        readers.release(playing.reader);
+        readers.release(upcoming.reader);
+    } else if (curWF) {
         delete curWF;
     }
 
@@ -464,6 +1604,12 @@ int main(int argc, char* argv[]) {
 
     aOut.terminate();
     printf("Audio output terminated.\n");
+    if (RtCheck::enabled) {
+        RtCheck::report();
+        if (RtCheck::getViolationCount() > 0) {
+            return 1;
+        }
+    }
     printf("Exit.\n");
 
     return 0;